@@ -0,0 +1,315 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "frontend.h"
+
+
+/*
+  Memory mapped input for raw PCM files and plain PCM WAV files.
+
+  16-bit audio in the machine's byte order is handed straight to
+  the encoder from the mapping (see map_mmap()), so it is never
+  copied by the frontend. Other byte orders and 24/32-bit samples
+  are converted to 16-bit as they are read, in the same way as
+  libsndfile does it (by dropping the low bytes).
+*/
+typedef struct mmap_file_s {
+    unsigned char *base;        // start of the mapping
+    size_t length;              // length of the mapping
+    unsigned char *data;        // first audio sample
+    long samples;               // number of samples (all channels)
+    long pos;                   // next sample to read
+    int bytes_per_sample;
+    int big_endian;             // byte order of the samples (after --byte-swap)
+    int wav;                    // is it a WAV file ?
+} mmap_file_t;
+
+
+static int host_is_big_endian(void)
+{
+    const short one = 1;
+    return *((const char *) &one) == 0;
+}
+
+
+static unsigned int get_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+
+static unsigned long get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long) p[3] << 24);
+}
+
+
+/*
+  parse_wav_header()
+  Find the format and the audio data of a PCM WAV file.
+  Returns -1 if it isn't a WAV file that we can map.
+*/
+static int parse_wav_header(mmap_file_t * mf, SF_INFO * sfinfo)
+{
+    unsigned char *p = mf->base + 12;
+    unsigned char *end = mf->base + mf->length;
+    int have_fmt = 0;
+
+    if (mf->length < 12 || memcmp(mf->base, "RIFF", 4) != 0 || memcmp(mf->base + 8, "WAVE", 4) != 0)
+        return -1;
+
+    // Walk through the chunks
+    while (p + 8 <= end) {
+        unsigned long size = get_le32(p + 4);
+        unsigned char *chunk = p + 8;
+
+        if (memcmp(p, "fmt ", 4) == 0 && size >= 16 && chunk + 16 <= end) {
+            unsigned int tag = get_le16(chunk);
+
+            // WAVE_FORMAT_EXTENSIBLE: the real format tag is at the start of the sub-format GUID
+            if (tag == 0xFFFE && size >= 40 && chunk + 40 <= end)
+                tag = get_le16(chunk + 24);
+            if (tag != 1)
+                return -1;
+
+            sfinfo->channels = get_le16(chunk + 2);
+            sfinfo->samplerate = get_le32(chunk + 4);
+            if (sfinfo->channels < 1)
+                return -1;
+            // Use the container size (eg 20-bit samples are stored in 3 bytes)
+            mf->bytes_per_sample = get_le16(chunk + 12) / sfinfo->channels;
+            have_fmt = 1;
+
+        } else if (memcmp(p, "data", 4) == 0 && have_fmt) {
+            if (mf->bytes_per_sample < 1)
+                return -1;
+            // Streamed WAV files may not have the size filled in
+            if (size == 0 || size > (unsigned long) (end - chunk))
+                size = end - chunk;
+            mf->data = chunk;
+            mf->samples = size / mf->bytes_per_sample;
+            return 0;
+        }
+
+        if (size >= (unsigned long) (end - chunk))
+            break;
+        p = chunk + size + (size & 1);
+    }
+
+    return -1;
+}
+
+
+static void print_info_mmap(struct audioin_s *audioin)
+{
+    mmap_file_t *mf = audioin->file;
+
+    fprintf(stderr, "Input Format: %s, %d-bit PCM (memory mapped)\n",
+            mf->wav ? "WAV" : "Raw", mf->bytes_per_sample * 8);
+    fprintf(stderr, "Input Audio: %d channels, %d Hz\n",
+            audioin->sfinfo->channels, audioin->sfinfo->samplerate);
+}
+
+
+/* Convert some samples to 16-bit in the machine's byte order */
+static int read_mmap(audioin_t * audioin, short *buffer, int samples)
+{
+    mmap_file_t *mf = audioin->file;
+    int bps = mf->bytes_per_sample;
+    const unsigned char *src = NULL;
+    int i;
+
+    if (samples > mf->samples - mf->pos)
+        samples = mf->samples - mf->pos;
+    src = mf->data + mf->pos * bps;
+
+    // Take the most significant two bytes of each sample
+    if (mf->big_endian) {
+        for (i = 0; i < samples; i++, src += bps)
+            buffer[i] = (short) ((src[0] << 8) | src[1]);
+    } else {
+        for (i = 0; i < samples; i++, src += bps)
+            buffer[i] = (short) ((src[bps - 1] << 8) | src[bps - 2]);
+    }
+
+    mf->pos += samples;
+    return samples;
+}
+
+
+/* Point at some samples in the mapping, without copying them */
+static int map_mmap(audioin_t * audioin, const short **buffer, int samples)
+{
+    mmap_file_t *mf = audioin->file;
+
+    if (samples > mf->samples - mf->pos)
+        samples = mf->samples - mf->pos;
+
+    *buffer = (const short *) (mf->data) + mf->pos;
+    mf->pos += samples;
+    return samples;
+}
+
+
+/* Move to the start of a sample frame */
+static int seek_mmap(audioin_t * audioin, long frame)
+{
+    mmap_file_t *mf = audioin->file;
+    long pos = frame * audioin->sfinfo->channels;
+
+    if (pos < 0 || pos > mf->samples)
+        return -1;
+
+    mf->pos = pos;
+    return 0;
+}
+
+
+/* Return error string (or NULL)
+   Reading from the mapping can't fail, so the only error is not having one */
+static const char *error_str_mmap(audioin_t * audioin)
+{
+    mmap_file_t *mf = audioin->file;
+
+    if (mf == NULL || mf->base == NULL)
+        return "the input file isn't mapped";
+    return NULL;
+}
+
+
+static int close_mmap(audioin_t * audioin)
+{
+    mmap_file_t *mf = audioin->file;
+    int result = munmap(mf->base, mf->length);
+
+    free(mf);
+    free(audioin);
+
+    return result;
+}
+
+
+/*
+  open_audioin_mmap()
+  Memory map a raw PCM file (samplesize is 16, 24 or 32) or,
+  if samplesize is 0, a PCM WAV file.
+  Returns NULL if the file can't be mapped or isn't in a format
+  we understand, so that the caller can try another method.
+*/
+audioin_t *open_audioin_mmap(char *filename, SF_INFO * sfinfo, int samplesize, int byteswap)
+{
+    audioin_t *audioin = NULL;
+    mmap_file_t *mf = NULL;
+    SF_INFO info = *sfinfo;
+    struct stat st;
+    void *base = NULL;
+    int fd = -1;
+
+    if (samplesize != 0 && samplesize != 16 && samplesize != 24 && samplesize != 32)
+        return NULL;
+
+    // Only regular files can be mapped
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    mf = (mmap_file_t *) calloc(1, sizeof(mmap_file_t));
+    if (mf == NULL) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    mf->base = (unsigned char *) base;
+    mf->length = st.st_size;
+
+    if (samplesize) {
+        // Raw audio is in the machine's byte order
+        mf->data = mf->base;
+        mf->bytes_per_sample = samplesize / 8;
+        mf->samples = mf->length / mf->bytes_per_sample;
+        mf->big_endian = host_is_big_endian();
+    } else if (parse_wav_header(mf, &info) == 0 &&
+               mf->bytes_per_sample >= 2 && mf->bytes_per_sample <= 4 &&
+               info.channels > 0 && info.samplerate > 0) {
+        mf->wav = 1;
+        mf->big_endian = 0;
+    } else {
+        munmap(base, st.st_size);
+        free(mf);
+        return NULL;
+    }
+    if (byteswap)
+        mf->big_endian = !mf->big_endian;
+
+    // Drop any incomplete sample frame at the end
+    mf->samples -= mf->samples % info.channels;
+    info.frames = mf->samples / info.channels;
+
+    audioin = (audioin_t *) calloc(1, sizeof(audioin_t));
+    if (audioin == NULL) {
+        munmap(base, st.st_size);
+        free(mf);
+        return NULL;
+    }
+    // We will be reading the file from start to finish
+    madvise(mf->base, mf->length, MADV_SEQUENTIAL);
+
+    *sfinfo = info;
+
+    // Fill-in data structure
+    audioin->file = mf;
+    audioin->samplesize = mf->bytes_per_sample * 8;
+    audioin->sfinfo = sfinfo;
+    audioin->byteswapped = 1;
+    audioin->print_info = print_info_mmap;
+    audioin->read = read_mmap;
+    audioin->seek = seek_mmap;
+    audioin->error_str = error_str_mmap;
+    audioin->close = close_mmap;
+
+    // The samples can be used where they are if they are already 16-bit native shorts
+    if (mf->bytes_per_sample == 2 && mf->big_endian == host_is_big_endian() &&
+        ((unsigned long) mf->data % sizeof(short)) == 0)
+        audioin->map = map_mmap;
+
+    return audioin;
+}
+
+
+// vim:ts=4:sw=4:nowrap:
@@ -57,6 +57,19 @@ static int read_raw(audioin_t * audioin, short *buffer, int samples)
 }
 
 
+/* Move to the start of a sample frame */
+static int seek_raw(audioin_t * audioin, long frame)
+{
+    FILE *file = audioin->file;
+    long bytes_per_frame = audioin->sfinfo->channels * (audioin->samplesize / 8);
+
+    if (frame < 0 || frame > audioin->sfinfo->frames)
+        return -1;
+
+    return fseek(file, frame * bytes_per_frame, SEEK_SET) == 0 ? 0 : -1;
+}
+
+
 /* Return error string (or NULL) */
 static const char *error_str_raw(audioin_t * audioin)
 {
@@ -101,16 +114,33 @@ audioin_t *open_audioin_raw(char *filename, SF_INFO * sfinfo, int samplesize)
     if (audioin->file == NULL) {
         fprintf(stderr, "Failed to open input file (%s):\n", filename);
         fprintf(stderr, "  %s\n", strerror(errno));
-        exit(ERR_OPENING_INPUT);
+        free(audioin);
+        return NULL;
     }
     // Fill-in data structure
     audioin->samplesize = samplesize;
     audioin->sfinfo = sfinfo;
+    audioin->byteswapped = 0;
     audioin->print_info = print_info_raw;
     audioin->read = read_raw;
+    audioin->map = NULL;
+    audioin->seek = NULL;
     audioin->error_str = error_str_raw;
     audioin->close = close_raw;
 
+    // A file (but not a pipe) can be seeked, and its length gives the number of frames
+    if (audioin->file != stdin && fseek(audioin->file, 0, SEEK_END) == 0) {
+        long bytes_per_frame = sfinfo->channels * (samplesize / 8);
+        long length = ftell(audioin->file);
+
+        if (length >= 0 && bytes_per_frame > 0 && fseek(audioin->file, 0, SEEK_SET) == 0) {
+            sfinfo->frames = length / bytes_per_frame;
+            audioin->seek = seek_raw;
+        } else {
+            rewind(audioin->file);
+        }
+    }
+
 
     return audioin;
 }
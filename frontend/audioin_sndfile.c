@@ -105,6 +105,18 @@ static int read_sndfile(audioin_t * audioin, short *buffer, int samples)
 }
 
 
+/* Move to the start of a sample frame */
+static int seek_sndfile(audioin_t * audioin, long frame)
+{
+    SNDFILE *file = audioin->file;
+
+    if (sf_seek(file, frame, SEEK_SET) != frame)
+        return -1;
+
+    return 0;
+}
+
+
 /* Return error string (or NULL) */
 static const char *error_str_sndfile(audioin_t * audioin)
 {
@@ -145,13 +157,17 @@ audioin_t *open_audioin_sndfile(char *filename, SF_INFO * sfinfo)
     if (audioin->file == NULL) {
         fprintf(stderr, "Failed to open input file (%s):\n", filename);
         fprintf(stderr, "  %s\n", sf_strerror(NULL));
-        exit(ERR_OPENING_INPUT);
+        free(audioin);
+        return NULL;
     }
     // Fill-in data structure
     audioin->samplesize = 0;
     audioin->sfinfo = sfinfo;
+    audioin->byteswapped = 0;
     audioin->print_info = print_info_sndfile;
     audioin->read = read_sndfile;
+    audioin->map = NULL;
+    audioin->seek = sfinfo->seekable ? seek_sndfile : NULL;
     audioin->error_str = error_str_sndfile;
     audioin->close = close_sndfile;
 
@@ -25,11 +25,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <getopt.h>
 
 #include <twolame.h>
 #include <sndfile.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include "frontend.h"
+#include "ringbuffer.h"
+#include "workqueue.h"
 
 
 
@@ -41,10 +47,34 @@ int sample_size = 16;           // number of bits per sample for raw input
 int single_frame_mode = FALSE;  // only encode a single frame of MPEG audio ?
 int byteswap = FALSE;           // swap endian on input audio ?
 int channelswap = FALSE;        // swap left and right channels ?
+int low_latency = FALSE;        // read and write a frame at a time ?
+int num_buffers = DEFAULT_BUFFERS;  // buffers between reader, encoder and writer threads
+int use_mmap = TRUE;            // memory map input files when we can ?
+int num_segments = 1;           // number of segments to encode at once
+int verify_segments = FALSE;    // compare segment mode with a serial encode ?
+int batch_mode = FALSE;         // encode a list of files ?
+int num_workers = 0;            // number of threads encoding in batch mode (0 = one per CPU)
 SF_INFO sfinfo;                 // contains information about input file format
 
 char inputfilename[MAX_NAME_SIZE] = "\0";
 char outputfilename[MAX_NAME_SIZE] = "\0";
+char manifestfilename[MAX_NAME_SIZE] = "\0";
+
+/*
+  The options which configure libtwolame, kept so that
+  batch mode can set up more encoders in the same way
+*/
+typedef struct encoder_option_s {
+    int ch;
+    char *arg;
+} encoder_option_t;
+
+static encoder_option_t *encoder_options = NULL;
+static int num_encoder_options = 0;
+
+// Input filenames given on the command line in batch mode
+static char **batch_args = NULL;
+static int num_batch_args = 0;
 
 
 
@@ -157,6 +187,8 @@ static void usage_long()
     fprintf(stderr, "Usage: \n");
 
     fprintf(stderr, "\ttwolame [options] <infile> [outfile]\n");
+    fprintf(stderr, "\ttwolame [options] --batch <infile> [infile ...]\n");
+    fprintf(stderr, "\ttwolame [options] --manifest <file>\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Both input and output filenames can be set to - to use stdin/stdout.\n");
     fprintf(stderr, "  <infile>       input sound file (any format supported by libsndfile)\n");
@@ -173,6 +205,11 @@ static void usage_long()
     fprintf(stderr, "\t    --scale value        scale input (multiply PCM data)\n");
     fprintf(stderr, "\t    --scale-l value      scale channel 0 (left) input\n");
     fprintf(stderr, "\t    --scale-r value      scale channel 1 (right) input\n");
+    fprintf(stderr,
+            "\t    --buffers num        buffers between reader/encoder/writer threads (default %d)\n",
+            DEFAULT_BUFFERS);
+    fprintf(stderr, "\t                         0 does everything in a single thread\n");
+    fprintf(stderr, "\t    --no-mmap            don't memory map raw and WAV input files\n");
 
 
     fprintf(stderr, "\nOutput Options\n");
@@ -180,14 +217,23 @@ static void usage_long()
     fprintf(stderr,
             "\t-a, --downmix            downmix from stereo to mono file for mono encoding\n");
     fprintf(stderr, "\t-b, --bitrate br         total bitrate in kbps (default 192 for 44.1kHz)\n");
-    fprintf(stderr, "\t-P, --psyc-mode psyc     psychoacoustic model -1 to 4 (default 3)\n");
+    fprintf(stderr, "\t-P, --psyc-mode psyc     psychoacoustic model -1 to 5 (default 3)\n");
     fprintf(stderr, "\t-v, --vbr                enable VBR mode\n");
     fprintf(stderr,
             "\t-V, --vbr-level lev      enable VBR and set VBR level -50 to 50 (default 5)\n");
     fprintf(stderr, "\t-B, --max-bitrate rate   set the upper bitrate when in VBR mode\n");
     fprintf(stderr, "\t-l, --ath lev            ATH level (default 0.0)\n");
+    fprintf(stderr, "\t    --lowpass freq       don't code frequencies above freq Hz\n");
     fprintf(stderr, "\t-q, --quick num          only calculate psy model every num frames\n");
     fprintf(stderr, "\t-S, --single-frame       only encode a single frame of MPEG Audio\n");
+    fprintf(stderr, "\t    --low-latency        read and write one frame at a time\n");
+    fprintf(stderr, "\t    --frame-budget usec  use cheaper psy models if a frame takes longer\n");
+    fprintf(stderr, "\t    --channel-threads    analyse left and right channels on separate threads\n");
+    fprintf(stderr, "\t    --channel-cpu num    pin the right channel's thread to CPU num\n");
+    fprintf(stderr, "\t    --single-run         only analyse one window per frame in psy models 2 and 4\n");
+    fprintf(stderr, "\t    --fixed-point        filter and quantize in fixed point (psy -1, [0])\n");
+    fprintf(stderr, "\t    --segments num       split the input file into num segments encoded at once\n");
+    fprintf(stderr, "\t    --verify             compare the segments with a serial encode\n");
 
 
     fprintf(stderr, "\nMiscellaneous Options\n");
@@ -201,6 +247,12 @@ static void usage_long()
     fprintf(stderr, "\t-e, --deemphasis emp     de-emphasis n/5/c (default: (n)one)\n");
     fprintf(stderr, "\t-E, --energy             turn on energy level extensions\n");
 
+    fprintf(stderr, "\nBatch Options\n");
+    fprintf(stderr, "\t    --batch              encode every input file to <infile>.mp2\n");
+    fprintf(stderr, "\t    --manifest file      encode the files listed in file (implies --batch)\n");
+    fprintf(stderr, "\t                         one per line, optionally TAB output filename\n");
+    fprintf(stderr, "\t    --jobs num           number of files to encode at once (default: CPUs)\n");
+
     fprintf(stderr, "\nVerbosity Options\n");
     fprintf(stderr, "\t-t, --talkativity num    talkativity 0-10 (default is 2)\n");
     fprintf(stderr, "\t    --quiet              same as --talkativity=0\n");
@@ -275,6 +327,175 @@ static char *build_shortopt_string(struct option *opts)
 
 
 
+/*
+  set_encoder_option()
+  Apply a command line option which configures libtwolame.
+  Returns FALSE if it isn't one of those.
+*/
+static int set_encoder_option(twolame_options * encopts, int ch, char *arg)
+{
+    switch (ch) {
+
+        // Input
+    case 's':
+        twolame_set_out_samplerate(encopts, atoi(arg));
+        break;
+
+    case 1001:                 // --scale
+        twolame_set_scale(encopts, atof(arg));
+        break;
+
+    case 1002:                 // --scale-l
+        twolame_set_scale_left(encopts, atof(arg));
+        break;
+
+    case 1003:                 // --scale-r
+        twolame_set_scale_right(encopts, atof(arg));
+        break;
+
+
+        // Output
+    case 'm':
+        if (*arg == 's') {
+            twolame_set_mode(encopts, TWOLAME_STEREO);
+        } else if (*arg == 'd') {
+            twolame_set_mode(encopts, TWOLAME_DUAL_CHANNEL);
+        } else if (*arg == 'j') {
+            twolame_set_mode(encopts, TWOLAME_JOINT_STEREO);
+        } else if (*arg == 'm') {
+            twolame_set_mode(encopts, TWOLAME_MONO);
+        } else if (*arg == 'a') {
+            twolame_set_mode(encopts, TWOLAME_AUTO_MODE);
+        } else {
+            fprintf(stderr, "Error: mode must be a/s/d/j/m not '%s'\n\n", arg);
+            usage_long();
+        }
+        break;
+
+    case 'a':                  // downmix
+        twolame_set_mode(encopts, TWOLAME_MONO);
+        break;
+
+    case 'b':
+        twolame_set_bitrate(encopts, atoi(arg));
+        break;
+
+    case 'P':
+        twolame_set_psymodel(encopts, atoi(arg));
+        break;
+
+    case 'v':
+        twolame_set_VBR(encopts, TRUE);
+        break;
+
+    case 'V':
+        twolame_set_VBR(encopts, TRUE);
+        twolame_set_VBR_level(encopts, atof(arg));
+        break;
+
+    case 'B':
+        twolame_set_VBR_max_bitrate_kbps(encopts, atoi(arg));
+        break;
+
+    case 'l':
+        twolame_set_ATH_level(encopts, atof(arg));
+        break;
+
+    case 'q':
+        twolame_set_quick_mode(encopts, TRUE);
+        twolame_set_quick_count(encopts, atoi(arg));
+        break;
+
+    case 1010:                 // --frame-budget
+        twolame_set_frame_budget(encopts, atoi(arg));
+        break;
+
+    case 1018:                 // --channel-threads
+        twolame_set_channel_threads(encopts, TRUE);
+        break;
+
+    case 1019:                 // --channel-cpu
+        twolame_set_channel_thread_cpu(encopts, atoi(arg));
+        break;
+
+    case 1020:                 // --single-run
+        twolame_set_psy_single_run(encopts, TRUE);
+        break;
+
+    case 1021:                 // --lowpass
+        twolame_set_lowpass(encopts, atoi(arg));
+        break;
+
+    case 1022:                 // --fixed-point
+        twolame_set_fixed_point(encopts, TRUE);
+        break;
+
+
+        // Miscellaneous 
+    case 'c':
+        twolame_set_copyright(encopts, TRUE);
+        break;
+    case 1004:                 // --non-copyright
+        twolame_set_copyright(encopts, FALSE);
+        break;
+    case 'o':                  // --non-original
+        twolame_set_original(encopts, FALSE);
+        break;
+    case 1005:                 // --original
+        twolame_set_original(encopts, TRUE);
+        break;
+    case 'p':
+        twolame_set_error_protection(encopts, TRUE);
+        break;
+    case 'd':
+        twolame_set_padding(encopts, TWOLAME_PAD_ALL);
+        break;
+    case 'R':
+        twolame_set_num_ancillary_bits(encopts, atoi(arg));
+        break;
+    case 'e':
+        if (*arg == 'n')
+            twolame_set_emphasis(encopts, TWOLAME_EMPHASIS_N);
+        else if (*arg == '5')
+            twolame_set_emphasis(encopts, TWOLAME_EMPHASIS_5);
+        else if (*arg == 'c')
+            twolame_set_emphasis(encopts, TWOLAME_EMPHASIS_C);
+        else {
+            fprintf(stderr, "Error: emphasis must be n/5/c not '%s'\n\n", arg);
+            usage_long();
+        }
+        break;
+    case 'E':
+        twolame_set_energy_levels(encopts, TRUE);
+        break;
+
+
+        // Verbosity
+    case 't':
+        twolame_set_verbosity(encopts, atoi(arg));
+        break;
+
+    case 1006:                 // --quiet
+        twolame_set_verbosity(encopts, 0);
+        break;
+
+    case 1007:                 // --brief
+        twolame_set_verbosity(encopts, 1);
+        break;
+
+    case 1008:                 // --verbose
+        twolame_set_verbosity(encopts, 4);
+        break;
+
+    default:
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+
 /* 
   parse_args() 
   Parse the command line arguments
@@ -296,6 +517,8 @@ static void parse_args(int argc, char **argv, twolame_options * encopts)
         {"scale", required_argument, NULL, 1001},
         {"scale-l", required_argument, NULL, 1002},
         {"scale-r", required_argument, NULL, 1003},
+        {"buffers", required_argument, NULL, 1011},
+        {"no-mmap", no_argument, NULL, 1015},
 
         // Output
         {"mode", required_argument, NULL, 'm'},
@@ -308,6 +531,20 @@ static void parse_args(int argc, char **argv, twolame_options * encopts)
         {"ath", required_argument, NULL, 'l'},
         {"quick", required_argument, NULL, 'q'},
         {"single-frame", no_argument, NULL, 'S'},
+        {"low-latency", no_argument, NULL, 1009},
+        {"frame-budget", required_argument, NULL, 1010},
+        {"channel-threads", no_argument, NULL, 1018},
+        {"channel-cpu", required_argument, NULL, 1019},
+        {"single-run", no_argument, NULL, 1020},
+        {"lowpass", required_argument, NULL, 1021},
+        {"fixed-point", no_argument, NULL, 1022},
+        {"segments", required_argument, NULL, 1016},
+        {"verify", no_argument, NULL, 1017},
+
+        // Batch
+        {"batch", no_argument, NULL, 1012},
+        {"manifest", required_argument, NULL, 1013},
+        {"jobs", required_argument, NULL, 1014},
 
         // Misc
         {"copyright", no_argument, NULL, 'c'},
@@ -344,6 +581,13 @@ static void parse_args(int argc, char **argv, twolame_options * encopts)
     sfinfo.frames = 0;
 
 
+    // Keep the options which configure libtwolame (there can't be more than argc)
+    encoder_options = (encoder_option_t *) calloc(argc, sizeof(encoder_option_t));
+    if (encoder_options == NULL) {
+        fprintf(stderr, "Error: options memory allocation failed\n");
+        exit(ERR_MEM_ALLOC);
+    }
+
     while ((ch = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
         switch (ch) {
 
@@ -356,11 +600,6 @@ static void parse_args(int argc, char **argv, twolame_options * encopts)
             byteswap = TRUE;
             break;
 
-        case 's':
-            twolame_set_out_samplerate(encopts, atoi(optarg));
-            sfinfo.samplerate = atoi(optarg);
-            break;
-
         case 1000:             // --samplesize
             sample_size = atoi(optarg);
             break;
@@ -373,139 +612,75 @@ static void parse_args(int argc, char **argv, twolame_options * encopts)
             channelswap = TRUE;
             break;
 
-        case 1001:             // --scale
-            twolame_set_scale(encopts, atof(optarg));
+        case 1015:             // --no-mmap
+            use_mmap = FALSE;
             break;
 
-        case 1002:             // --scale-l
-            twolame_set_scale_left(encopts, atof(optarg));
-            break;
-
-        case 1003:             // --scale-r
-            twolame_set_scale_right(encopts, atof(optarg));
-            break;
-
-
-
-            // Output
-        case 'm':
-            if (*optarg == 's') {
-                twolame_set_mode(encopts, TWOLAME_STEREO);
-            } else if (*optarg == 'd') {
-                twolame_set_mode(encopts, TWOLAME_DUAL_CHANNEL);
-            } else if (*optarg == 'j') {
-                twolame_set_mode(encopts, TWOLAME_JOINT_STEREO);
-            } else if (*optarg == 'm') {
-                twolame_set_mode(encopts, TWOLAME_MONO);
-            } else if (*optarg == 'a') {
-                twolame_set_mode(encopts, TWOLAME_AUTO_MODE);
-            } else {
-                fprintf(stderr, "Error: mode must be a/s/d/j/m not '%s'\n\n", optarg);
-                usage_long();
+        case 1011:             // --buffers
+            num_buffers = atoi(optarg);
+            if (num_buffers < 0) {
+                fprintf(stderr, "Error: number of buffers can't be negative.\n");
+                usage_short();
             }
             break;
 
-        case 'a':              // downmix
-            twolame_set_mode(encopts, TWOLAME_MONO);
-            break;
-
-        case 'b':
-            twolame_set_bitrate(encopts, atoi(optarg));
-            break;
-
-        case 'P':
-            twolame_set_psymodel(encopts, atoi(optarg));
-            break;
-
-        case 'v':
-            twolame_set_VBR(encopts, TRUE);
-            break;
-
-        case 'V':
-            twolame_set_VBR(encopts, TRUE);
-            twolame_set_VBR_level(encopts, atof(optarg));
-            break;
-
-        case 'B':
-            twolame_set_VBR_max_bitrate_kbps(encopts, atoi(optarg));
-            break;
-
-        case 'l':
-            twolame_set_ATH_level(encopts, atof(optarg));
-            break;
-
-        case 'q':
-            twolame_set_quick_mode(encopts, TRUE);
-            twolame_set_quick_count(encopts, atoi(optarg));
-            break;
 
+            // Output
         case 'S':
             single_frame_mode = TRUE;
             break;
 
-
-            // Miscellaneous 
-        case 'c':
-            twolame_set_copyright(encopts, TRUE);
-            break;
-        case 1004:              // --non-copyright
-            twolame_set_copyright(encopts, FALSE);
-            break;
-        case 'o':              // --non-original
-            twolame_set_original(encopts, FALSE);
-            break;
-        case 1005:             // --original
-            twolame_set_original(encopts, TRUE);
-            break;
-        case 'p':
-            twolame_set_error_protection(encopts, TRUE);
-            break;
-        case 'd':
-            twolame_set_padding(encopts, TWOLAME_PAD_ALL);
-            break;
-        case 'R':
-            twolame_set_num_ancillary_bits(encopts, atoi(optarg));
+        case 1009:             // --low-latency
+            low_latency = TRUE;
             break;
-        case 'e':
-            if (*optarg == 'n')
-                twolame_set_emphasis(encopts, TWOLAME_EMPHASIS_N);
-            else if (*optarg == '5')
-                twolame_set_emphasis(encopts, TWOLAME_EMPHASIS_5);
-            else if (*optarg == 'c')
-                twolame_set_emphasis(encopts, TWOLAME_EMPHASIS_C);
-            else {
-                fprintf(stderr, "Error: emphasis must be n/5/c not '%s'\n\n", optarg);
-                usage_long();
+
+        case 1016:             // --segments
+            num_segments = atoi(optarg);
+            if (num_segments < 1) {
+                fprintf(stderr, "Error: number of segments must be at least 1.\n");
+                usage_short();
             }
             break;
-        case 'E':
-            twolame_set_energy_levels(encopts, TRUE);
+
+        case 1017:             // --verify
+            verify_segments = TRUE;
             break;
 
 
-            // Verbosity
-        case 't':
-            twolame_set_verbosity(encopts, atoi(optarg));
+            // Batch
+        case 1012:             // --batch
+            batch_mode = TRUE;
             break;
 
-        case 1006:             // --quiet
-            twolame_set_verbosity(encopts, 0);
+        case 1013:             // --manifest
+            batch_mode = TRUE;
+            strncpy(manifestfilename, optarg, MAX_NAME_SIZE - 1);
             break;
 
-        case 1007:             // --brief
-            twolame_set_verbosity(encopts, 1);
+        case 1014:             // --jobs
+            num_workers = atoi(optarg);
+            if (num_workers < 1) {
+                fprintf(stderr, "Error: number of jobs must be at least 1.\n");
+                usage_short();
+            }
             break;
 
-        case 1008:             // --verbose
-            twolame_set_verbosity(encopts, 4);
-            break;
 
         case 'h':
             usage_long();
             break;
 
+        case 's':
+            sfinfo.samplerate = atoi(optarg);
+            // and the output samplerate, below
+            /* fall through */
+
         default:
-            usage_short();
+            if (!set_encoder_option(encopts, ch, optarg))
+                usage_short();
+            encoder_options[num_encoder_options].ch = ch;
+            encoder_options[num_encoder_options].arg = optarg;
+            num_encoder_options++;
             break;
         }
     }
@@ -515,6 +690,17 @@ static void parse_args(int argc, char **argv, twolame_options * encopts)
     // Look for the input and output file names
     argc -= optind;
     argv += optind;
+
+    // In batch mode they are all input files
+    if (batch_mode) {
+        batch_args = argv;
+        num_batch_args = argc;
+        if (argc == 0 && manifestfilename[0] == '\0') {
+            fprintf(stderr, "Missing input filenames.\n");
+            usage_short();
+        }
+        return;
+    }
     while (argc) {
         if (inputfilename[0] == '\0')
             strncpy(inputfilename, *argv, MAX_NAME_SIZE);
@@ -553,6 +739,32 @@ static void parse_args(int argc, char **argv, twolame_options * encopts)
 
 
 
+/*
+  open_input()
+  Open an input file, memory mapping it if we can
+*/
+static audioin_t *open_input(char *filename, SF_INFO * info)
+{
+    audioin_t *inputfile = NULL;
+
+    if (use_mmap && strcmp(filename, "-") != 0)
+        inputfile = open_audioin_mmap(filename, info, use_raw ? sample_size : 0, byteswap);
+
+    if (inputfile == NULL) {
+        if (use_raw) {
+            // use raw input handler
+            inputfile = open_audioin_raw(filename, info, sample_size);
+        } else {
+            // use libsndfile
+            inputfile = open_audioin_sndfile(filename, info);
+        }
+    }
+
+    return inputfile;
+}
+
+
+
 static FILE *open_output_file(char *filename)
 {
     FILE *file = NULL;
@@ -575,6 +787,833 @@ static FILE *open_output_file(char *filename)
 }
 
 
+/*
+  read_audio()
+  Read some audio from the input file, byte swapping and
+  swapping channels if requested.
+  Returns the number of samples per channel.
+*/
+static int read_audio(audioin_t * inputfile, short int *pcmaudio, int audioReadSize)
+{
+    int samples_read = inputfile->read(inputfile, pcmaudio, audioReadSize);
+
+    if (samples_read <= 0)
+        return samples_read;
+
+    // Force byte swapping if requested
+    if (byteswap && !inputfile->byteswapped) {
+        int i;
+        for (i = 0; i < samples_read; i++) {
+            short tmp = pcmaudio[i];
+            char *src = (char *) &tmp;
+            char *dst = (char *) &pcmaudio[i];
+            dst[0] = src[1];
+            dst[1] = src[0];
+        }
+    }
+    // Calculate the number of samples we have (per channel)
+    samples_read /= inputfile->sfinfo->channels;
+
+    // Do swapping of left and right channels if requested
+    if (channelswap && inputfile->sfinfo->channels == 2) {
+        int i;
+        for (i = 0; i < samples_read; i++) {
+            short tmp = pcmaudio[(2 * i)];
+            pcmaudio[(2 * i)] = pcmaudio[(2 * i) + 1];
+            pcmaudio[(2 * i) + 1] = tmp;
+        }
+    }
+
+    return samples_read;
+}
+
+
+
+/*
+  next_audio()
+  Get the next block of audio, straight from the input file's
+  memory mapping if possible, otherwise by reading it into pcmaudio.
+  Returns the number of samples per channel.
+*/
+static int next_audio(audioin_t * inputfile, const short int **pcm, short int *pcmaudio,
+                      int audioReadSize)
+{
+    if (inputfile->map && !channelswap) {
+        int samples_read = inputfile->map(inputfile, pcm, audioReadSize);
+        return samples_read / inputfile->sfinfo->channels;
+    }
+
+    *pcm = pcmaudio;
+    return read_audio(inputfile, pcmaudio, audioReadSize);
+}
+
+
+
+/*
+  write_mp2()
+  Write encoded audio to the output file
+*/
+static void write_mp2(FILE * outputfile, unsigned char *mp2buffer, int mp2fill_size)
+{
+    int bytes_out = fwrite(mp2buffer, sizeof(unsigned char), mp2fill_size, outputfile);
+    if (bytes_out != mp2fill_size) {
+        perror("error while writing to output file");
+        exit(ERR_WRITING_OUTPUT);
+    }
+    // Send the frame on its way now, rather than when the stdio buffer is full
+    if (low_latency)
+        fflush(outputfile);
+}
+
+
+
+/*
+  write_mp2v()
+  Write several buffers of encoded audio with as few system calls as possible
+*/
+static void write_mp2v(FILE * outputfile, struct iovec *iov, int count)
+{
+    int fd = fileno(outputfile);
+
+    while (count > 0) {
+        ssize_t bytes_out = writev(fd, iov, count);
+        if (bytes_out < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("error while writing to output file");
+            exit(ERR_WRITING_OUTPUT);
+        }
+        // Skip over the buffers that have been written
+        while (count > 0 && (size_t) bytes_out >= iov->iov_len) {
+            bytes_out -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + bytes_out;
+            iov->iov_len -= bytes_out;
+        }
+    }
+}
+
+
+
+/*
+  Reader and writer threads, used when num_buffers > 0.
+  The reader fills pcm_ring from the input file, the main thread
+  encodes from pcm_ring into mp2_ring and the writer empties mp2_ring
+  to the output file. So a slow disk or pipe at either end only
+  stalls the encoder once all the buffers are empty (or full).
+  Memory mapped input doesn't need a reader thread, and the writer
+  sends everything that is waiting with a single writev().
+*/
+typedef struct pipeline_s {
+    audioin_t *inputfile;
+    FILE *outputfile;
+    int audioReadSize;
+    ringbuffer_t *pcm_ring;
+    ringbuffer_t *mp2_ring;
+    unsigned int total_bytes;
+} pipeline_t;
+
+
+static void *reader_thread(void *arg)
+{
+    pipeline_t *pipeline = (pipeline_t *) arg;
+    int samples_read = 0;
+
+    while (1) {
+        short int *pcmaudio = ringbuffer_write_slot(pipeline->pcm_ring);
+        samples_read = read_audio(pipeline->inputfile, pcmaudio, pipeline->audioReadSize);
+        if (samples_read <= 0)
+            break;
+        ringbuffer_commit(pipeline->pcm_ring, samples_read);
+    }
+
+    ringbuffer_finish(pipeline->pcm_ring);
+    return NULL;
+}
+
+
+static void *writer_thread(void *arg)
+{
+    pipeline_t *pipeline = (pipeline_t *) arg;
+    struct iovec iov[MAX_WRITEV];
+    int count, i;
+
+    while ((count = ringbuffer_read_slots(pipeline->mp2_ring, iov, MAX_WRITEV)) > 0) {
+        for (i = 0; i < count; i++)
+            pipeline->total_bytes += iov[i].iov_len;
+        write_mp2v(pipeline->outputfile, iov, count);
+        ringbuffer_release_slots(pipeline->mp2_ring, count);
+    }
+
+    return NULL;
+}
+
+
+
+/*
+  Batch mode: encode a list of files on several worker threads.
+  The files are shared out with a work-stealing queue. Each worker
+  keeps its encoder and buffers from one file to the next and only
+  sets up a new encoder when the number of channels or the sample
+  rate changes; otherwise twolame_reset() is all that is needed.
+*/
+typedef struct batch_job_s {
+    char *inputfilename;
+    char *outputfilename;
+    int result;                 // ERR_NO_ERROR or the reason it failed
+    unsigned int bytes;         // bytes of MPEG Audio written
+    double audio_secs;          // duration of the audio encoded
+    double encode_secs;         // time taken to encode it
+} batch_job_t;
+
+typedef struct batch_s {
+    batch_job_t *jobs;
+    int num_files;
+    int size;                   // number of jobs allocated
+    workqueue_t *queue;
+} batch_t;
+
+typedef struct batch_worker_s {
+    batch_t *batch;
+    int id;
+    pthread_t thread;
+    twolame_options *encopts;
+    short int *pcmaudio;
+    unsigned char *mp2buffer;
+    char *outputbuffer;         // stdio buffer for the output file
+    unsigned int files;         // files taken by this worker
+    unsigned int new_encoders;  // times a new encoder had to be set up
+} batch_worker_t;
+
+
+static double get_time(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+
+/* Add a file to the batch, making up the output filename if needed */
+static void add_batch_job(batch_t * batch, const char *input, const char *output)
+{
+    batch_job_t *job = NULL;
+
+    if (batch->num_files == batch->size) {
+        batch->size = batch->size ? batch->size * 2 : 64;
+        batch->jobs = (batch_job_t *) realloc(batch->jobs, batch->size * sizeof(batch_job_t));
+        if (batch->jobs == NULL) {
+            fprintf(stderr, "Error: batch memory allocation failed\n");
+            exit(ERR_MEM_ALLOC);
+        }
+    }
+
+    job = &batch->jobs[batch->num_files++];
+    memset(job, 0, sizeof(batch_job_t));
+    job->inputfilename = strdup(input);
+    if (output && *output) {
+        job->outputfilename = strdup(output);
+    } else {
+        job->outputfilename = (char *) calloc(MAX_NAME_SIZE, 1);
+        if (job->outputfilename)
+            new_extension(job->inputfilename, OUTPUT_SUFFIX, job->outputfilename);
+    }
+    if (job->inputfilename == NULL || job->outputfilename == NULL) {
+        fprintf(stderr, "Error: batch memory allocation failed\n");
+        exit(ERR_MEM_ALLOC);
+    }
+}
+
+
+/*
+  read_manifest()
+  Add the files listed in a manifest to the batch: one input
+  filename per line, optionally followed by a TAB and the output
+  filename. Blank lines and lines starting with # are ignored.
+*/
+static int read_manifest(batch_t * batch, char *filename)
+{
+    char line[MAX_NAME_SIZE * 2];
+    FILE *file = NULL;
+
+    if (strcmp(filename, "-") == 0)
+        file = stdin;
+    else
+        file = fopen(filename, "r");
+    if (file == NULL) {
+        perror("Failed to open manifest file");
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        char *output = NULL;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        output = strchr(line, '\t');
+        if (output)
+            *output++ = '\0';
+        add_batch_job(batch, line, output);
+    }
+
+    if (file != stdin)
+        fclose(file);
+
+    return 0;
+}
+
+
+/*
+  new_encoder()
+  Set up an encoder for an input file, using the options
+  given on the command line.
+*/
+static twolame_options *new_encoder(SF_INFO * info)
+{
+    twolame_options *encopts = twolame_init();
+    int i;
+
+    if (encopts == NULL)
+        return NULL;
+
+    for (i = 0; i < num_encoder_options; i++)
+        set_encoder_option(encopts, encoder_options[i].ch, encoder_options[i].arg);
+
+    twolame_set_num_channels(encopts, info->channels);
+    twolame_set_in_samplerate(encopts, info->samplerate);
+    if (twolame_init_params(encopts) != 0) {
+        twolame_close(&encopts);
+        return NULL;
+    }
+
+    return encopts;
+}
+
+
+/* Encode one file of the batch. Returns one of the ERR_ codes. */
+static int batch_encode_file(batch_worker_t * worker, batch_job_t * job)
+{
+    SF_INFO info = sfinfo;      // raw input format from the command line
+    audioin_t *inputfile = NULL;
+    FILE *outputfile = NULL;
+    long samples = 0;
+    int samples_read = 0;
+    int mp2fill_size = 0;
+    int result = ERR_NO_ERROR;
+
+    if (strcmp(job->inputfilename, job->outputfilename) == 0) {
+        fprintf(stderr, "Error: %s would be encoded to itself.\n", job->inputfilename);
+        return ERR_INVALID_PARAM;
+    }
+    // Open the input file
+    inputfile = open_input(job->inputfilename, &info);
+    if (inputfile == NULL)
+        return ERR_OPENING_INPUT;
+
+    // Re-use the encoder from the last file if we can
+    if (worker->encopts != NULL &&
+        twolame_get_num_channels(worker->encopts) == info.channels &&
+        twolame_get_in_samplerate(worker->encopts) == info.samplerate) {
+        twolame_reset(worker->encopts);
+    } else {
+        twolame_close(&worker->encopts);
+        worker->encopts = new_encoder(&info);
+        worker->new_encoders++;
+        if (worker->encopts == NULL) {
+            fprintf(stderr, "Error: configuring libtwolame encoder failed for %s.\n",
+                    job->inputfilename);
+            inputfile->close(inputfile);
+            return ERR_INVALID_PARAM;
+        }
+    }
+
+    // Open the output file
+    outputfile = fopen(job->outputfilename, "wb");
+    if (outputfile == NULL) {
+        fprintf(stderr, "Failed to open output file (%s):\n", job->outputfilename);
+        perror("  ");
+        inputfile->close(inputfile);
+        return ERR_OPENING_OUTPUT;
+    }
+    setvbuf(outputfile, worker->outputbuffer, _IOFBF, OUTPUT_BUF_SIZE);
+
+    while (result == ERR_NO_ERROR) {
+        const short int *pcm = NULL;
+
+        samples_read = next_audio(inputfile, &pcm, worker->pcmaudio, AUDIO_BUF_SIZE);
+        if (samples_read <= 0) {
+            // flush any remaining audio
+            mp2fill_size = twolame_encode_flush(worker->encopts, worker->mp2buffer, MP2_BUF_SIZE);
+        } else {
+            samples += samples_read;
+            mp2fill_size = twolame_encode_buffer_interleaved(worker->encopts, pcm, samples_read,
+                                                             worker->mp2buffer, MP2_BUF_SIZE);
+        }
+
+        if (mp2fill_size < 0) {
+            fprintf(stderr, "error while encoding %s: %d\n", job->inputfilename, mp2fill_size);
+            result = ERR_ENCODING;
+        } else if (fwrite(worker->mp2buffer, 1, mp2fill_size, outputfile) != (size_t) mp2fill_size) {
+            fprintf(stderr, "error while writing to %s\n", job->outputfilename);
+            result = ERR_WRITING_OUTPUT;
+        }
+        job->bytes += mp2fill_size;
+
+        if (samples_read <= 0)
+            break;
+    }
+
+    // Was there an error reading the audio?
+    if (result == ERR_NO_ERROR && inputfile->error_str(inputfile)) {
+        fprintf(stderr, "Error reading from %s: %s\n", job->inputfilename,
+                inputfile->error_str(inputfile));
+        result = ERR_READING_INPUT;
+    }
+    inputfile->close(inputfile);
+
+    if (fclose(outputfile) != 0 && result == ERR_NO_ERROR) {
+        fprintf(stderr, "error while writing to %s\n", job->outputfilename);
+        result = ERR_WRITING_OUTPUT;
+    }
+    // Don't leave half an output file behind
+    if (result != ERR_NO_ERROR)
+        remove(job->outputfilename);
+
+    job->audio_secs = (double) samples / info.samplerate;
+
+    return result;
+}
+
+
+static void *batch_worker_thread(void *arg)
+{
+    batch_worker_t *worker = (batch_worker_t *) arg;
+    batch_t *batch = worker->batch;
+    int item;
+
+    while ((item = workqueue_next(batch->queue, worker->id)) >= 0) {
+        batch_job_t *job = &batch->jobs[item];
+        double start = get_time();
+
+        job->result = batch_encode_file(worker, job);
+        job->encode_secs = get_time() - start;
+        worker->files++;
+    }
+
+    return NULL;
+}
+
+
+/*
+  run_batch()
+  Encode all the files given in batch mode and report how fast it went.
+  Returns ERR_NO_ERROR, or the error of the first file that failed.
+*/
+static int run_batch(int verbosity)
+{
+    batch_t batch;
+    batch_worker_t *workers = NULL;
+    unsigned int total_bytes = 0, new_encoders = 0, steals = 0;
+    double audio_secs = 0.0, elapsed = 0.0;
+    int failed = 0, result = ERR_NO_ERROR;
+    int i;
+
+    // Make a list of the files to encode
+    memset(&batch, 0, sizeof(batch));
+    for (i = 0; i < num_batch_args; i++) {
+        if (strcmp(batch_args[i], "-") == 0) {
+            fprintf(stderr, "Error: can't use STDIN as an input file in batch mode.\n");
+            usage_short();
+        }
+        add_batch_job(&batch, batch_args[i], NULL);
+    }
+    if (manifestfilename[0] != '\0' && read_manifest(&batch, manifestfilename) < 0)
+        exit(ERR_OPENING_INPUT);
+    if (batch.num_files == 0) {
+        fprintf(stderr, "No input files to encode.\n");
+        exit(ERR_NO_ENCODE);
+    }
+    // One worker per CPU, unless told otherwise
+    if (num_workers < 1)
+        num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers < 1)
+        num_workers = 1;
+    if (num_workers > batch.num_files)
+        num_workers = batch.num_files;
+
+    batch.queue = workqueue_new(batch.num_files, num_workers);
+    workers = (batch_worker_t *) calloc(num_workers, sizeof(batch_worker_t));
+    if (batch.queue == NULL || workers == NULL) {
+        fprintf(stderr, "Error: batch memory allocation failed\n");
+        exit(ERR_MEM_ALLOC);
+    }
+
+    if (verbosity > 0) {
+        fprintf(stderr, "Encoding %d files using %d threads\n", batch.num_files, num_workers);
+    }
+
+    elapsed = get_time();
+    for (i = 0; i < num_workers; i++) {
+        workers[i].batch = &batch;
+        workers[i].id = i;
+        workers[i].pcmaudio = (short int *) calloc(AUDIO_BUF_SIZE, sizeof(short int));
+        workers[i].mp2buffer = (unsigned char *) calloc(MP2_BUF_SIZE, sizeof(unsigned char));
+        workers[i].outputbuffer = (char *) malloc(OUTPUT_BUF_SIZE);
+        if (workers[i].pcmaudio == NULL || workers[i].mp2buffer == NULL ||
+            workers[i].outputbuffer == NULL) {
+            fprintf(stderr, "Error: batch memory allocation failed\n");
+            exit(ERR_MEM_ALLOC);
+        }
+        if (pthread_create(&workers[i].thread, NULL, batch_worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "Error: failed to start batch worker threads\n");
+            exit(ERR_MEM_ALLOC);
+        }
+    }
+
+    for (i = 0; i < num_workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        new_encoders += workers[i].new_encoders;
+        steals += batch.queue->deques[i].steals;
+
+        twolame_close(&workers[i].encopts);
+        free(workers[i].pcmaudio);
+        free(workers[i].mp2buffer);
+        free(workers[i].outputbuffer);
+    }
+    elapsed = get_time() - elapsed;
+
+    // Report on each file, in the order they were given
+    for (i = 0; i < batch.num_files; i++) {
+        batch_job_t *job = &batch.jobs[i];
+
+        if (job->result != ERR_NO_ERROR) {
+            if (verbosity > 0)
+                fprintf(stderr, "%s: FAILED (error %d)\n", job->inputfilename, job->result);
+            if (result == ERR_NO_ERROR)
+                result = job->result;
+            failed++;
+        } else if (verbosity > 1) {
+            fprintf(stderr, "%s: %1.1f sec of audio in %1.3f sec (%1.1fx realtime)\n",
+                    job->inputfilename, job->audio_secs, job->encode_secs,
+                    job->encode_secs > 0 ? job->audio_secs / job->encode_secs : 0.0);
+        }
+        total_bytes += job->bytes;
+        audio_secs += job->audio_secs;
+
+        free(job->inputfilename);
+        free(job->outputfilename);
+    }
+
+    if (verbosity > 0) {
+        char *filesize = format_filesize_string(total_bytes);
+        fprintf(stderr, "---------------------------------------------------------\n");
+        fprintf(stderr, "Encoded %d files (%d failed) in %1.2f sec using %d threads.\n",
+                batch.num_files - failed, failed, elapsed, num_workers);
+        fprintf(stderr, "Total audio: %1.1f sec (%1.1fx realtime, %1.1f files/sec).\n",
+                audio_secs, elapsed > 0 ? audio_secs / elapsed : 0.0,
+                elapsed > 0 ? batch.num_files / elapsed : 0.0);
+        fprintf(stderr, "Total bytes written: %s.\n", filesize);
+        free(filesize);
+    }
+    if (verbosity > 2) {
+        fprintf(stderr, "Encoders set up: %u (re-used for %u files), blocks stolen: %u.\n",
+                new_encoders, batch.num_files - new_encoders, steals);
+    }
+
+    workqueue_free(batch.queue);
+    free(workers);
+    free(batch.jobs);
+
+    return result;
+}
+
+
+
+/*
+  Segment mode: split one input file into segments and encode them
+  on separate threads. Each segment after the first starts a few
+  frames early (the pre-roll) and throws those frames away, which
+  fills the filterbank and psycho model history with the same audio
+  as a serial encode would have. twolame_seek_frame() puts the
+  padding pattern and quick mode counter in step. The segments are
+  then written out in order.
+*/
+typedef struct segment_s {
+    pthread_t thread;
+    long first_frame;           // first frame of the segment
+    long num_frames;            // number of frames (the last segment runs to the end)
+    int last;                   // is this the last segment ?
+    int preroll;                // number of frames to encode and throw away first
+    unsigned char *data;        // the encoded audio
+    long size;                  // bytes of encoded audio
+    long alloc;                 // bytes allocated for data
+    int *frame_sizes;           // size of each frame encoded
+    long frames_out;            // number of frames encoded
+    int result;                 // ERR_NO_ERROR or the reason it failed
+} segment_t;
+
+
+/* Keep an encoded frame */
+static int segment_append(segment_t * seg, unsigned char *mp2buffer, int mp2fill_size)
+{
+    if (seg->size + mp2fill_size > seg->alloc) {
+        long alloc = seg->alloc * 2 + MP2_BUF_SIZE;
+        unsigned char *data = (unsigned char *) realloc(seg->data, alloc);
+        if (data == NULL)
+            return -1;
+        seg->data = data;
+        seg->alloc = alloc;
+    }
+    memcpy(seg->data + seg->size, mp2buffer, mp2fill_size);
+    seg->size += mp2fill_size;
+    seg->frame_sizes[seg->frames_out++] = mp2fill_size;
+
+    return 0;
+}
+
+
+static void *segment_thread(void *arg)
+{
+    segment_t *seg = (segment_t *) arg;
+    SF_INFO info = sfinfo;
+    twolame_options *encopts = NULL;
+    audioin_t *inputfile = NULL;
+    short int *pcmaudio = NULL;
+    unsigned char *mp2buffer = NULL;
+    long start = seg->first_frame - seg->preroll;
+    long frame = 0;
+
+    seg->result = ERR_MEM_ALLOC;
+    if (start < 0)
+        start = 0;
+
+    // Each segment has its own view of the input file and its own encoder
+    pcmaudio = (short int *) calloc(TWOLAME_SAMPLES_PER_FRAME * 2, sizeof(short int));
+    mp2buffer = (unsigned char *) calloc(MP2_BUF_SIZE, sizeof(unsigned char));
+    seg->frame_sizes = (int *) calloc(seg->num_frames + 1, sizeof(int));
+    if (pcmaudio == NULL || mp2buffer == NULL || seg->frame_sizes == NULL)
+        goto done;
+
+    seg->result = ERR_OPENING_INPUT;
+    inputfile = open_input(inputfilename, &info);
+    if (inputfile == NULL || inputfile->seek == NULL ||
+        inputfile->seek(inputfile, start * TWOLAME_SAMPLES_PER_FRAME) != 0)
+        goto done;
+
+    seg->result = ERR_INVALID_PARAM;
+    encopts = new_encoder(&info);
+    if (encopts == NULL || twolame_seek_frame(encopts, start) != 0)
+        goto done;
+
+    // Encode a frame at a time, so that we know where each one starts
+    seg->result = ERR_NO_ERROR;
+    for (frame = start; seg->last || frame < seg->first_frame + seg->num_frames; frame++) {
+        const short int *pcm = NULL;
+        int mp2fill_size = 0;
+        int samples_read = next_audio(inputfile, &pcm, pcmaudio,
+                                      TWOLAME_SAMPLES_PER_FRAME * info.channels);
+
+        if (samples_read > 0)
+            mp2fill_size = twolame_encode_buffer_interleaved(encopts, pcm, samples_read,
+                                                             mp2buffer, MP2_BUF_SIZE);
+        // At the end of the file, flush out the last partial frame
+        if (samples_read < TWOLAME_SAMPLES_PER_FRAME && seg->last && mp2fill_size == 0)
+            mp2fill_size = twolame_encode_flush(encopts, mp2buffer, MP2_BUF_SIZE);
+
+        if (mp2fill_size < 0) {
+            seg->result = ERR_ENCODING;
+            break;
+        }
+        // Throw away the pre-roll
+        if (frame >= seg->first_frame && mp2fill_size > 0 &&
+            segment_append(seg, mp2buffer, mp2fill_size) < 0) {
+            seg->result = ERR_MEM_ALLOC;
+            break;
+        }
+
+        if (samples_read < TWOLAME_SAMPLES_PER_FRAME)
+            break;
+    }
+
+  done:
+    if (seg->result != ERR_NO_ERROR)
+        fprintf(stderr, "Error: failed to encode the segment starting at frame %ld.\n",
+                seg->first_frame);
+    if (inputfile)
+        inputfile->close(inputfile);
+    twolame_close(&encopts);
+    free(pcmaudio);
+    free(mp2buffer);
+
+    return NULL;
+}
+
+
+/*
+  compare_segments()
+  Compare the frames from segment mode with those from a serial encode
+  and report how much they differ.
+*/
+static void compare_segments(segment_t * segments, int count, segment_t * serial)
+{
+    long frame = 0, diff_frames = 0, diff_bytes = 0, first_diff = -1;
+    long serial_pos = 0, total_frames = 0;
+    int s, size_mismatch = 0;
+
+    for (s = 0; s < count; s++) {
+        long pos = 0, f;
+
+        for (f = 0; f < segments[s].frames_out; f++, frame++) {
+            int len = segments[s].frame_sizes[f];
+            int i, differ = 0;
+
+            if (frame >= serial->frames_out || serial->frame_sizes[frame] != len) {
+                size_mismatch = 1;
+                break;
+            }
+            for (i = 0; i < len; i++) {
+                if (segments[s].data[pos + i] != serial->data[serial_pos + i])
+                    differ++;
+            }
+            if (differ) {
+                diff_frames++;
+                diff_bytes += differ;
+                if (first_diff < 0)
+                    first_diff = frame;
+            }
+            pos += len;
+            serial_pos += len;
+        }
+        total_frames += segments[s].frames_out;
+        if (size_mismatch)
+            break;
+    }
+
+    if (size_mismatch || total_frames != serial->frames_out) {
+        fprintf(stderr, "Verify: frame sizes differ from a serial encode from frame %ld "
+                "(%ld frames vs %ld).\n", frame, total_frames, serial->frames_out);
+    } else if (diff_frames == 0) {
+        fprintf(stderr, "Verify: all %ld frames are identical to a serial encode.\n",
+                total_frames);
+    } else {
+        fprintf(stderr, "Verify: %ld of %ld frames differ from a serial encode "
+                "(%ld bytes, first in frame %ld).\n", diff_frames, total_frames, diff_bytes,
+                first_diff);
+    }
+}
+
+
+/*
+  run_segments()
+  Encode the input file as num_segments segments at once, and write
+  them to the output file. Returns one of the ERR_ codes.
+*/
+static int run_segments(twolame_options * encopts, FILE * outputfile)
+{
+    int verbosity = twolame_get_verbosity(encopts);
+    long total_frames = sfinfo.frames / TWOLAME_SAMPLES_PER_FRAME;
+    segment_t *segments = NULL;
+    unsigned int total_bytes = 0;
+    long frames_out = 0;
+    int preroll = SEGMENT_PREROLL;
+    int result = ERR_NO_ERROR;
+    double elapsed = 0.0;
+    int i;
+
+    // In quick mode the psycho model only sees every quick_count'th frame,
+    // so it needs to have run twice before the segment starts
+    if (twolame_get_quick_mode(encopts) && twolame_get_quick_count(encopts) * 2 > preroll)
+        preroll = twolame_get_quick_count(encopts) * 2;
+
+    if (num_segments > total_frames)
+        num_segments = total_frames > 0 ? total_frames : 1;
+
+    segments = (segment_t *) calloc(num_segments, sizeof(segment_t));
+    if (segments == NULL) {
+        fprintf(stderr, "Error: segment memory allocation failed\n");
+        exit(ERR_MEM_ALLOC);
+    }
+
+    if (verbosity > 0) {
+        fprintf(stderr, "Encoding in %d segments with %d frames of pre-roll\n", num_segments,
+                preroll);
+    }
+
+    elapsed = get_time();
+    for (i = 0; i < num_segments; i++) {
+        segment_t *seg = &segments[i];
+
+        seg->first_frame = (total_frames * i) / num_segments;
+        seg->num_frames = (total_frames * (i + 1)) / num_segments - seg->first_frame;
+        seg->last = (i == num_segments - 1);
+        seg->preroll = preroll;
+        if (seg->last)
+            seg->num_frames++;  // for the flush
+        if (pthread_create(&seg->thread, NULL, segment_thread, seg) != 0) {
+            fprintf(stderr, "Error: failed to start segment threads\n");
+            exit(ERR_MEM_ALLOC);
+        }
+    }
+
+    // Write out each segment once it (and all the ones before it) are done
+    for (i = 0; i < num_segments; i++) {
+        pthread_join(segments[i].thread, NULL);
+        if (segments[i].result != ERR_NO_ERROR) {
+            if (result == ERR_NO_ERROR)
+                result = segments[i].result;
+            continue;
+        }
+        if (result == ERR_NO_ERROR)
+            write_mp2(outputfile, segments[i].data, segments[i].size);
+        total_bytes += segments[i].size;
+        frames_out += segments[i].frames_out;
+    }
+    elapsed = get_time() - elapsed;
+
+    if (verbosity > 1) {
+        char *filesize = format_filesize_string(total_bytes);
+        fprintf(stderr, "\nEncoding Finished.\n");
+        fprintf(stderr, "Total bytes written: %s.\n", filesize);
+        fprintf(stderr, "Encoded %ld frames in %1.2f sec.\n", frames_out, elapsed);
+        free(filesize);
+    }
+    // Encode the whole file again, serially, and compare
+    if (verify_segments && result == ERR_NO_ERROR) {
+        segment_t serial;
+        double serial_elapsed = get_time();
+
+        memset(&serial, 0, sizeof(serial));
+        serial.num_frames = total_frames + 1;
+        serial.last = TRUE;
+        segment_thread(&serial);
+        serial_elapsed = get_time() - serial_elapsed;
+
+        if (serial.result == ERR_NO_ERROR) {
+            compare_segments(segments, num_segments, &serial);
+            fprintf(stderr, "Verify: serial encode took %1.2f sec, segments were %1.1fx as fast.\n",
+                    serial_elapsed, elapsed > 0 ? serial_elapsed / elapsed : 0.0);
+        }
+        free(serial.data);
+        free(serial.frame_sizes);
+    }
+
+    for (i = 0; i < num_segments; i++) {
+        free(segments[i].data);
+        free(segments[i].frame_sizes);
+    }
+    free(segments);
+
+    return result;
+}
+
+
+
 int main(int argc, char **argv)
 {
     twolame_options *encopts = NULL;
@@ -589,6 +1628,9 @@ int main(int argc, char **argv)
     int samples_read = 0;
     int mp2fill_size = 0;
     int audioReadSize = 0;
+    pipeline_t pipeline;
+    pthread_t reader, writer;
+    int threaded_read = FALSE;
 
 
     // Allocate memory for the PCM audio data
@@ -610,17 +1652,23 @@ int main(int argc, char **argv)
     // Get options and parameters from the command line
     parse_args(argc, argv, encopts);
 
+    // Encode a whole list of files ?
+    if (batch_mode) {
+        int result = run_batch(twolame_get_verbosity(encopts));
+        twolame_close(&encopts);
+        free(encoder_options);
+        free(pcmaudio);
+        free(mp2buffer);
+        return result;
+    }
+
     // Display the filenames
     print_filenames(twolame_get_verbosity(encopts));
 
     // Open the input file
-    if (use_raw) {
-        // use raw input handler
-        inputfile = open_audioin_raw(inputfilename, &sfinfo, sample_size);
-    } else {
-        // use libsndfile
-        inputfile = open_audioin_sndfile(inputfilename, &sfinfo);
-    }
+    inputfile = open_input(inputfilename, &sfinfo);
+    if (inputfile == NULL)
+        exit(ERR_OPENING_INPUT);
 
     // Display input information
     if (twolame_get_verbosity(encopts) > 1) {
@@ -643,58 +1691,105 @@ int main(int argc, char **argv)
     twolame_print_config(encopts);
 
 
+    // Encode the file in segments on several threads ?
+    if (num_segments > 1 && !single_frame_mode && !low_latency) {
+        if (inputfile->seek != NULL) {
+            int result = run_segments(encopts, outputfile);
+            inputfile->close(inputfile);
+            fclose(outputfile);
+            twolame_close(&encopts);
+            free(encoder_options);
+            free(pcmaudio);
+            free(mp2buffer);
+            return result;
+        }
+        fprintf(stderr, "Warning: segment mode needs an input file that can be seeked; encoding serially.\n");
+    }
+
     // Only encode a single frame of mpeg audio ?
     if (single_frame_mode)
         audioReadSize = TWOLAME_SAMPLES_PER_FRAME;
+    else if (low_latency)
+        audioReadSize = TWOLAME_SAMPLES_PER_FRAME * sfinfo.channels;
     else
         audioReadSize = AUDIO_BUF_SIZE;
 
+    // Tell the user how much delay we are adding
+    if (low_latency && twolame_get_verbosity(encopts) > 1) {
+        int delay = twolame_get_encoder_delay(encopts) + TWOLAME_SAMPLES_PER_FRAME;
+        fprintf(stderr, "Encoder delay: %d samples (%1.1f ms) including frame buffering\n",
+                delay, (delay * 1000.0) / twolame_get_out_samplerate(encopts));
+    }
+
     // Calculate the size and number of frames we are going to encode
     frame_len = twolame_get_framelength(encopts);
     if (sfinfo.frames)
         total_frames = sfinfo.frames / TWOLAME_SAMPLES_PER_FRAME;
 
 
-    // Now do the reading/encoding/writing
-    while ((samples_read = inputfile->read(inputfile, pcmaudio, audioReadSize)) > 0) {
-        int bytes_out = 0;
-
-        // Force byte swapping if requested
-        if (byteswap) {
-            int i;
-            for (i = 0; i < samples_read; i++) {
-                short tmp = pcmaudio[i];
-                char *src = (char *) &tmp;
-                char *dst = (char *) &pcmaudio[i];
-                dst[0] = src[1];
-                dst[1] = src[0];
-            }
+    // Only use threads when we are going to encode more than one buffer full
+    if (single_frame_mode)
+        num_buffers = 0;
+
+    // Memory mapped audio can be encoded where it is, without a reader thread
+    threaded_read = (num_buffers > 0 && !(inputfile->map && !channelswap));
+
+    // Start the reader and writer threads
+    if (num_buffers > 0) {
+        pipeline.inputfile = inputfile;
+        pipeline.outputfile = outputfile;
+        pipeline.audioReadSize = audioReadSize;
+        pipeline.total_bytes = 0;
+        pipeline.pcm_ring = NULL;
+        if (threaded_read)
+            pipeline.pcm_ring = ringbuffer_new(num_buffers, AUDIO_BUF_SIZE * sizeof(short int));
+        pipeline.mp2_ring = ringbuffer_new(num_buffers, MP2_BUF_SIZE);
+        if ((threaded_read && pipeline.pcm_ring == NULL) || pipeline.mp2_ring == NULL) {
+            fprintf(stderr, "Error: buffer memory allocation failed\n");
+            exit(ERR_MEM_ALLOC);
         }
-        // Calculate the number of samples we have (per channel)
-        samples_read /= sfinfo.channels;
+        if ((threaded_read && pthread_create(&reader, NULL, reader_thread, &pipeline) != 0) ||
+            pthread_create(&writer, NULL, writer_thread, &pipeline) != 0) {
+            fprintf(stderr, "Error: failed to start reader/writer threads\n");
+            exit(ERR_MEM_ALLOC);
+        }
+    }
 
-        // Do swapping of left and right channels if requested
-        if (channelswap && sfinfo.channels == 2) {
-            int i;
-            for (i = 0; i < samples_read; i++) {
-                short tmp = pcmaudio[(2 * i)];
-                pcmaudio[(2 * i)] = pcmaudio[(2 * i) + 1];
-                pcmaudio[(2 * i) + 1] = tmp;
-            }
+    // Now do the reading/encoding/writing
+    while (1) {
+        const short int *pcm = pcmaudio;
+        unsigned char *mp2 = mp2buffer;
+
+        if (threaded_read) {
+            pcm = ringbuffer_read_slot(pipeline.pcm_ring, &samples_read);
+            if (pcm == NULL)
+                break;
+        } else {
+            samples_read = next_audio(inputfile, &pcm, pcmaudio, audioReadSize);
+            if (samples_read <= 0)
+                break;
         }
+        if (num_buffers > 0)
+            mp2 = ringbuffer_write_slot(pipeline.mp2_ring);
+
         // Encode the audio to MP2
-        mp2fill_size =
-            twolame_encode_buffer_interleaved(encopts, pcmaudio, samples_read, mp2buffer,
-                                              MP2_BUF_SIZE);
+        mp2fill_size = twolame_encode_buffer_interleaved(encopts, pcm, samples_read, mp2,
+                                                         MP2_BUF_SIZE);
+
+        if (threaded_read)
+            ringbuffer_release(pipeline.pcm_ring);
 
-        // Stop if we don't have any bytes (probably don't have enough audio for a full frame of
-        // mpeg audio)
-        if (mp2fill_size == 0)
-            break;
         if (mp2fill_size < 0) {
             fprintf(stderr, "error while encoding audio: %d\n", mp2fill_size);
             exit(ERR_ENCODING);
         }
+        // Stop if we don't have any bytes (probably don't have enough audio for a full frame of
+        // mpeg audio). When reading in another thread, just carry on with the next buffer.
+        if (mp2fill_size == 0) {
+            if (num_buffers > 0)
+                continue;
+            break;
+        }
         // Check that a whole number of frame was written
         // if (mp2fill_size % frame_len != 0) {
         // fprintf(stderr,"error while encoding audio: non-whole number of frames written\n");
@@ -702,12 +1797,12 @@ int main(int argc, char **argv)
         // }
 
         // Write the encoded audio out
-        bytes_out = fwrite(mp2buffer, sizeof(unsigned char), mp2fill_size, outputfile);
-        if (bytes_out != mp2fill_size) {
-            perror("error while writing to output file");
-            exit(ERR_WRITING_OUTPUT);
+        if (num_buffers > 0) {
+            ringbuffer_commit(pipeline.mp2_ring, mp2fill_size);
+        } else {
+            write_mp2(outputfile, mp2buffer, mp2fill_size);
+            total_bytes += mp2fill_size;
         }
-        total_bytes += bytes_out;
 
         // Only single frame ?
         if (single_frame_mode)
@@ -734,15 +1829,30 @@ int main(int argc, char **argv)
     // should only ever be a max of 1 frame on a flush. There may be zero
     // frames if the audio data was an exact multiple of 1152
     // 
-    mp2fill_size = twolame_encode_flush(encopts, mp2buffer, MP2_BUF_SIZE);
-    if (mp2fill_size > 0) {
-        int bytes_out = fwrite(mp2buffer, sizeof(unsigned char), mp2fill_size, outputfile);
-        frame_count++;
-        if (bytes_out <= 0) {
-            perror("error while writing to output file");
-            exit(ERR_WRITING_OUTPUT);
+    if (num_buffers > 0) {
+        unsigned char *mp2 = ringbuffer_write_slot(pipeline.mp2_ring);
+        mp2fill_size = twolame_encode_flush(encopts, mp2, MP2_BUF_SIZE);
+        if (mp2fill_size > 0) {
+            ringbuffer_commit(pipeline.mp2_ring, mp2fill_size);
+            frame_count++;
+        }
+
+        // Wait for everything to be written
+        ringbuffer_finish(pipeline.mp2_ring);
+        pthread_join(writer, NULL);
+        if (threaded_read)
+            pthread_join(reader, NULL);
+        total_bytes += pipeline.total_bytes;
+
+        ringbuffer_free(pipeline.pcm_ring);
+        ringbuffer_free(pipeline.mp2_ring);
+    } else {
+        mp2fill_size = twolame_encode_flush(encopts, mp2buffer, MP2_BUF_SIZE);
+        if (mp2fill_size > 0) {
+            write_mp2(outputfile, mp2buffer, mp2fill_size);
+            frame_count++;
+            total_bytes += mp2fill_size;
         }
-        total_bytes += bytes_out;
     }
 
     if (twolame_get_verbosity(encopts) > 1) {
@@ -750,6 +1860,15 @@ int main(int argc, char **argv)
         fprintf(stderr, "\nEncoding Finished.\n");
         fprintf(stderr, "Total bytes written: %s.\n", filesize);
         free(filesize);
+
+        if (twolame_get_frame_budget(encopts)) {
+            TWOLAME_realtime_stats stats;
+            twolame_get_realtime_stats(encopts, &stats);
+            fprintf(stderr, "Frames over budget: %i/%i (longest %i usec).\n",
+                    stats.frames_over_budget, stats.frames, stats.max_frame_usec);
+            fprintf(stderr, "Psycho model changes: %i down, %i up, %i frames re-used.\n",
+                    stats.degrade_events, stats.recover_events, stats.reused_frames);
+        }
     }
     // Close input and output streams
     inputfile->close(inputfile);
@@ -760,6 +1879,7 @@ int main(int argc, char **argv)
 
 
     // Free up memory
+    free(encoder_options);
     free(pcmaudio);
     free(mp2buffer);
 
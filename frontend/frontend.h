@@ -33,6 +33,10 @@
 #define OUTPUT_SUFFIX		".mp2"
 #define DEFAULT_CHANNELS	(2)
 #define DEFAULT_SAMPLERATE	(44100)
+#define DEFAULT_BUFFERS		(4)
+#define MAX_WRITEV			(16)
+#define OUTPUT_BUF_SIZE		(262144)
+#define SEGMENT_PREROLL		(2)
 
 
 /*
@@ -59,6 +63,12 @@ typedef struct audioin_s {
     // Read in some audio
     int (*read) (struct audioin_s *, short *buffer, int samples);
 
+    // Get a pointer to some audio without copying it (NULL if not possible)
+    int (*map) (struct audioin_s *, const short **buffer, int samples);
+
+    // Move to a sample frame (NULL if the input isn't seekable)
+    int (*seek) (struct audioin_s *, long frame);
+
     // Return error string (if any)
     const char *(*error_str) (struct audioin_s *);
 
@@ -75,10 +85,14 @@ typedef struct audioin_s {
     // Size of the samples (in bits)
     int samplesize;
 
+    // Has --byte-swap already been applied by read() ?
+    int byteswapped;
+
 } audioin_t;
 
 
 
-/* Initialisers */
+/* Initialisers (return NULL if the file can't be opened) */
 audioin_t *open_audioin_sndfile(char *filename, SF_INFO * sfinfo);
 audioin_t *open_audioin_raw(char *filename, SF_INFO * sfinfo, int samplesize);
+audioin_t *open_audioin_mmap(char *filename, SF_INFO * sfinfo, int samplesize, int byteswap);
@@ -0,0 +1,206 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "ringbuffer.h"
+
+
+
+ringbuffer_t *ringbuffer_new(int depth, int slot_size)
+{
+    ringbuffer_t *rb = NULL;
+
+    rb = (ringbuffer_t *) calloc(1, sizeof(ringbuffer_t));
+    if (rb == NULL)
+        return NULL;
+
+    rb->depth = depth;
+    rb->slot_size = slot_size;
+    rb->data = (unsigned char *) calloc(depth, slot_size);
+    rb->used = (int *) calloc(depth, sizeof(int));
+    if (rb->data == NULL || rb->used == NULL) {
+        free(rb->data);
+        free(rb->used);
+        free(rb);
+        return NULL;
+    }
+
+    pthread_mutex_init(&rb->mutex, NULL);
+    pthread_cond_init(&rb->cond, NULL);
+
+    return rb;
+}
+
+
+void ringbuffer_free(ringbuffer_t * rb)
+{
+    if (rb == NULL)
+        return;
+
+    pthread_cond_destroy(&rb->cond);
+    pthread_mutex_destroy(&rb->mutex);
+    free(rb->data);
+    free(rb->used);
+    free(rb);
+}
+
+
+/* 
+  Wake up the other side, if it is asleep.
+  The full barrier orders our index update before reading 'waiters',
+  matching the one in ringbuffer_wait(): either we see the sleeper, or
+  the sleeper sees our update and doesn't go to sleep.
+*/
+static void ringbuffer_wake(ringbuffer_t * rb)
+{
+    __sync_synchronize();
+    if (rb->waiters) {
+        pthread_mutex_lock(&rb->mutex);
+        pthread_cond_broadcast(&rb->cond);
+        pthread_mutex_unlock(&rb->mutex);
+    }
+}
+
+
+/* Sleep until there is a slot to write to (for_write) or to read from */
+static void ringbuffer_wait(ringbuffer_t * rb, int for_write)
+{
+    pthread_mutex_lock(&rb->mutex);
+    __sync_fetch_and_add(&rb->waiters, 1);
+    while (1) {
+        unsigned int count = rb->tail - rb->head;
+        if (for_write && count < (unsigned int) rb->depth)
+            break;
+        if (!for_write && (count > 0 || rb->eof))
+            break;
+        pthread_cond_wait(&rb->cond, &rb->mutex);
+    }
+    __sync_fetch_and_sub(&rb->waiters, 1);
+    pthread_mutex_unlock(&rb->mutex);
+}
+
+
+/* Get the next empty slot, waiting until one is free */
+void *ringbuffer_write_slot(ringbuffer_t * rb)
+{
+    if (rb->tail - rb->head >= (unsigned int) rb->depth)
+        ringbuffer_wait(rb, 1);
+
+    // Don't touch the slot until we have seen the consumer let go of it
+    __sync_synchronize();
+
+    return rb->data + (rb->tail % rb->depth) * rb->slot_size;
+}
+
+
+/* Pass the slot from ringbuffer_write_slot() to the consumer */
+void ringbuffer_commit(ringbuffer_t * rb, int used)
+{
+    rb->used[rb->tail % rb->depth] = used;
+
+    // Publish the contents of the slot before the new tail
+    __sync_synchronize();
+    rb->tail++;
+
+    ringbuffer_wake(rb);
+}
+
+
+/* Tell the consumer that there is nothing more to come */
+void ringbuffer_finish(ringbuffer_t * rb)
+{
+    __sync_synchronize();
+    rb->eof = 1;
+    ringbuffer_wake(rb);
+}
+
+
+/* Get the next full slot, or NULL when the producer has finished */
+void *ringbuffer_read_slot(ringbuffer_t * rb, int *used)
+{
+    if (rb->tail == rb->head)
+        ringbuffer_wait(rb, 0);
+
+    // Don't read the slot until we have seen the producer's tail
+    __sync_synchronize();
+
+    if (rb->tail == rb->head)
+        return NULL;
+
+    *used = rb->used[rb->head % rb->depth];
+    return rb->data + (rb->head % rb->depth) * rb->slot_size;
+}
+
+
+/* Give the slot from ringbuffer_read_slot() back to the producer */
+void ringbuffer_release(ringbuffer_t * rb)
+{
+    // Finish with the slot before the producer can see it is free
+    __sync_synchronize();
+    rb->head++;
+
+    ringbuffer_wake(rb);
+}
+
+
+/*
+  Get all of the full slots at once (up to max), so that they can be
+  written out with a single writev(). Returns the number of slots,
+  or 0 when the producer has finished.
+*/
+int ringbuffer_read_slots(ringbuffer_t * rb, struct iovec *iov, int max)
+{
+    unsigned int count, n;
+
+    if (rb->tail == rb->head)
+        ringbuffer_wait(rb, 0);
+
+    // Don't read the slots until we have seen the producer's tail
+    __sync_synchronize();
+
+    count = rb->tail - rb->head;
+    if (count > (unsigned int) max)
+        count = max;
+
+    for (n = 0; n < count; n++) {
+        unsigned int slot = (rb->head + n) % rb->depth;
+        iov[n].iov_base = rb->data + slot * rb->slot_size;
+        iov[n].iov_len = rb->used[slot];
+    }
+
+    return count;
+}
+
+
+/* Give the slots from ringbuffer_read_slots() back to the producer */
+void ringbuffer_release_slots(ringbuffer_t * rb, int count)
+{
+    __sync_synchronize();
+    rb->head += count;
+
+    ringbuffer_wake(rb);
+}
+
+
+// vim:ts=4:sw=4:nowrap: 
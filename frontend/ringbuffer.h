@@ -0,0 +1,73 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+#ifndef TWOLAME_RINGBUFFER_H
+#define TWOLAME_RINGBUFFER_H
+
+#include <pthread.h>
+#include <sys/uio.h>
+
+
+/*
+  Bounded single-producer / single-consumer ring of fixed size slots.
+
+  The producer fills the slot returned by ringbuffer_write_slot() and
+  hands it over with ringbuffer_commit(); the consumer gets it with
+  ringbuffer_read_slot() and gives it back with ringbuffer_release().
+  Each index is only ever written by one thread, so passing a slot
+  doesn't take a lock. The mutex is only used to sleep when the ring
+  is full or empty.
+*/
+typedef struct ringbuffer_s {
+    int depth;                  // number of slots
+    int slot_size;              // size of each slot in bytes
+    unsigned char *data;
+    int *used;                  // bytes used in each slot
+
+    volatile unsigned int head; // next slot to read (only written by consumer)
+    volatile unsigned int tail; // next slot to write (only written by producer)
+    volatile int eof;           // producer has finished
+    volatile int waiters;       // threads sleeping on cond
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} ringbuffer_t;
+
+
+ringbuffer_t *ringbuffer_new(int depth, int slot_size);
+void ringbuffer_free(ringbuffer_t * rb);
+
+void *ringbuffer_write_slot(ringbuffer_t * rb);
+void ringbuffer_commit(ringbuffer_t * rb, int used);
+void ringbuffer_finish(ringbuffer_t * rb);
+
+void *ringbuffer_read_slot(ringbuffer_t * rb, int *used);
+void ringbuffer_release(ringbuffer_t * rb);
+
+int ringbuffer_read_slots(ringbuffer_t * rb, struct iovec *iov, int max);
+void ringbuffer_release_slots(ringbuffer_t * rb, int count);
+
+#endif
+
+
+// vim:ts=4:sw=4:nowrap: 
@@ -0,0 +1,151 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "workqueue.h"
+
+
+
+workqueue_t *workqueue_new(int num_items, int num_workers)
+{
+    workqueue_t *wq = NULL;
+    int i;
+
+    if (num_workers < 1)
+        return NULL;
+
+    wq = (workqueue_t *) calloc(1, sizeof(workqueue_t));
+    if (wq == NULL)
+        return NULL;
+
+    wq->num_workers = num_workers;
+    wq->deques = (workqueue_deque_t *) calloc(num_workers, sizeof(workqueue_deque_t));
+    if (wq->deques == NULL) {
+        free(wq);
+        return NULL;
+    }
+    // Deal out the items in contiguous blocks
+    for (i = 0; i < num_workers; i++) {
+        wq->deques[i].head = (int) (((long) num_items * i) / num_workers);
+        wq->deques[i].tail = (int) (((long) num_items * (i + 1)) / num_workers);
+        pthread_mutex_init(&wq->deques[i].mutex, NULL);
+    }
+
+    return wq;
+}
+
+
+void workqueue_free(workqueue_t * wq)
+{
+    int i;
+
+    if (wq == NULL)
+        return;
+
+    for (i = 0; i < wq->num_workers; i++)
+        pthread_mutex_destroy(&wq->deques[i].mutex);
+    free(wq->deques);
+    free(wq);
+}
+
+
+/* Take the next item from the front of a worker's own block */
+static int workqueue_pop(workqueue_deque_t * deque)
+{
+    int item = -1;
+
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->head < deque->tail)
+        item = deque->head++;
+    pthread_mutex_unlock(&deque->mutex);
+
+    return item;
+}
+
+
+/*
+  Steal the back half of the fullest block into the worker's own
+  (empty) block. Returns FALSE once there is nothing left to steal.
+*/
+static int workqueue_steal(workqueue_t * wq, int worker)
+{
+    workqueue_deque_t *self = &wq->deques[worker];
+    int victim, first, last;
+
+    while (1) {
+        int i, most = 0;
+
+        // Find the worker with the most items left
+        victim = -1;
+        for (i = 0; i < wq->num_workers; i++) {
+            int left = wq->deques[i].tail - wq->deques[i].head;
+            if (i != worker && left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+        if (victim < 0)
+            return 0;
+
+        // The sizes were read without the lock, so check again
+        pthread_mutex_lock(&wq->deques[victim].mutex);
+        first = wq->deques[victim].head;
+        last = wq->deques[victim].tail;
+        if (first < last) {
+            first += (last - first) / 2;
+            wq->deques[victim].tail = first;
+            pthread_mutex_unlock(&wq->deques[victim].mutex);
+            break;
+        }
+        pthread_mutex_unlock(&wq->deques[victim].mutex);
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    self->head = first;
+    self->tail = last;
+    self->steals++;
+    pthread_mutex_unlock(&self->mutex);
+
+    return 1;
+}
+
+
+/*
+  Get the next item for a worker to process.
+  Returns -1 when every item has been handed out.
+*/
+int workqueue_next(workqueue_t * wq, int worker)
+{
+    int item;
+
+    while ((item = workqueue_pop(&wq->deques[worker])) < 0) {
+        if (!workqueue_steal(wq, worker))
+            break;
+    }
+
+    return item;
+}
+
+
+// vim:ts=4:sw=4:nowrap:
@@ -0,0 +1,60 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+#ifndef TWOLAME_WORKQUEUE_H
+#define TWOLAME_WORKQUEUE_H
+
+#include <pthread.h>
+
+
+/*
+  Work-stealing queue of the items 0 .. num_items-1.
+
+  Each worker starts off owning a contiguous block of items, which
+  it takes from the front. A worker whose block has run out steals
+  the back half of the largest block left, so neighbouring items
+  (usually similar files) tend to stay on the same worker and the
+  locks are only contended while stealing.
+*/
+typedef struct workqueue_deque_s {
+    int head;                   // next item to take (owner end)
+    int tail;                   // one past the last item (stealing end)
+    unsigned int steals;        // blocks stolen by the owner
+    pthread_mutex_t mutex;
+} workqueue_deque_t;
+
+typedef struct workqueue_s {
+    int num_workers;
+    workqueue_deque_t *deques;
+} workqueue_t;
+
+
+workqueue_t *workqueue_new(int num_items, int num_workers);
+void workqueue_free(workqueue_t * wq);
+
+int workqueue_next(workqueue_t * wq, int worker);
+
+#endif
+
+
+// vim:ts=4:sw=4:nowrap:
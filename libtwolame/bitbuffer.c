@@ -29,6 +29,7 @@
 #include "twolame.h"
 #include "common.h"
 #include "bitbuffer.h"
+#include "crc.h"
 #include "mem.h"
 
 
@@ -44,6 +45,8 @@ bit_stream *buffer_init(unsigned char *buffer, int buffer_size)
     bs->totbit = 0;
     bs->eob = FALSE;
     bs->eobs = FALSE;
+    bs->crc_on = FALSE;
+    bs->crc = 0;
 
     return bs;
 }
@@ -58,6 +61,74 @@ void buffer_deinit(bit_stream ** bs)
     TWOLAME_FREE(*bs);
 }
 
+/* Write count codes into the bit stream, each of length[i] bits (which can be 0). It
+   gives the same bits as buffer_putbits() for each code, but collects them in a word
+   and stores a byte at a time */
+void buffer_putcodes(bit_stream * bs, const unsigned int *code, const unsigned char *length,
+                     int count)
+{
+    int idx = bs->buf_byte_idx;
+    int nbits = 8 - bs->buf_bit_idx;    // bits in acc, which are still to be stored
+    unsigned int acc = bs->buf[idx] >> bs->buf_bit_idx;
+    unsigned int low = bs->buf[idx] & ((1 << bs->buf_bit_idx) - 1);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        int n = length[i];
+
+        acc = (acc << n) | (code[i] & ((1 << n) - 1));
+        nbits += n;
+        bs->totbit += n;
+        while (nbits >= 8) {
+            nbits -= 8;
+            bs->buf[idx] = ((acc >> nbits) & 0xff) | low;
+            low = 0;
+            if (bs->crc_on)
+                bs->crc = crc_update(bs->buf[idx], bs->crc, 8);
+            if (++idx >= bs->buf_size) {
+                fprintf(stderr, "buffer_putcodes: error. bit_stream buffer needs to be bigger\n");
+                bs->buf_byte_idx = idx;
+                bs->buf_bit_idx = 8;
+                return;
+            }
+        }
+    }
+
+    bs->buf[idx] = ((acc << (8 - nbits)) & 0xff) | low;
+    bs->buf_byte_idx = idx;
+    bs->buf_bit_idx = 8 - nbits;
+}
+
+/*
+  The CRC-16 of the error protection is worked out as the protected
+  bits are written: each byte goes into bs->crc as it is completed,
+  so there's no need to go back over them. The protected bits have to
+  start on a byte boundary, and can end anywhere.
+*/
+
+/* Start a new CRC with the next byte */
+void buffer_crc_start(bit_stream * bs)
+{
+    bs->crc = 0xffff;
+    bs->crc_on = TRUE;
+}
+
+/* Stop adding to the CRC, after the bits written so far in the current byte */
+void buffer_crc_pause(bit_stream * bs)
+{
+    if (!bs->crc_on)
+        return;
+    if (bs->buf_bit_idx < 8)
+        bs->crc = crc_update(bs->buf[bs->buf_byte_idx], bs->crc, 8 - bs->buf_bit_idx);
+    bs->crc_on = FALSE;
+}
+
+/* Carry on adding to the CRC from the next byte */
+void buffer_crc_resume(bit_stream * bs)
+{
+    bs->crc_on = TRUE;
+}
+
 
 
 // vim:ts=4:sw=4:nowrap: 
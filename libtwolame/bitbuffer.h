@@ -36,11 +36,18 @@ typedef struct bit_stream_struc {
     int buf_bit_idx;            /* pointer to top bit of top byte in buffer */
     int eob;                    /* end of buffer index */
     int eobs;                   /* end of bit stream flag */
+    int crc_on;                 /* fold each byte into crc as it is completed */
+    unsigned int crc;           /* CRC-16 of the bits written while crc_on */
 } bit_stream;
 
 
 bit_stream *buffer_init(unsigned char *buffer, int buffer_size);
 void buffer_deinit(bit_stream ** bs);
+void buffer_putcodes(bit_stream * bs, const unsigned int *code, const unsigned char *length,
+                     int count);
+void buffer_crc_start(bit_stream * bs);
+void buffer_crc_pause(bit_stream * bs);
+void buffer_crc_resume(bit_stream * bs);
 
 /*return the current bit stream length (in bits)*/
 #define buffer_sstell(bs) (bs->totbit)
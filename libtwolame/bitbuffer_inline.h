@@ -23,6 +23,9 @@
  */
 
 
+#include "crc.h"
+
+
 /* write 1 bit from the bit stream */
 static inline void buffer_put1bit(bit_stream * bs, int bit)
 {
@@ -31,6 +34,8 @@ static inline void buffer_put1bit(bit_stream * bs, int bit)
     bs->buf[bs->buf_byte_idx] |= (bit & 0x1) << (bs->buf_bit_idx - 1);
     bs->buf_bit_idx--;
     if (!bs->buf_bit_idx) {
+        if (bs->crc_on)
+            bs->crc = crc_update(bs->buf[bs->buf_byte_idx], bs->crc, 8);
         bs->buf_bit_idx = 8;
         bs->buf_byte_idx++;
         if (bs->buf_byte_idx >= bs->buf_size) {
@@ -56,6 +61,8 @@ static inline void buffer_putbits(bit_stream * bs, unsigned int val, int N)
         bs->buf[bs->buf_byte_idx] |= (tmp & putmask[k]) << (bs->buf_bit_idx - k);
         bs->buf_bit_idx -= k;
         if (!bs->buf_bit_idx) {
+            if (bs->crc_on)
+                bs->crc = crc_update(bs->buf[bs->buf_byte_idx], bs->crc, 8);
             bs->buf_bit_idx = 8;
             bs->buf_byte_idx++;
             if (bs->buf_byte_idx >= bs->buf_size) {
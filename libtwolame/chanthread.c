@@ -0,0 +1,307 @@
+/*
+ *  TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *  Copyright (C) 2001-2004 Michael Cheng
+ *  Copyright (C) 2004-2006 The TwoLAME Project
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+#define _GNU_SOURCE             // for pthread_setaffinity_np()
+
+#include <stdio.h>
+#include <string.h>
+
+#include "twolame.h"
+#include "common.h"
+#include "bitbuffer.h"
+#include "mem.h"
+#include "encode.h"
+#include "subband.h"
+#include "psycho_1.h"
+#include "psycho_2.h"
+#include "psycho_3.h"
+#include "psycho_4.h"
+#include "chanthread.h"
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+
+/*
+  Channel threads
+
+  In stereo the two channels don't share any state until the bit
+  allocation, so the right channel's filterbank, scalefactors and
+  psycho model can be run on a second thread while the calling
+  thread does the left channel. This halves the time it takes to
+  encode a frame on a machine with cores to spare, which is what
+  matters for live encoding.
+
+  The second thread has its own memory for the psycho models,
+  holding the state of the right channel, so the SMR values
+  (and the output) are exactly the same as a single thread gives.
+  Psycho models -1 and 0 are cheap and are left to encode_frame().
+*/
+
+#ifdef HAVE_PTHREAD_H
+
+struct chanthread_struct {
+    twolame_options *glopts;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;       // signalled when there is a job to do
+    pthread_cond_t done;        // signalled when the job is finished
+    int pending;                // TRUE from posting a job until it is finished
+    int quit;
+
+    // The current job
+    int psymodel;
+    FLOAT **hist;
+    sb_sample_t *sb_sample;
+    unsigned int (*scalar)[3][SBLIMIT];
+    FLOAT (*max_sc)[SBLIMIT];
+    FLOAT (*smr)[SBLIMIT];
+
+    // Psycho model memory for the right channel
+    psycho_1_mem *p1mem;
+    psycho_2_mem *p2mem;
+    psycho_3_mem *p3mem;
+    psycho_4_mem *p4mem;
+};
+
+
+/* Filterbank, scalefactors and psycho model for a single channel */
+static void analyse_channel(chanthread * ct, int ch,
+                            psycho_1_mem ** p1mem, psycho_2_mem ** p2mem,
+                            psycho_3_mem ** p3mem, psycho_4_mem ** p4mem)
+{
+    twolame_options *glopts = ct->glopts;
+    int gr, bl;
+
+    for (gr = 0; gr < 3; gr++)
+        for (bl = 0; bl < 12; bl++)
+            window_filter_subband(&glopts->smem, &ct->hist[ch][gr * 12 * 32 + 32 * bl],
+                                  &(*ct->sb_sample)[ch][gr][bl][0]);
+
+    scalefactor_calc(&(*ct->sb_sample)[ch], &ct->scalar[ch], 1, glopts->sblimit);
+    find_sf_max_channel(glopts, ct->scalar[ch], ct->max_sc[ch]);
+
+    switch (ct->psymodel) {
+    case 1:
+        psycho_1_channel(glopts, p1mem, ch, ct->hist, ct->max_sc, ct->smr);
+        break;
+    case 2:
+        psycho_2_channel(glopts, p2mem, ch, ct->hist, ct->smr);
+        break;
+    case 3:
+        psycho_3_channel(glopts, p3mem, ch, ct->hist, ct->max_sc, ct->smr);
+        break;
+    case 4:
+        psycho_4_channel(glopts, p4mem, ch, ct->hist, ct->smr);
+        break;
+    default:
+        break;
+    }
+}
+
+
+static void *chanthread_worker(void *arg)
+{
+    chanthread *ct = (chanthread *) arg;
+
+    pthread_mutex_lock(&ct->mutex);
+    while (1) {
+        while (!ct->pending && !ct->quit)
+            pthread_cond_wait(&ct->start, &ct->mutex);
+        if (ct->quit)
+            break;
+        pthread_mutex_unlock(&ct->mutex);
+
+        analyse_channel(ct, 1, &ct->p1mem, &ct->p2mem, &ct->p3mem, &ct->p4mem);
+
+        pthread_mutex_lock(&ct->mutex);
+        ct->pending = FALSE;
+        pthread_cond_signal(&ct->done);
+    }
+    pthread_mutex_unlock(&ct->mutex);
+
+    return NULL;
+}
+
+
+/*
+  Start the second thread, if channel threads were asked for
+  and there are two channels to encode.
+  Returns -1 if the thread can't be started.
+*/
+int chanthread_init(twolame_options * glopts)
+{
+    chanthread *ct;
+
+    glopts->chanthread = NULL;
+    if (!glopts->channel_threads || glopts->num_channels_out != 2)
+        return 0;
+
+    /* The fixed point engine filters both channels itself */
+    if (glopts->fixed_point) {
+        if (glopts->verbosity > 0)
+            fprintf(stderr, "Warning: channel threads aren't used with the fixed point engine.\n");
+        return 0;
+    }
+
+    ct = (chanthread *) TWOLAME_MALLOC(sizeof(chanthread));
+    if (ct == NULL)
+        return -1;
+    ct->glopts = glopts;
+
+    pthread_mutex_init(&ct->mutex, NULL);
+    pthread_cond_init(&ct->start, NULL);
+    pthread_cond_init(&ct->done, NULL);
+    if (pthread_create(&ct->thread, NULL, chanthread_worker, ct) != 0) {
+        fprintf(stderr, "chanthread_init(): failed to start channel thread.\n");
+        pthread_cond_destroy(&ct->done);
+        pthread_cond_destroy(&ct->start);
+        pthread_mutex_destroy(&ct->mutex);
+        TWOLAME_FREE(ct);
+        return -1;
+    }
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    if (glopts->channel_thread_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(glopts->channel_thread_cpu, &cpus);
+        if (pthread_setaffinity_np(ct->thread, sizeof(cpus), &cpus) != 0)
+            fprintf(stderr, "Warning: failed to pin channel thread to CPU %d.\n",
+                    glopts->channel_thread_cpu);
+    }
+#endif
+
+    glopts->chanthread = ct;
+    return 0;
+}
+
+
+/*
+  Run the filterbank, the scalefactors and (for psycho models 1-4)
+  the psycho model for both channels, the right channel on the
+  second thread. Returns once both have finished.
+*/
+void chanthread_analyse(twolame_options * glopts, int psymodel,
+                        FLOAT * hist[2], sb_sample_t * sb_sample,
+                        unsigned int scalar[2][3][SBLIMIT], FLOAT max_sc[2][SBLIMIT],
+                        FLOAT smr[2][SBLIMIT])
+{
+    chanthread *ct = glopts->chanthread;
+    int sb;
+
+    ct->psymodel = psymodel;
+    ct->hist = hist;
+    ct->sb_sample = sb_sample;
+    ct->scalar = scalar;
+    ct->max_sc = max_sc;
+    ct->smr = smr;
+
+    pthread_mutex_lock(&ct->mutex);
+    ct->pending = TRUE;
+    pthread_cond_signal(&ct->start);
+    pthread_mutex_unlock(&ct->mutex);
+
+    analyse_channel(ct, 0, &glopts->p1mem, &glopts->p2mem, &glopts->p3mem, &glopts->p4mem);
+
+    pthread_mutex_lock(&ct->mutex);
+    while (ct->pending)
+        pthread_cond_wait(&ct->done, &ct->mutex);
+    pthread_mutex_unlock(&ct->mutex);
+
+    // As find_sf_max() does for the bands above sblimit
+    for (sb = glopts->sblimit; sb < SBLIMIT; sb++)
+        max_sc[0][sb] = max_sc[1][sb] = 1E-20;
+}
+
+
+/* Forget the psycho model state of the right channel */
+void chanthread_reset(twolame_options * glopts)
+{
+    chanthread *ct = glopts->chanthread;
+
+    if (ct == NULL)
+        return;
+
+    psycho_2_reset(ct->p2mem);
+    psycho_4_reset(ct->p4mem);
+}
+
+
+void chanthread_deinit(twolame_options * glopts)
+{
+    chanthread *ct = glopts->chanthread;
+
+    if (ct == NULL)
+        return;
+
+    pthread_mutex_lock(&ct->mutex);
+    ct->quit = TRUE;
+    pthread_cond_signal(&ct->start);
+    pthread_mutex_unlock(&ct->mutex);
+    pthread_join(ct->thread, NULL);
+
+    pthread_cond_destroy(&ct->done);
+    pthread_cond_destroy(&ct->start);
+    pthread_mutex_destroy(&ct->mutex);
+
+    psycho_4_deinit(&ct->p4mem);
+    psycho_3_deinit(&ct->p3mem);
+    psycho_2_deinit(&ct->p2mem);
+    psycho_1_deinit(&ct->p1mem);
+
+    TWOLAME_FREE(ct);
+    glopts->chanthread = NULL;
+}
+
+#else                           /* HAVE_PTHREAD_H */
+
+/* Without threads the channels are always encoded one after the other */
+int chanthread_init(twolame_options * glopts)
+{
+    glopts->chanthread = NULL;
+    if (glopts->channel_threads && glopts->verbosity > 0)
+        fprintf(stderr, "Warning: this build of libtwolame doesn't support channel threads.\n");
+    return 0;
+}
+
+void chanthread_analyse(twolame_options * glopts, int psymodel,
+                        FLOAT * hist[2], sb_sample_t * sb_sample,
+                        unsigned int scalar[2][3][SBLIMIT], FLOAT max_sc[2][SBLIMIT],
+                        FLOAT smr[2][SBLIMIT])
+{
+}
+
+void chanthread_reset(twolame_options * glopts)
+{
+}
+
+void chanthread_deinit(twolame_options * glopts)
+{
+}
+
+#endif                          /* HAVE_PTHREAD_H */
+
+
+// vim:ts=4:sw=4:nowrap: 
@@ -0,0 +1,40 @@
+/*
+ *  TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *  Copyright (C) 2001-2004 Michael Cheng
+ *  Copyright (C) 2004-2006 The TwoLAME Project
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+
+#ifndef TWOLAME_CHANTHREAD_H
+#define TWOLAME_CHANTHREAD_H
+
+int chanthread_init(twolame_options * glopts);
+void chanthread_analyse(twolame_options * glopts, int psymodel,
+                        FLOAT * hist[2], sb_sample_t * sb_sample,
+                        unsigned int scalar[2][3][SBLIMIT], FLOAT max_sc[2][SBLIMIT],
+                        FLOAT smr[2][SBLIMIT]);
+void chanthread_reset(twolame_options * glopts);
+void chanthread_deinit(twolame_options * glopts);
+
+#endif
+
+
+// vim:ts=4:sw=4:nowrap: 
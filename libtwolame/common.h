@@ -44,6 +44,11 @@
 #define			FLOAT					double
 #endif
 
+/* Products and sums in the fixed point engine (see twolame_set_fixed_point()) */
+#ifndef FIXED_ACC
+#define			FIXED_ACC				long long
+#endif
+
 #define			NULL_CHAR				'\0'
 
 #define			MAX_U_32_NUM			0xFFFFFFFF
@@ -68,11 +73,14 @@
 #define			SCALE_BLOCK				12
 #define			SCALE_RANGE				64
 #define			SCALE					32768
+#define			HISTORY_SIZE			480
+#define			FIXED_BITS				28      // fraction bits of the fixed point subband samples
 #define			CRC16_POLYNOMIAL		0x8005
 #define			CRC8_POLYNOMIAL			0x1D
 
 #define			MIN(A, B)		((A) < (B) ? (A) : (B))
 #define			MAX(A, B)		((A) > (B) ? (A) : (B))
+#define			MIN(A, B)		((A) < (B) ? (A) : (B))
 
 
 /* This is the smallest MNR a subband can have before it is counted
@@ -94,6 +102,19 @@
 /* max output power to 96 dB per spec */
 
 
+/* The tonal or non-tonal maskers left for the threshold calculation
+   in psycho models 1 and 3 (see masking.c) */
+typedef struct {
+    int count;
+    int line[HAN_SIZE];
+    FLOAT x[HAN_SIZE];          // level (dB)
+    FLOAT bark[HAN_SIZE];
+    FLOAT base[HAN_SIZE];       // masking index added to the level
+    FLOAT lower[HAN_SIZE];      // slopes of the masking function
+    FLOAT upper[HAN_SIZE];
+} masker_list;
+
+
 /***************************************************************************************
   Psychoacoustic Model 2/4 Definitions
 ****************************************************************************************/
@@ -121,19 +142,27 @@ typedef struct {
     FLOAT bark, hear, x;
 } g_thres, *g_ptr;
 
+/* The spectrum, one entry per line. next links the lines
+   into the lists of tonal and non-tonal components */
 typedef struct {
-    FLOAT x;
-    int type, next, map;
-} mask, *mask_ptr;
+    FLOAT x[HAN_SIZE];          // level (dB)
+    int type[HAN_SIZE];         // TONE, NOISE or FALSE
+    int next[HAN_SIZE];
+    int map[HAN_SIZE];          // frequency subband (index into ltg)
+} mask_spectrum;
 
 typedef struct psycho_1_mem_struct {
-    int off[2];
-    FLOAT fft_buf[2][1408];
+    FLOAT window[FFT_SIZE];
     int *cbound;
     int crit_band;
     int sub_size;
-    mask_ptr power;
+    mask_spectrum power;
+    masker_list tonal;
+    masker_list noise;
     g_ptr ltg;
+    FLOAT *bark;                // bark value of each frequency subband
+    FLOAT *thres;               // masking threshold of each frequency subband
+    int used_size;              // frequency subbands up to glopts->sblimit
     FLOAT dbtable[DBTAB];
 } psycho_1_mem;
 
@@ -146,14 +175,17 @@ Psycho3 memory structure
 
 #define SUBSIZE 136
 typedef struct psycho_3_mem_struct {
-    int off[2];
     int freq_subset[SUBSIZE];
+    FLOAT subset_bark[SUBSIZE]; // bark value of each line in freq_subset
+    int used_subset;            // lines of freq_subset up to glopts->sblimit
     FLOAT bark[HBLKSIZE];
     FLOAT ath[HBLKSIZE];
-    FLOAT fft_buf[2][1408];
+    FLOAT window[FFT_SIZE];
 #define CRITBANDMAX 32          /* this is much higher than it needs to be. really only about 24 */
     int cbands;                 /* How many critical bands there really are */
     int cbandindex[CRITBANDMAX];    /* The spectral line index of the start of each critical band */
+    masker_list tonal;
+    masker_list noise;
     FLOAT dbtable[DBTAB];
 } psycho_3_mem;
 
@@ -200,12 +232,19 @@ typedef struct psycho_4_mem_struct {
     FLOAT cbval[CBANDS];
     FLOAT rnorm[CBANDS];
     FLOAT wsamp_r[BLKSIZE], phi[BLKSIZE], energy[BLKSIZE], window[BLKSIZE];
+    FLOAT wsamp_tail[BLKSIZE - 480];   // end of the first pass's window (see psycho_2_window())
     FLOAT ath[HBLKSIZE], thr[HBLKSIZE], c[HBLKSIZE];
     FLOAT fthr[HBLKSIZE], absthr[HBLKSIZE]; // psy2 only
     int numlines[CBANDS];
     int partition[HBLKSIZE];
     FLOAT *tmn;
     FCB *s;
+    FCB *spread;                // s transposed, see spread.c
+    int spread_first[CBANDS];   // rows of each column of s which aren't zero
+    int spread_last[CBANDS];
+    unsigned int used_lines;    // spectral lines up to glopts->sblimit (see spread_cutoff())
+    unsigned int used_bands;    // partitions of those lines
+    unsigned int c_lines;       // lines whose unpredictability spreads into them
     FHBLK *lthr;
     F2HBLK *r, *phi_sav;
     FLOAT snrtmp[2][32];
@@ -213,19 +252,104 @@ typedef struct psycho_4_mem_struct {
 } psycho_4_mem, psycho_2_mem;
 
 
+
+/***************************************************************************************
+Psycho5 memory structure
+****************************************************************************************/
+
+typedef struct psycho_5_mem_struct {
+    FLOAT bark[SBLIMIT];        // bark value at the centre of each subband
+    FLOAT ath[SBLIMIT];         // lowest ATH in each subband (as energy)
+    FLOAT tmn[SBLIMIT];         // tone masking noise (dB)
+    FLOAT spread[SBLIMIT][SBLIMIT]; // spreading function from subband [j] to [i]
+    int spread_first[SBLIMIT];  // range of i for which spread[j][i] isn't zero
+    int spread_last[SBLIMIT];
+    FLOAT rnorm[SBLIMIT];       // sum of the spreading function into each subband
+    FLOAT last_energy[2][SBLIMIT];  // energy of the last granule of the previous frame
+} psycho_5_mem;
+
+
 /***************************************************************************************
  Subband utility structures
 ****************************************************************************************/
 
 typedef struct subband_mem_struct {
-    FLOAT x[2][512];
     FLOAT m[16][32];
-    int off[2];
-    int half[2];
+    int sblimit;                // subbands to filter, the rest are zero
+    int fixed_window[512];      // enwindow for the fixed point engine, in Q28
+    int fixed_m[16][32];        // m for the fixed point engine, in Q28
 } subband_mem;
 
 
 
+/***************************************************************************************
+ Padding slot accounting (see availbits.c)
+****************************************************************************************/
+
+typedef struct slotinfo_struct {
+    FLOAT average;
+    FLOAT frac;
+    int whole;
+    FLOAT lag;
+    int extra;
+} slotinfo;
+
+
+
+/***************************************************************************************
+ Real-time governor structure
+****************************************************************************************/
+
+#define RT_LADDER_SIZE	(6)
+
+typedef struct realtime_mem_struct {
+    int ladder[RT_LADDER_SIZE]; // psycho models to step down through
+    int ladder_len;
+    int rung;                   // current position on the ladder
+    int settle;                 // number of frames to ignore after a change
+    int good_frames;            // consecutive frames with headroom
+    int hold;                   // frames of headroom needed to step back up
+    double frame_start;
+    TWOLAME_realtime_stats stats;
+} realtime_mem;
+
+
+
+/***************************************************************************************
+ Channel thread (private to chanthread.c)
+****************************************************************************************/
+
+typedef struct chanthread_struct chanthread;
+
+
+
+/***************************************************************************************
+ Frame encoding
+****************************************************************************************/
+
+/* The quantizer of one allocation of one subband (see init_bit_allocation()) */
+typedef struct {
+    FLOAT a, b;                 // quantization coefficients (ISO11172 Table C.6)
+    unsigned int steps2n;       // the power of 2 just under steps
+    unsigned int steps;         // number of steps, for grouping three samples
+    int bits;                   // bits per codeword
+    int group;                  // 3 codewords for three samples, or 1 if they are grouped
+    int fixed_a, fixed_b;       // a and b in Q30, for the fixed point engine
+} alloc_step;
+
+/* The frame encoding loops for one channel layout (private to encode.c) */
+typedef struct encode_kernels_struct encode_kernels;
+
+
+
+/***************************************************************************************
+ Real-time input ring (private to pcmring.c)
+****************************************************************************************/
+
+typedef struct pcmring_struct pcmring;
+
+
+
 /***************************************************************************************
  Header and frame information
 ****************************************************************************************/
@@ -251,6 +375,34 @@ typedef struct {
 typedef unsigned int subband_t[2][3][SCALE_BLOCK][SBLIMIT];
 typedef FLOAT jsb_sample_t[3][SCALE_BLOCK][SBLIMIT];
 typedef FLOAT sb_sample_t[2][3][SCALE_BLOCK][SBLIMIT];
+typedef int fixed_jsb_sample_t[3][SCALE_BLOCK][SBLIMIT];    // in Q28 (FIXED_BITS)
+typedef int fixed_sample_t[2][3][SCALE_BLOCK][SBLIMIT];
+
+
+
+/***************************************************************************************
+ Lanes of mono streams for twolame_encode_frame_multi()
+****************************************************************************************/
+
+/* Streams filtered together by window_filter_subband_lanes() */
+#define LANE_BLOCK		(4)
+
+/* Sample n of the l'th stream of a block is at [n][l],
+   so the filterbank works on them all at once, one in each lane.
+   The history is kept like this from one frame to the next. */
+typedef struct multi_lanes_struct {
+    FLOAT history[HISTORY_SIZE + TWOLAME_SAMPLES_PER_FRAME][LANE_BLOCK];
+    FLOAT sb_sample[SBLIMIT][LANE_BLOCK];
+} multi_lanes;
+
+/* The streams of a multi-stream encoder. The first num_blocks * LANE_BLOCK
+   are filtered in the lanes, any left over use their own history */
+struct twolame_multi_struct {
+    twolame_options *glopts[TWOLAME_MAX_STREAMS];
+    int num_streams;
+    int num_blocks;
+    multi_lanes *lanes;         // num_blocks of them
+};
 
 
 
@@ -277,12 +429,19 @@ struct twolame_options_struct {
     int do_energy_levels;       // Write energy level information into the end of the frame [FALSE]
     int num_ancillary_bits;     // Number of reserved ancillary bits [0] (Currently only available
     // for non-VBR modes)
+    int lowpass;                // Don't code subbands above this frequency in Hz [0 = no limit]
+    int fixed_point;            // Filter and quantize in fixed point, not floating point [FALSE]
 
     // Psychoacoustic Model options
-    int psymodel;               // -1, 0, 1, 2, [3], 4 Psy model number
+    int psymodel;               // -1, 0, 1, 2, [3], 4, 5 Psy model number
+    int psymodel_set;           // psymodel was chosen with twolame_set_psymodel() [FALSE]
     FLOAT athlevel;             // Adjust the Absolute Threshold of Hearing curve by [0] dB
     int quickmode;              // Only calculate psy model ever X frames [FALSE] 
     int quickcount;             // Only calculate psy model every [10] frames
+    int frame_budget;           // Time allowed to encode a frame in microseconds [0 = no limit]
+    int channel_threads;        // Analyse the two channels on separate threads [FALSE]
+    int channel_thread_cpu;     // CPU to pin the second channel's thread to [-1 = don't pin]
+    int psy_single_run;         // Only analyse one window per frame in psy models 2 and 4 [FALSE]
 
     // VBR Options
     int vbr;                    // turn on VBR mode TRUE [FALSE] 
@@ -321,14 +480,20 @@ struct twolame_options_struct {
     int upper_index;
     int bitrateindextobits[15];
     int vbr_frame_count;        // Used for debugging VBR
+    FLOAT alloc_snr[SBLIMIT][16];   // SNR of each allocation of each subband (see init_bit_allocation())
+    int alloc_smp_bits[SBLIMIT][16];    // bits taken by the samples of each allocation
+    int alloc_nbal[SBLIMIT];    // bits of the allocation field of each subband
+    alloc_step alloc_steps[SBLIMIT][16];    // quantizer of each allocation of each subband
+    const encode_kernels *kernels;  // encoding loops for the channel layout (see encode_init())
 
 
     // Used by twolame_encode_frame
     int twolame_init;
     short int buffer[2][TWOLAME_SAMPLES_PER_FRAME]; // Sample buffer
     unsigned int samples_in_buffer; // Number of samples currently in buffer
+    FLOAT history[2][HISTORY_SIZE + TWOLAME_SAMPLES_PER_FRAME];    // Analysis history (see history_stage())
+    short int fixed_history[2][HISTORY_SIZE + TWOLAME_SAMPLES_PER_FRAME];  // ...for the fixed point engine
     unsigned int psycount;
-    unsigned int num_crc_bits;  // Number of bits CRC is calculated on
 
     unsigned int bit_alloc[2][SBLIMIT];
     unsigned int scfsi[2][SBLIMIT];
@@ -340,6 +505,8 @@ struct twolame_options_struct {
 
     subband_t *subband;
     jsb_sample_t *j_sample;
+    fixed_sample_t *fixed_sample;   // subband samples of the fixed point engine
+    fixed_jsb_sample_t *fixed_j_sample;
     sb_sample_t *sb_sample;
 
 
@@ -355,13 +522,24 @@ struct twolame_options_struct {
     psycho_2_mem *p2mem;
     psycho_3_mem *p3mem;
     psycho_4_mem *p4mem;
+    psycho_5_mem *p5mem;
 
 
     // memory for subband
     subband_mem smem;
 
+    // real-time governor state
+    realtime_mem rtmem;
+
+    // second thread for the right channel (see chanthread.c)
+    chanthread *chanthread;
+
+    // ring of PCM audio from a real-time thread (see pcmring.c)
+    pcmring *ring;
+
     // Frame info
     frame_header header;
+    slotinfo slots;
     int jsbound;                // first band of joint stereo coding
     int sblimit;                // total number of sub bands
     int tablenum;
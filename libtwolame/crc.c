@@ -34,7 +34,8 @@
 
 
 
-static unsigned int crc_update(unsigned int value, unsigned int crc, unsigned int nbBit)
+/* Add the top nbBit bits of the byte value to the CRC-16 crc */
+unsigned int crc_update(unsigned int value, unsigned int crc, unsigned int nbBit)
 {
     int i;
     value <<= 8;
@@ -52,30 +53,15 @@ static unsigned int crc_update(unsigned int value, unsigned int crc, unsigned in
 
 /*
  * The CRC is based on the second two bytes of the MPEG audio header
- * and then the bits up and until the scale-factor bits.
+ * and then the bits up and until the scale-factor bits. They are
+ * added up as they are written (see buffer_crc_start()), and this
+ * just puts the result in the frame.
  */
 
-void crc_writeheader(unsigned char *bitstream, int bit_count)
+void crc_writeheader(unsigned char *bitstream, unsigned int crc)
 {
-    unsigned int crc = 0xffff;  /* (jo) init crc16 for error_protection */
-    int whole_bytes = (bit_count >> 3);
-    int byte;
-
-    // Calculate the CRC on the second two bytes of the header
-    crc = crc_update(bitstream[2], crc, 8);
-    crc = crc_update(bitstream[3], crc, 8);
-
-    // Calculate CRC on whole bytes after CRC
-    for (byte = 6; byte < (whole_bytes + 6); byte++) {
-        crc = crc_update(bitstream[byte], crc, 8);
-    }
-
-    // Calculate CRC on remaining bits
-    if (bit_count & 7) {
-        crc = crc_update(bitstream[byte], crc, bit_count & 7);
-    }
     // Insert the CRC into the 16-bits after the header
-    bitstream[4] = crc >> 8;
+    bitstream[4] = (crc >> 8) & 0xFF;
     bitstream[5] = crc & 0xFF;
 }
 
@@ -25,7 +25,8 @@
 #ifndef TWOLAME_CRC_H
 #define TWOLAME_CRC_H
 
-void crc_writeheader(unsigned char *bitstream, int bit_count);
+unsigned int crc_update(unsigned int value, unsigned int crc, unsigned int nbBit);
+void crc_writeheader(unsigned char *bitstream, unsigned int crc);
 
 #endif
 
@@ -31,45 +31,32 @@
 #include "dab.h"
 
 
-void
-dab_crc_calc(twolame_options * glopts,
-             unsigned int bit_alloc[2][SBLIMIT],
-             unsigned int scfsi[2][SBLIMIT],
-             unsigned int scalar[2][3][SBLIMIT], unsigned int *crc, int packed)
+/*
+  The DAB CRCs are of the top 3 bits of the scalefactors in each region
+  of subbands (0-3, 4-7, 8-15 and 16-29), in the order they are written
+  into the frame. write_scalefactors() adds each one to the CRC of its
+  region as it goes, after dab_crc_clear().
+*/
+
+void dab_crc_clear(twolame_options * glopts)
+{
+    unsigned int i;
+
+    for (i = 0; i < glopts->dab_crc_len; i++)
+        glopts->dab_crc[i] = 0;
+}
+
+/* The CRC for the scalefactors of subband sb, or NULL if there isn't one */
+unsigned int *dab_crc_region(twolame_options * glopts, int sb)
 {
-    int i, j, k;
-    int nch = glopts->num_channels_out;
-    int nb_scalar;
-    int f[5] = { 0, 4, 8, 16, 30 };
-    int first, last;
-
-    first = f[packed];
-    last = f[packed + 1];
-    if (last > glopts->sblimit)
-        last = glopts->sblimit;
-
-    nb_scalar = 0;
-    *crc = 0x0;
-    for (i = first; i < last; i++)
-        for (k = 0; k < nch; k++)
-            if (bit_alloc[k][i])    /* above jsbound, bit_alloc[0][i] == ba[1][i] */
-                switch (scfsi[k][i]) {
-                case 0:
-                    for (j = 0; j < 3; j++) {
-                        nb_scalar++;
-                        dab_crc_update(scalar[k][j][i] >> 3, 3, crc);
-                    }
-                    break;
-                case 1:
-                case 3:
-                    nb_scalar += 2;
-                    dab_crc_update(scalar[k][0][i] >> 3, 3, crc);
-                    dab_crc_update(scalar[k][2][i] >> 3, 3, crc);
-                    break;
-                case 2:
-                    nb_scalar++;
-                    dab_crc_update(scalar[k][0][i] >> 3, 3, crc);
-                }
+    static const int region[SBLIMIT] = {
+        0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2,
+        3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, -1, -1
+    };
+
+    if (!glopts->do_dab || region[sb] < 0 || (unsigned int) region[sb] >= glopts->dab_crc_len)
+        return NULL;
+    return &glopts->dab_crc[region[sb]];
 }
 
 void dab_crc_update(unsigned int data, unsigned int length, unsigned int *crc)
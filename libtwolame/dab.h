@@ -26,10 +26,8 @@
 #ifndef TWOLAME_DAB_H
 #define TWOLAME_DAB_H
 
-void dab_crc_calc(twolame_options * glopts,
-                  unsigned int bit_alloc[2][SBLIMIT],
-                  unsigned int scfsi[2][SBLIMIT],
-                  unsigned int scalar[2][3][SBLIMIT], unsigned int *crc, int i);
+void dab_crc_clear(twolame_options * glopts);
+unsigned int *dab_crc_region(twolame_options * glopts, int sb);
 
 void dab_crc_update(unsigned int, unsigned int, unsigned int *);
 
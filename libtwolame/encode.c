@@ -32,6 +32,7 @@
 #include "bitbuffer.h"
 #include "availbits.h"
 #include "encode.h"
+#include "dab.h"
 
 #include "bitbuffer_inline.h"
 
@@ -151,6 +152,18 @@ static const FLOAT scalefactor[64] = {  /* Equation for nth element = 2 / (cuber
     1E-20
 };
 
+/* scalefactor[] in Q28, for the fixed point engine */
+static const int fixed_scalefactor[64] = {
+    536870912, 426114725, 338207482, 268435456, 213057363, 169103741, 134217728, 106528681,
+    84551870, 67108864, 53264341, 42275935, 33554432, 26632170, 21137968, 16777216,
+    13316085, 10568984, 8388608, 6658043, 5284492, 4194304, 3329021, 2642246,
+    2097152, 1664511, 1321123, 1048576, 832255, 660561, 524288, 416128,
+    330281, 262144, 208064, 165140, 131072, 104032, 82570, 65536,
+    52016, 41285, 32768, 26008, 20643, 16384, 13004, 10321,
+    8192, 6502, 5161, 4096, 3251, 2580, 2048, 1625,
+    1290, 1024, 813, 645, 512, 406, 323, 0
+};
+
 /* ISO11172 Table C.5 Layer II Signal to Noise Raios 
    MFC FIX find a reference for these in terms of bits->SNR value
    Index into table is the steps index 
@@ -181,6 +194,24 @@ static int get_js_bound(int m_ext)
 }
 
 
+/* The number of bits taken by the bit allocation fields. These are
+   there for every subband up to the sblimit of the allocation table,
+   whether or not the lowpass means they are coded. */
+static int alloc_bits(twolame_options * glopts, int jsbound)
+{
+    int nch = glopts->num_channels_out;
+    int sblimit = table_sblimit[glopts->tablenum];
+    int bbal = 0;
+    int sb;
+
+    for (sb = 0; sb < jsbound; sb++)
+        bbal += nch * nbal[line[glopts->tablenum][sb]]; // (*alloc)[sb][0].bits;
+    for (sb = jsbound; sb < sblimit; sb++)
+        bbal += nbal[line[glopts->tablenum][sb]];   // (*alloc)[sb][0].bits;
+    return bbal;
+}
+
+
 int encode_init(twolame_options * glopts)
 {
     frame_header *header = &glopts->header;
@@ -210,10 +241,21 @@ int encode_init(twolame_options * glopts)
     // fprintf(stderr,"encode_init: using tablenum %i with sblimit %i\n",glopts->tablenum,
     // glopts->sblimit);
 
+    /* Each subband is samplerate/64 Hz wide, so the lowpass can leave fewer to code. Every
+       stage from the filterbank on stops at glopts->sblimit, and just the bit allocation
+       fields are still written up to the table's sblimit (see alloc_bits()) */
+    if (glopts->lowpass > 0) {
+        int sblimit = (int) ceil(glopts->lowpass * 64.0 / glopts->samplerate_out);
+        if (sblimit < 1)
+            sblimit = 1;
+        if (sblimit < glopts->sblimit)
+            glopts->sblimit = sblimit;
+    }
+
     if (glopts->mode == TWOLAME_JOINT_STEREO)
         glopts->jsbound = get_js_bound(header->mode_ext);
     else
-        glopts->jsbound = glopts->sblimit;
+        glopts->jsbound = table_sblimit[glopts->tablenum];
     /* alloc, tab_num set in pick_table */
 
 
@@ -256,12 +298,11 @@ int encode_init(twolame_options * glopts)
 /* 
    scale_factor_calc
    pick_scale
-   if JOINTSTEREO 
-		 combine_LR
-		 scale_factor_calc
    use psy model to determine SMR
    transmission pattern
    main_bit_allocation
+   if JOINTSTEREO 
+		 combine_LR and scale_factor_calc above jsbound
    if (error protection)
 		 calc CRC
    encode_info
@@ -273,6 +314,24 @@ int encode_init(twolame_options * glopts)
    sample_encoding
 */
 
+/* The index of the smallest scalefactor which is at least cur_max */
+static inline unsigned int scalefactor_index(FLOAT cur_max)
+{
+    unsigned int l, scale_fac;
+
+    /* PDS: binary search in the scalefactor table: */
+    /* This is the real speed up: */
+    for (l = 16, scale_fac = 32; l; l >>= 1) {
+        if (cur_max <= scalefactor[scale_fac])
+            scale_fac += l;
+        else
+            scale_fac -= l;
+    }
+    if (cur_max > scalefactor[scale_fac])
+        scale_fac--;
+    return scale_fac;
+}
+
 void scalefactor_calc(FLOAT sb_sample[][3][SCALE_BLOCK][SBLIMIT],
                       unsigned int sf_index[][3][SBLIMIT], int nch, int sblimit)
 {
@@ -288,9 +347,7 @@ void scalefactor_calc(FLOAT sb_sample[][3][SCALE_BLOCK][SBLIMIT],
             int sb;
             for (sb = sblimit; sb--;) {
                 int j;
-                unsigned int l;
                 register FLOAT temp;
-                unsigned int scale_fac;
                 /* Determination of max. over each set of 12 subband samples: */
                 /* PDS TODO: maybe this could/should ??!! be integrated into */
                 /* the subband filtering routines? */
@@ -299,17 +356,7 @@ void scalefactor_calc(FLOAT sb_sample[][3][SCALE_BLOCK][SBLIMIT],
                     if ((temp = fabs(sb_sample[ch][gr][j][sb])) > cur_max)
                         cur_max = temp;
                 }
-                /* PDS: binary search in the scalefactor table: */
-                /* This is the real speed up: */
-                for (l = 16, scale_fac = 32; l; l >>= 1) {
-                    if (cur_max <= scalefactor[scale_fac])
-                        scale_fac += l;
-                    else
-                        scale_fac -= l;
-                }
-                if (cur_max > scalefactor[scale_fac])
-                    scale_fac--;
-                sf_index[ch][gr][sb] = scale_fac;
+                sf_index[ch][gr][sb] = scalefactor_index(cur_max);
                 /* There is a direct way of working out the index, if the maximum value is known
                    but since it involves a log it isn't really speedy. Items in the scalefactor[]
                    table are calculated by: the n'th entry = 2 / (cuberoot(2) ^ n) And so using a
@@ -321,17 +368,109 @@ void scalefactor_calc(FLOAT sb_sample[][3][SCALE_BLOCK][SBLIMIT],
 }
 
 
-/* Combine L&R channels into a mono joint stereo channel */
+/* scalefactor_index() for the fixed point engine */
+static inline unsigned int fixed_scalefactor_index(int cur_max)
+{
+    unsigned int l, scale_fac;
+
+    for (l = 16, scale_fac = 32; l; l >>= 1) {
+        if (cur_max <= fixed_scalefactor[scale_fac])
+            scale_fac += l;
+        else
+            scale_fac -= l;
+    }
+    if (cur_max > fixed_scalefactor[scale_fac])
+        scale_fac--;
+    return scale_fac;
+}
+
+/* scalefactor_calc() for the fixed point engine */
+void scalefactor_calc_fixed(int sb_sample[][3][SCALE_BLOCK][SBLIMIT],
+                            unsigned int sf_index[][3][SBLIMIT], int nch, int sblimit)
+{
+    int ch, gr, sb, j;
+
+    for (ch = 0; ch < nch; ch++)
+        for (gr = 0; gr < 3; gr++) {
+            int cur_max[SBLIMIT];
+
+            for (sb = 0; sb < sblimit; sb++)
+                cur_max[sb] = 0;
+            for (j = 0; j < SCALE_BLOCK; j++)
+                for (sb = 0; sb < sblimit; sb++) {
+                    int x = sb_sample[ch][gr][j][sb];
+                    int ax = (x < 0) ? -x : x;
+                    cur_max[sb] = (ax > cur_max[sb]) ? ax : cur_max[sb];
+                }
+            for (sb = 0; sb < sblimit; sb++)
+                sf_index[ch][gr][sb] = fixed_scalefactor_index(cur_max[sb]);
+        }
+}
+
+
+/* Combine L&R channels into a mono joint stereo channel for the subbands from
+   jsbound up to sblimit (the only ones coded in mono), and work out the
+   scalefactors of the mono samples in the same pass */
 void combine_lr(FLOAT sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
-                FLOAT joint_sample[3][SCALE_BLOCK][SBLIMIT], int sblimit)
+                FLOAT joint_sample[3][SCALE_BLOCK][SBLIMIT],
+                unsigned int j_scale[3][SBLIMIT], int jsbound, int sblimit)
+{
+    int sb, sample, gr;
+
+    for (gr = 0; gr < 3; ++gr) {
+        FLOAT cur_max[SBLIMIT];
+
+        for (sb = jsbound; sb < sblimit; ++sb)
+            cur_max[sb] = 0.0;
+
+        /* Along the subbands, so that the compiler can vectorise it */
+        for (sample = 0; sample < SCALE_BLOCK; ++sample) {
+            const FLOAT *left = sb_sample[0][gr][sample];
+            const FLOAT *right = sb_sample[1][gr][sample];
+            FLOAT *joint = joint_sample[gr][sample];
+
+            for (sb = jsbound; sb < sblimit; ++sb) {
+                FLOAT x = .5 * (left[sb] + right[sb]);
+                FLOAT ax = fabs(x);
+                joint[sb] = x;
+                cur_max[sb] = (ax > cur_max[sb]) ? ax : cur_max[sb];
+            }
+        }
+
+        for (sb = jsbound; sb < sblimit; ++sb)
+            j_scale[gr][sb] = scalefactor_index(cur_max[sb]);
+    }
+}
+
+/* combine_lr() for the fixed point engine */
+void combine_lr_fixed(int sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
+                      int joint_sample[3][SCALE_BLOCK][SBLIMIT],
+                      unsigned int j_scale[3][SBLIMIT], int jsbound, int sblimit)
 {
     int sb, sample, gr;
 
-    for (sb = 0; sb < sblimit; ++sb)
-        for (sample = 0; sample < SCALE_BLOCK; ++sample)
-            for (gr = 0; gr < 3; ++gr)
-                joint_sample[gr][sample][sb] =
-                    .5 * (sb_sample[0][gr][sample][sb] + sb_sample[1][gr][sample][sb]);
+    for (gr = 0; gr < 3; ++gr) {
+        int cur_max[SBLIMIT];
+
+        for (sb = jsbound; sb < sblimit; ++sb)
+            cur_max[sb] = 0;
+
+        for (sample = 0; sample < SCALE_BLOCK; ++sample) {
+            const int *left = sb_sample[0][gr][sample];
+            const int *right = sb_sample[1][gr][sample];
+            int *joint = joint_sample[gr][sample];
+
+            for (sb = jsbound; sb < sblimit; ++sb) {
+                int x = (left[sb] + right[sb]) >> 1;
+                int ax = (x < 0) ? -x : x;
+                joint[sb] = x;
+                cur_max[sb] = (ax > cur_max[sb]) ? ax : cur_max[sb];
+            }
+        }
+
+        for (sb = jsbound; sb < sblimit; ++sb)
+            j_scale[gr][sb] = fixed_scalefactor_index(cur_max[sb]);
+    }
 }
 
 /* PURPOSE:For each subband, puts the smallest scalefactor of the 3
@@ -349,22 +488,32 @@ void combine_lr(FLOAT sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
 void find_sf_max(twolame_options * glopts,
                  unsigned int sf_index[2][3][SBLIMIT], FLOAT sf_max[2][SBLIMIT])
 {
-    unsigned int sb, gr, ch;
-    unsigned int lowest_sf_index;
+    unsigned int sb, ch;
     unsigned int nch = glopts->num_channels_out;
     unsigned int sblimit = glopts->sblimit;
 
     for (ch = 0; ch < nch; ch++)
-        for (sb = 0; sb < sblimit; sb++) {
-            for (gr = 1, lowest_sf_index = sf_index[ch][0][sb]; gr < 3; gr++)
-                if (lowest_sf_index > sf_index[ch][gr][sb])
-                    lowest_sf_index = sf_index[ch][gr][sb];
-            sf_max[ch][sb] = multiple[lowest_sf_index];
-        }
+        find_sf_max_channel(glopts, sf_index[ch], sf_max[ch]);
     for (sb = sblimit; sb < SBLIMIT; sb++)
         sf_max[0][sb] = sf_max[1][sb] = 1E-20;
 }
 
+/* find_sf_max() for the subbands below sblimit of a single channel */
+void find_sf_max_channel(twolame_options * glopts,
+                         unsigned int sf_index[3][SBLIMIT], FLOAT sf_max[SBLIMIT])
+{
+    unsigned int sb, gr;
+    unsigned int lowest_sf_index;
+    unsigned int sblimit = glopts->sblimit;
+
+    for (sb = 0; sb < sblimit; sb++) {
+        for (gr = 1, lowest_sf_index = sf_index[0][sb]; gr < 3; gr++)
+            if (lowest_sf_index > sf_index[gr][sb])
+                lowest_sf_index = sf_index[gr][sb];
+        sf_max[sb] = multiple[lowest_sf_index];
+    }
+}
+
 /*	sf_transmission_pattern	 
 	PURPOSE:For a given subband, determines whether to send 1, 2, or
 	all 3 of the scalefactors, and fills in the scalefactor
@@ -452,6 +601,10 @@ void write_header(twolame_options * glopts, bit_stream * bs)
     buffer_put1bit(bs, header->version);    /* ID 1 bit */
     buffer_putbits(bs, 4 - header->lay, 2); /* layer 2 bits */
     buffer_put1bit(bs, !header->error_protection);  /* bit set => no err prot */
+
+    /* The CRC starts with the second two bytes of the header */
+    if (header->error_protection)
+        buffer_crc_start(bs);
     buffer_putbits(bs, header->bitrate_index, 4);
     buffer_putbits(bs, header->samplerate_idx, 2);
     buffer_put1bit(bs, header->padding);
@@ -461,8 +614,39 @@ void write_header(twolame_options * glopts, bit_stream * bs)
     buffer_put1bit(bs, header->copyright);
     buffer_put1bit(bs, header->original);
     buffer_putbits(bs, header->emphasis, 2);
+    buffer_crc_pause(bs);
+}
+
+/*
+  The loops which encode each frame are written once for any channel
+  layout: nch channels with their own samples up to a bound, and (in
+  joint stereo) one set of samples for both above it. The kernels at
+  the end of this section are a copy of each loop for mono, stereo
+  (and dual channel) and joint stereo, with nch and the bound fixed so
+  that the compiler can drop the checks on them. init_bit_allocation()
+  chooses the kernels for the frames, and flattens the allocation
+  table into glopts->alloc_nbal and glopts->alloc_steps, so the loops
+  don't go through line[], step_index[] and the rest for every sample.
+*/
+
+/* The loops have to be inlined into each kernel for nch and the bound to be fixed */
+#if defined(__GNUC__)
+#define KERNEL_INLINE static inline __attribute__ ((always_inline))
+#elif defined(_MSC_VER)
+#define KERNEL_INLINE static __forceinline
+#else
+#define KERNEL_INLINE static inline
+#endif
+
+/* The subband up to which each channel has its own samples */
+static inline int layout_bound(twolame_options * glopts, int joint, int sblimit)
+{
+    if (joint && glopts->jsbound < sblimit)
+        return glopts->jsbound;
+    return sblimit;
 }
 
+
 /*************************************************************************
  encode_bit_alloc (Layer II)
 
@@ -471,24 +655,19 @@ void write_header(twolame_options * glopts, bit_stream * bs)
  4,3,2, or 0 bits depending on the quantization table used.
 
 ************************************************************************/
-void write_bit_alloc(twolame_options * glopts, unsigned int bit_alloc[2][SBLIMIT], bit_stream * bs)
+KERNEL_INLINE void write_bit_alloc_layout(twolame_options * glopts,
+                                          unsigned int bit_alloc[2][SBLIMIT], bit_stream * bs,
+                                          const int nch, const int joint)
 {
-    int nch = glopts->num_channels_out;
-    int sblimit = glopts->sblimit;
-    int jsbound = glopts->jsbound;
+    int sblimit = table_sblimit[glopts->tablenum]; // not glopts->sblimit, see alloc_bits()
+    int jsbound = layout_bound(glopts, joint, sblimit);
     int sb, ch;
 
-    for (sb = 0; sb < sblimit; sb++) {
-        if (sb < jsbound) {
-            for (ch = 0; ch < ((sb < jsbound) ? nch : 1); ch++) {
-                buffer_putbits(bs, bit_alloc[ch][sb], nbal[line[glopts->tablenum][sb]]);
-                glopts->num_crc_bits += nbal[line[glopts->tablenum][sb]];
-            }
-        } else {
-            buffer_putbits(bs, bit_alloc[0][sb], nbal[line[glopts->tablenum][sb]]);
-            glopts->num_crc_bits += nbal[line[glopts->tablenum][sb]];
-        }
-    }
+    for (sb = 0; sb < jsbound; sb++)
+        for (ch = 0; ch < nch; ch++)
+            buffer_putbits(bs, bit_alloc[ch][sb], glopts->alloc_nbal[sb]);
+    for (; sb < sblimit; sb++)
+        buffer_putbits(bs, bit_alloc[0][sb], glopts->alloc_nbal[sb]);
 }
 
 /************************************************************************
@@ -503,43 +682,57 @@ void write_bit_alloc(twolame_options * glopts, unsigned int bit_alloc[2][SBLIMIT
 
 ************************************************************************/
 
-void write_scalefactors(twolame_options * glopts,
-                        unsigned int bit_alloc[2][SBLIMIT],
-                        unsigned int sf_selectinfo[2][SBLIMIT],
-                        unsigned int sf_index[2][3][SBLIMIT], bit_stream * bs)
+/* Write one scalefactor, and add it to the DAB CRC of its subband if there is one */
+static inline void write_scalefactor(bit_stream * bs, unsigned int sf, unsigned int *dab_crc)
+{
+    buffer_putbits(bs, sf, 6);
+    if (dab_crc)
+        dab_crc_update(sf >> 3, 3, dab_crc);
+}
+
+KERNEL_INLINE void write_scalefactors_layout(twolame_options * glopts,
+                                             unsigned int bit_alloc[2][SBLIMIT],
+                                             unsigned int sf_selectinfo[2][SBLIMIT],
+                                             unsigned int sf_index[2][3][SBLIMIT], bit_stream * bs,
+                                             const int nch)
 {
-    int nch = glopts->num_channels_out;
     int sblimit = glopts->sblimit;
     int sb, gr, ch;
 
     /* Write out the scalefactor selection information */
     for (sb = 0; sb < sblimit; sb++)
         for (ch = 0; ch < nch; ch++)
-            if (bit_alloc[ch][sb]) {
+            if (bit_alloc[ch][sb])
                 buffer_putbits(bs, sf_selectinfo[ch][sb], 2);
-                glopts->num_crc_bits += 2;
-            }
 
-    /* Write out the scalefactors */
-    for (sb = 0; sb < sblimit; sb++)
+    /* That's the end of the bits protected by the CRC */
+    buffer_crc_pause(bs);
+
+    /* Write out the scalefactors, and work out the DAB CRCs of them as they go */
+    if (glopts->do_dab)
+        dab_crc_clear(glopts);
+    for (sb = 0; sb < sblimit; sb++) {
+        unsigned int *dab_crc = dab_crc_region(glopts, sb);
+
         for (ch = 0; ch < nch; ch++)
             if (bit_alloc[ch][sb])  // above jsbound, bit_alloc[0][i] == ba[1][i] 
             {
                 switch (sf_selectinfo[ch][sb]) {
                 case 0:
                     for (gr = 0; gr < 3; gr++)
-                        buffer_putbits(bs, sf_index[ch][gr][sb], 6);
+                        write_scalefactor(bs, sf_index[ch][gr][sb], dab_crc);
                     break;
                 case 1:
                 case 3:
-                    buffer_putbits(bs, sf_index[ch][0][sb], 6);
-                    buffer_putbits(bs, sf_index[ch][2][sb], 6);
+                    write_scalefactor(bs, sf_index[ch][0][sb], dab_crc);
+                    write_scalefactor(bs, sf_index[ch][2][sb], dab_crc);
                     break;
                 case 2:
-                    buffer_putbits(bs, sf_index[ch][0][sb], 6);
+                    write_scalefactor(bs, sf_index[ch][0][sb], dab_crc);
                     break;
                 }
             }
+    }
 }
 
 
@@ -575,65 +768,108 @@ static const FLOAT b[18] = {
  negative number x is equivalent to adding 1 to it.
 
 ************************************************************************/
-void
-subband_quantization(twolame_options * glopts,
-                     unsigned int sf_index[2][3][SBLIMIT],
-                     FLOAT sb_samples[2][3][SCALE_BLOCK][SBLIMIT],
-                     unsigned int j_scale[3][SBLIMIT],
-                     FLOAT j_samps[3][SCALE_BLOCK][SBLIMIT],
-                     unsigned int bit_alloc[2][SBLIMIT],
-                     unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT])
+
+/* Quantize the scaled sample d with the quantizer step */
+static inline unsigned int quantize_sample(FLOAT d, const alloc_step * step)
+{
+    d = d * step->a + step->b;
+
+    /* extract MSB N-1 bits from the FLOATing point sample, and tag the inverted sign bit to
+       it at position N. The bit inversion is a must for grouping with 3,5,9 steps so it is
+       done for all subbands */
+    if (d >= 0)
+        return (unsigned int) (d * (FLOAT) step->steps2n) | step->steps2n;
+    d += 1.0;
+    return (unsigned int) (d * (FLOAT) step->steps2n);
+}
+
+KERNEL_INLINE void subband_quantization_layout(twolame_options * glopts,
+                                               unsigned int sf_index[2][3][SBLIMIT],
+                                               FLOAT sb_samples[2][3][SCALE_BLOCK][SBLIMIT],
+                                               unsigned int j_scale[3][SBLIMIT],
+                                               FLOAT j_samps[3][SCALE_BLOCK][SBLIMIT],
+                                               unsigned int bit_alloc[2][SBLIMIT],
+                                               unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
+                                               const int nch, const int joint)
 {
-    int sb, j, ch, gr, qnt_coeff_index, sig;
-    int nch = glopts->num_channels_out;
     int sblimit = glopts->sblimit;
-    int jsbound = glopts->jsbound;
-    FLOAT d;
+    int jsbound = layout_bound(glopts, joint, sblimit);
+    int sb, j, ch, gr;
 
     for (gr = 0; gr < 3; gr++)
-        for (j = 0; j < SCALE_BLOCK; j++)
-            for (sb = 0; sb < sblimit; sb++)
-                for (ch = 0; ch < ((sb < jsbound) ? nch : 1); ch++)
-
-                    if (bit_alloc[ch][sb]) {
-                        /* scale and quantize FLOATing point sample */
-                        if (nch == 2 && sb >= jsbound)  /* use j-stereo samples */
-                            d = j_samps[gr][j][sb] / scalefactor[j_scale[gr][sb]];
-                        else
-                            d = sb_samples[ch][gr][j][sb] / scalefactor[sf_index[ch][gr][sb]];
-
-                        /* Check that the wrong scale factor hasn't been chosen - which would
-                           result in a scaled sample being > 1.0 This error shouldn't ever happen
-                           *unless* something went wrong in scalefactor calc
-
-                           if (mod (d) > 1.0) fprintf (stderr, "Not scaled properly %d %d %d %d\n", 
-                           ch, gr, j, sb); */
-
-                        {
-                            /* 'index' indicates which "step line" we are using */
-                            int index = line[glopts->tablenum][sb];
-
-                            /* Find the "step index" within that line */
-                            qnt_coeff_index = step_index[index][bit_alloc[ch][sb]];
-                        }
-                        d = d * a[qnt_coeff_index] + b[qnt_coeff_index];
-
-                        /* extract MSB N-1 bits from the FLOATing point sample */
-                        if (d >= 0)
-                            sig = 1;
-                        else {
-                            sig = 0;
-                            d += 1.0;
-                        }
+        for (j = 0; j < SCALE_BLOCK; j++) {
+            for (sb = 0; sb < jsbound; sb++)
+                for (ch = 0; ch < nch; ch++)
+                    if (bit_alloc[ch][sb])
+                        sbband[ch][gr][j][sb] =
+                            quantize_sample(sb_samples[ch][gr][j][sb] /
+                                            scalefactor[sf_index[ch][gr][sb]],
+                                            &glopts->alloc_steps[sb][bit_alloc[ch][sb]]);
+
+            /* use j-stereo samples */
+            for (; sb < sblimit; sb++)
+                if (bit_alloc[0][sb])
+                    sbband[0][gr][j][sb] =
+                        quantize_sample(j_samps[gr][j][sb] / scalefactor[j_scale[gr][sb]],
+                                        &glopts->alloc_steps[sb][bit_alloc[0][sb]]);
+        }
+
+    /* Set everything above the sblimit to 0 */
+    for (ch = 0; ch < nch; ch++)
+        for (gr = 0; gr < 3; gr++)
+            for (sb = 0; sb < SCALE_BLOCK; sb++)
+                for (j = sblimit; j < SBLIMIT; j++)
+                    sbband[ch][gr][sb][j] = 0;
+}
+
+/* The Q28 sample x divided by scalefactor sf (2 / cuberoot(2)^sf), in Q30 */
+static inline int fixed_scale(int x, unsigned int sf)
+{
+    static const int cuberoot2[3] = { 1073741824, 1352829926, 1704458901 };   /* Q30 */
+
+    return (int) (((FIXED_ACC) x * cuberoot2[sf % 3]) >> (FIXED_BITS + 1 - sf / 3));
+}
+
+/* quantize_sample() for the fixed point engine, with d in Q30 */
+static inline unsigned int quantize_sample_fixed(int d, const alloc_step * step)
+{
+    FIXED_ACC q = (((FIXED_ACC) d * step->fixed_a) >> 30) + step->fixed_b;
 
+    if (q >= 0)
+        return (unsigned int) ((q * step->steps2n) >> 30) | step->steps2n;
+    return (unsigned int) (((q + (1 << 30)) * step->steps2n) >> 30);
+}
+
+KERNEL_INLINE void subband_quantization_fixed_layout(twolame_options * glopts,
+                                                     unsigned int sf_index[2][3][SBLIMIT],
+                                                     int sb_samples[2][3][SCALE_BLOCK][SBLIMIT],
+                                                     unsigned int j_scale[3][SBLIMIT],
+                                                     int j_samps[3][SCALE_BLOCK][SBLIMIT],
+                                                     unsigned int bit_alloc[2][SBLIMIT],
+                                                     unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
+                                                     const int nch, const int joint)
+{
+    int sblimit = glopts->sblimit;
+    int jsbound = layout_bound(glopts, joint, sblimit);
+    int sb, j, ch, gr;
+
+    for (gr = 0; gr < 3; gr++)
+        for (j = 0; j < SCALE_BLOCK; j++) {
+            for (sb = 0; sb < jsbound; sb++)
+                for (ch = 0; ch < nch; ch++)
+                    if (bit_alloc[ch][sb])
                         sbband[ch][gr][j][sb] =
-                            (unsigned int) (d * (FLOAT) steps2n[qnt_coeff_index]);
-                        /* tag the inverted sign bit to sbband at position N */
-                        /* The bit inversion is a must for grouping with 3,5,9 steps so it is done
-                           for all subbands */
-                        if (sig)
-                            sbband[ch][gr][j][sb] |= steps2n[qnt_coeff_index];
-                    }
+                            quantize_sample_fixed(fixed_scale(sb_samples[ch][gr][j][sb],
+                                                              sf_index[ch][gr][sb]),
+                                                  &glopts->alloc_steps[sb][bit_alloc[ch][sb]]);
+
+            /* use j-stereo samples */
+            for (; sb < sblimit; sb++)
+                if (bit_alloc[0][sb])
+                    sbband[0][gr][j][sb] =
+                        quantize_sample_fixed(fixed_scale(j_samps[gr][j][sb], j_scale[gr][sb]),
+                                              &glopts->alloc_steps[sb][bit_alloc[0][sb]]);
+        }
 
     /* Set everything above the sblimit to 0 */
     for (ch = 0; ch < nch; ch++)
@@ -654,44 +890,63 @@ subband_quantization(twolame_options * glopts,
  that are not a power of 2.
 
 ***********************************************************************/
-void write_samples(twolame_options * glopts,
-                   unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
-                   unsigned int bit_alloc[2][SBLIMIT], bit_stream * bs)
+
+/*
+  The samples are written in two passes. The first works out the
+  codewords of every subband triplet of the frame, and their lengths,
+  with no branches. The second packs them into the bit stream with
+  buffer_putcodes(), which stores a byte at a time rather than a few
+  bits at a time.
+*/
+
+/* The most codes in a frame: three for each channel of each subband of each triplet */
+#define TRIPLET_CODES (3 * (SCALE_BLOCK / 3) * 2 * SBLIMIT * 3)
+
+/* Work out the codewords for the three consecutive samples x, y and z of one subband with
+   the quantizer step. An allocation of 0 gives three codes of no bits */
+static inline void group_triplet(unsigned int *code, unsigned char *length,
+                                 const alloc_step * step,
+                                 unsigned int x, unsigned int y, unsigned int z)
 {
-    unsigned int nch = glopts->num_channels_out;
-    unsigned int sblimit = glopts->sblimit;
-    unsigned int jsbound = glopts->jsbound;
-    unsigned int sb, j, ch, gr, x, y;
-    unsigned int temp;
+    unsigned int steps = step->steps;
+    int single = (step->group == 3);    // 1 sample per codeword -> 3 codewords
+
+    /* ISO11172 Sec C.1.5.2.8 If steps=3, 5 or 9, then three consecutive samples are coded as
+       one codeword i.e. only one value (V) is transmitted for this triplet. If the 3 subband
+       samples are x,y,z then V = (steps*steps)*z + steps*y +x */
+    code[0] = single ? x : x + y * steps + z * steps * steps;
+    code[1] = y;
+    code[2] = z;
+    length[0] = step->bits;
+    length[1] = length[2] = single * step->bits;
+}
+
+KERNEL_INLINE void write_samples_layout(twolame_options * glopts,
+                                        unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
+                                        unsigned int bit_alloc[2][SBLIMIT], bit_stream * bs,
+                                        const int nch, const int joint)
+{
+    int sblimit = glopts->sblimit;
+    int jsbound = layout_bound(glopts, joint, sblimit);
+    unsigned int code[TRIPLET_CODES];
+    unsigned char length[TRIPLET_CODES];
+    int sb, j, ch, gr, n = 0;
 
     for (gr = 0; gr < 3; gr++)
-        for (j = 0; j < SCALE_BLOCK; j += 3)
-            for (sb = 0; sb < sblimit; sb++)
-                for (ch = 0; ch < ((sb < jsbound) ? nch : 1); ch++) {
-                    if (bit_alloc[ch][sb]) {
-                        int thisline = line[glopts->tablenum][sb];
-                        int thisstep_index = step_index[thisline][bit_alloc[ch][sb]];
-
-                        /* Check how many samples per codeword */
-                        if (group[thisstep_index] == 3) {
-                            /* Going to send 1 sample per codeword -> 3 samples */
-                            for (x = 0; x < 3; x++) {
-                                buffer_putbits(bs, sbband[ch][gr][j + x][sb], bits[thisstep_index]);
-                            }
-
-                        } else {
-                            /* ISO11172 Sec C.1.5.2.8 If steps=3, 5 or 9, then three consecutive
-                               samples are coded as one codeword i.e. only one value (V) is
-                               transmitted for this triplet. If the 3 subband samples are x,y,z
-                               then V = (steps*steps)*z + steps*y +x */
-                            y = steps[thisstep_index];
-                            temp =
-                                sbband[ch][gr][j][sb] + sbband[ch][gr][j + 1][sb] * y +
-                                sbband[ch][gr][j + 2][sb] * y * y;
-                            buffer_putbits(bs, temp, bits[thisstep_index]);
-                        }
-                    }
-                }
+        for (j = 0; j < SCALE_BLOCK; j += 3) {
+            for (sb = 0; sb < jsbound; sb++)
+                for (ch = 0; ch < nch; ch++, n += 3)
+                    group_triplet(&code[n], &length[n],
+                                  &glopts->alloc_steps[sb][bit_alloc[ch][sb]],
+                                  sbband[ch][gr][j][sb], sbband[ch][gr][j + 1][sb],
+                                  sbband[ch][gr][j + 2][sb]);
+            for (; sb < sblimit; sb++, n += 3)
+                group_triplet(&code[n], &length[n], &glopts->alloc_steps[sb][bit_alloc[0][sb]],
+                              sbband[0][gr][j][sb], sbband[0][gr][j + 1][sb],
+                              sbband[0][gr][j + 2][sb]);
+        }
+
+    buffer_putcodes(bs, code, length, n);
 }
 
 
@@ -723,18 +978,34 @@ void write_samples(twolame_options * glopts,
 *
 ************************************************************************/
 
-int bits_for_nonoise(twolame_options * glopts,
-                     FLOAT SMR[2][SBLIMIT],
-                     unsigned int scfsi[2][SBLIMIT], FLOAT min_mnr,
-                     unsigned int bit_alloc[2][SBLIMIT])
+/* The lowest allocation of subband sb with an MNR of at least min_mnr. The SNRs
+   of the allocations go up with the allocation (and the ones it mustn't choose
+   are huge), so this is a binary search of the 16 entries, in 4 steps which
+   don't branch */
+static inline int nonoise_alloc(twolame_options * glopts, int sb, FLOAT smr, FLOAT min_mnr)
+{
+    const FLOAT *snr = glopts->alloc_snr[sb];
+    int ba = 0;
+
+    ba += 8 & -(snr[ba + 7] - smr < min_mnr);
+    ba += 4 & -(snr[ba + 3] - smr < min_mnr);
+    ba += 2 & -(snr[ba + 1] - smr < min_mnr);
+    ba += 1 & -(snr[ba] - smr < min_mnr);
+    return ba;
+}
+
+KERNEL_INLINE int bits_for_nonoise_layout(twolame_options * glopts,
+                                          FLOAT SMR[2][SBLIMIT],
+                                          unsigned int scfsi[2][SBLIMIT], FLOAT min_mnr,
+                                          unsigned int bit_alloc[2][SBLIMIT],
+                                          const int nch, const int joint)
 {
     frame_header *header = &glopts->header;
     int sb, ch, ba;
-    int nch = glopts->num_channels_out;
     int sblimit = glopts->sblimit;
-    int jsbound = glopts->jsbound;
+    int jsbound = layout_bound(glopts, joint, sblimit);
     int req_bits = 0, bbal = 0, berr = 0, banc = 32;
-    int maxAlloc, sel_bits, sc_bits, smp_bits;
+    int sel_bits, sc_bits;
     static const int sfsPerScfsi[] = { 3, 2, 1, 2 };    /* lookup # sfs per scfsi */
 
     /* MFC Feb 2003 This works out the basic number of bits just to get a valid (but empty) frame.
@@ -749,60 +1020,240 @@ int bits_for_nonoise(twolame_options * glopts,
 
     /* Count the number of bits required to encode the quantization index for both channels in each 
        subband. If we're above the jsbound, then pretend we only have one channel */
-    for (sb = 0; sb < jsbound; ++sb)
-        bbal += nch * nbal[line[glopts->tablenum][sb]]; // (*alloc)[sb][0].bits;
-
-    for (sb = jsbound; sb < sblimit; ++sb)
-        bbal += nbal[line[glopts->tablenum][sb]];   // (*alloc)[sb][0].bits;
+    bbal = alloc_bits(glopts, glopts->jsbound);
     req_bits = banc + bbal + berr;
 
-    for (sb = 0; sb < sblimit; ++sb)
-        for (ch = 0; ch < ((sb < jsbound) ? nch : 1); ++ch) {
-            int thisline = line[glopts->tablenum][sb];
-
-            /* How many possible steps are there to choose from ? */
-            maxAlloc = (1 << nbal[line[glopts->tablenum][sb]]) - 1; // (*alloc)[sb][0].bits) - 1;
-            sel_bits = sc_bits = smp_bits = 0;
-            /* Keep choosing the next number of steps (and hence our SNR value) until we have the
-               required MNR value */
-            for (ba = 0; ba < maxAlloc - 1; ++ba) {
-                int thisstep_index = step_index[thisline][ba];
-                if ((SNR[thisstep_index] - SMR[ch][sb]) >= min_mnr)
-                    break;      /* we found enough bits */
-            }
-            if (nch == 2 && sb >= jsbound)  /* check other JS channel */
-                for (; ba < maxAlloc - 1; ++ba) {
-                    int thisstep_index = step_index[thisline][ba];
-                    if ((SNR[thisstep_index] - SMR[1 - ch][sb]) >= min_mnr)
-                        break;
-                }
-            if (ba > 0) {
-                // smp_bits = SCALE_BLOCK * ((*alloc)[sb][ba].group * (*alloc)[sb][ba].bits);
-                int thisstep_index = step_index[thisline][ba];
-                smp_bits = SCALE_BLOCK * group[thisstep_index] * bits[thisstep_index];
-                /* scale factor bits required for subband */
-                sel_bits = 2;
-                sc_bits = 6 * sfsPerScfsi[scfsi[ch][sb]];
-                if (nch == 2 && sb >= jsbound) {
-                    /* each new js sb has L+R scfsis */
-                    sel_bits += 2;
-                    sc_bits += 6 * sfsPerScfsi[scfsi[1 - ch][sb]];
-                }
-                req_bits += smp_bits + sel_bits + sc_bits;
-            }
+    /* Choose the fewest steps (and hence the lowest SNR) giving the required MNR value. Above
+       jsbound, both channels need it */
+    for (sb = 0; sb < jsbound; ++sb)
+        for (ch = 0; ch < nch; ++ch) {
+            ba = nonoise_alloc(glopts, sb, SMR[ch][sb], min_mnr);
+
+            /* the samples, and the scfsi and scale factors if any are sent */
+            sel_bits = 2;
+            sc_bits = 6 * sfsPerScfsi[scfsi[ch][sb]];
+            req_bits += glopts->alloc_smp_bits[sb][ba] + (ba > 0) * (sel_bits + sc_bits);
             bit_alloc[ch][sb] = ba;
         }
+    for (; sb < sblimit; ++sb) {
+        int other = nonoise_alloc(glopts, sb, SMR[1][sb], min_mnr);
+
+        ba = nonoise_alloc(glopts, sb, SMR[0][sb], min_mnr);
+        ba = (other > ba) ? other : ba;
+
+        /* each new js sb has L+R scfsis */
+        sel_bits = 4;
+        sc_bits = 6 * (sfsPerScfsi[scfsi[0][sb]] + sfsPerScfsi[scfsi[1][sb]]);
+        req_bits += glopts->alloc_smp_bits[sb][ba] + (ba > 0) * (sel_bits + sc_bits);
+        bit_alloc[0][sb] = ba;
+    }
     return req_bits;
 }
 
 
+/* The encoding loops for one channel layout */
+struct encode_kernels_struct {
+    void (*write_bit_alloc) (twolame_options * glopts, unsigned int bit_alloc[2][SBLIMIT],
+                             bit_stream * bs);
+    void (*write_scalefactors) (twolame_options * glopts, unsigned int bit_alloc[2][SBLIMIT],
+                                unsigned int sf_selectinfo[2][SBLIMIT],
+                                unsigned int sf_index[2][3][SBLIMIT], bit_stream * bs);
+    void (*subband_quantization) (twolame_options * glopts,
+                                  unsigned int sf_index[2][3][SBLIMIT],
+                                  FLOAT sb_samples[2][3][SCALE_BLOCK][SBLIMIT],
+                                  unsigned int j_scale[3][SBLIMIT],
+                                  FLOAT j_samps[3][SCALE_BLOCK][SBLIMIT],
+                                  unsigned int bit_alloc[2][SBLIMIT],
+                                  unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT]);
+    void (*subband_quantization_fixed) (twolame_options * glopts,
+                                        unsigned int sf_index[2][3][SBLIMIT],
+                                        int sb_samples[2][3][SCALE_BLOCK][SBLIMIT],
+                                        unsigned int j_scale[3][SBLIMIT],
+                                        int j_samps[3][SCALE_BLOCK][SBLIMIT],
+                                        unsigned int bit_alloc[2][SBLIMIT],
+                                        unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT]);
+    void (*write_samples) (twolame_options * glopts,
+                           unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
+                           unsigned int bit_alloc[2][SBLIMIT], bit_stream * bs);
+    int (*bits_for_nonoise) (twolame_options * glopts, FLOAT SMR[2][SBLIMIT],
+                             unsigned int scfsi[2][SBLIMIT], FLOAT min_mnr,
+                             unsigned int bit_alloc[2][SBLIMIT]);
+};
+
+/* A copy of each loop for nch channels, with or without joint stereo */
+#define ENCODE_KERNELS(layout, nch, joint) \
+static void write_bit_alloc_##layout(twolame_options * glopts, \
+                                     unsigned int bit_alloc[2][SBLIMIT], bit_stream * bs) \
+{ \
+    write_bit_alloc_layout(glopts, bit_alloc, bs, nch, joint); \
+} \
+static void write_scalefactors_##layout(twolame_options * glopts, \
+                                        unsigned int bit_alloc[2][SBLIMIT], \
+                                        unsigned int sf_selectinfo[2][SBLIMIT], \
+                                        unsigned int sf_index[2][3][SBLIMIT], bit_stream * bs) \
+{ \
+    write_scalefactors_layout(glopts, bit_alloc, sf_selectinfo, sf_index, bs, nch); \
+} \
+static void subband_quantization_##layout(twolame_options * glopts, \
+                                          unsigned int sf_index[2][3][SBLIMIT], \
+                                          FLOAT sb_samples[2][3][SCALE_BLOCK][SBLIMIT], \
+                                          unsigned int j_scale[3][SBLIMIT], \
+                                          FLOAT j_samps[3][SCALE_BLOCK][SBLIMIT], \
+                                          unsigned int bit_alloc[2][SBLIMIT], \
+                                          unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT]) \
+{ \
+    subband_quantization_layout(glopts, sf_index, sb_samples, j_scale, j_samps, bit_alloc, \
+                                sbband, nch, joint); \
+} \
+static void subband_quantization_fixed_##layout(twolame_options * glopts, \
+                                                unsigned int sf_index[2][3][SBLIMIT], \
+                                                int sb_samples[2][3][SCALE_BLOCK][SBLIMIT], \
+                                                unsigned int j_scale[3][SBLIMIT], \
+                                                int j_samps[3][SCALE_BLOCK][SBLIMIT], \
+                                                unsigned int bit_alloc[2][SBLIMIT], \
+                                                unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT]) \
+{ \
+    subband_quantization_fixed_layout(glopts, sf_index, sb_samples, j_scale, j_samps, \
+                                      bit_alloc, sbband, nch, joint); \
+} \
+static void write_samples_##layout(twolame_options * glopts, \
+                                   unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT], \
+                                   unsigned int bit_alloc[2][SBLIMIT], bit_stream * bs) \
+{ \
+    write_samples_layout(glopts, sbband, bit_alloc, bs, nch, joint); \
+} \
+static int bits_for_nonoise_##layout(twolame_options * glopts, FLOAT SMR[2][SBLIMIT], \
+                                     unsigned int scfsi[2][SBLIMIT], FLOAT min_mnr, \
+                                     unsigned int bit_alloc[2][SBLIMIT]) \
+{ \
+    return bits_for_nonoise_layout(glopts, SMR, scfsi, min_mnr, bit_alloc, nch, joint); \
+} \
+static const encode_kernels layout##_kernels = { \
+    write_bit_alloc_##layout, \
+    write_scalefactors_##layout, \
+    subband_quantization_##layout, \
+    subband_quantization_fixed_##layout, \
+    write_samples_##layout, \
+    bits_for_nonoise_##layout \
+};
+
+ENCODE_KERNELS(mono, 1, FALSE)
+ENCODE_KERNELS(stereo, 2, FALSE)
+ENCODE_KERNELS(joint, 2, TRUE)
+
+
+void write_bit_alloc(twolame_options * glopts, unsigned int bit_alloc[2][SBLIMIT], bit_stream * bs)
+{
+    glopts->kernels->write_bit_alloc(glopts, bit_alloc, bs);
+}
+
+void write_scalefactors(twolame_options * glopts,
+                        unsigned int bit_alloc[2][SBLIMIT],
+                        unsigned int sf_selectinfo[2][SBLIMIT],
+                        unsigned int sf_index[2][3][SBLIMIT], bit_stream * bs)
+{
+    glopts->kernels->write_scalefactors(glopts, bit_alloc, sf_selectinfo, sf_index, bs);
+}
+
+void
+subband_quantization(twolame_options * glopts,
+                     unsigned int sf_index[2][3][SBLIMIT],
+                     FLOAT sb_samples[2][3][SCALE_BLOCK][SBLIMIT],
+                     unsigned int j_scale[3][SBLIMIT],
+                     FLOAT j_samps[3][SCALE_BLOCK][SBLIMIT],
+                     unsigned int bit_alloc[2][SBLIMIT],
+                     unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT])
+{
+    glopts->kernels->subband_quantization(glopts, sf_index, sb_samples, j_scale, j_samps,
+                                          bit_alloc, sbband);
+}
+
+void
+subband_quantization_fixed(twolame_options * glopts,
+                           unsigned int sf_index[2][3][SBLIMIT],
+                           int sb_samples[2][3][SCALE_BLOCK][SBLIMIT],
+                           unsigned int j_scale[3][SBLIMIT],
+                           int j_samps[3][SCALE_BLOCK][SBLIMIT],
+                           unsigned int bit_alloc[2][SBLIMIT],
+                           unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT])
+{
+    glopts->kernels->subband_quantization_fixed(glopts, sf_index, sb_samples, j_scale, j_samps,
+                                                bit_alloc, sbband);
+}
+
+void write_samples(twolame_options * glopts,
+                   unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
+                   unsigned int bit_alloc[2][SBLIMIT], bit_stream * bs)
+{
+    glopts->kernels->write_samples(glopts, sbband, bit_alloc, bs);
+}
+
+int bits_for_nonoise(twolame_options * glopts,
+                     FLOAT SMR[2][SBLIMIT],
+                     unsigned int scfsi[2][SBLIMIT], FLOAT min_mnr,
+                     unsigned int bit_alloc[2][SBLIMIT])
+{
+    return glopts->kernels->bits_for_nonoise(glopts, SMR, scfsi, min_mnr, bit_alloc);
+}
+
+
 /* must be called before calling main_bit_allocation */
 int init_bit_allocation(twolame_options * glopts)
 {
     frame_header *header = &glopts->header;
     int nch = glopts->num_channels_out;
-    int brindex;
+    int brindex, sb, ba;
+
+
+    /* The SNR and the sample bits of each allocation, for bits_for_nonoise(). As ever, it
+       stops one short of the highest allocation of each subband, (1 << nbal) - 1, so that
+       and everything above it get an SNR which is always enough */
+    for (sb = 0; sb < SBLIMIT; sb++) {
+        int thisline = line[glopts->tablenum][sb];
+        int max_alloc = (thisline < 0) ? 0 : (1 << nbal[thisline]) - 2;
+
+        for (ba = 0; ba < 16; ba++) {
+            int thisstep_index = (thisline < 0) ? 0 : step_index[thisline][ba];
+
+            if (ba < max_alloc)
+                glopts->alloc_snr[sb][ba] = SNR[thisstep_index];
+            else
+                glopts->alloc_snr[sb][ba] = 1E20;
+            if (ba > 0 && ba <= max_alloc)
+                glopts->alloc_smp_bits[sb][ba] =
+                    SCALE_BLOCK * group[thisstep_index] * bits[thisstep_index];
+            else
+                glopts->alloc_smp_bits[sb][ba] = 0;
+        }
+    }
 
+    /* The allocation table, flattened for the encoding loops */
+    for (sb = 0; sb < SBLIMIT; sb++) {
+        int thisline = line[glopts->tablenum][sb];
+
+        glopts->alloc_nbal[sb] = (thisline < 0) ? 0 : nbal[thisline];
+        for (ba = 0; ba < 16; ba++) {
+            int thisstep_index = (thisline < 0) ? 0 : step_index[thisline][ba];
+            alloc_step *step = &glopts->alloc_steps[sb][ba];
+
+            step->a = a[thisstep_index];
+            step->b = b[thisstep_index];
+            step->fixed_a = (int) floor(a[thisstep_index] * (1 << 30) + 0.5);
+            step->fixed_b = (int) floor(b[thisstep_index] * (1 << 30) + 0.5);
+            step->steps2n = steps2n[thisstep_index];
+            step->steps = steps[thisstep_index];
+            step->bits = bits[thisstep_index];
+            step->group = group[thisstep_index];
+        }
+    }
+
+    /* and the copy of them for the channel layout */
+    if (nch == 1)
+        glopts->kernels = &mono_kernels;
+    else if (glopts->mode == TWOLAME_JOINT_STEREO)
+        glopts->kernels = &joint_kernels;
+    else
+        glopts->kernels = &stereo_kernels;
 
     /* these are the tables which specify the limits within which the VBR can vary You can't vary
        outside these ranges, otherwise a new alloc table would have to be loaded in the middle of
@@ -901,7 +1352,7 @@ void main_bit_allocation(twolame_options * glopts,
     if (mode == TWOLAME_JOINT_STEREO) {
         header->mode = TWOLAME_STEREO;
         header->mode_ext = 0;
-        glopts->jsbound = glopts->sblimit;
+        glopts->jsbound = table_sblimit[glopts->tablenum];
         if ((rq_db = bits_for_nonoise(glopts, SMR, scfsi, 0, bit_alloc)) > *adb) {
             header->mode = TWOLAME_JOINT_STEREO;
             mode_ext = 4;       /* 3 is least severe reduction */
@@ -1053,8 +1504,7 @@ int vbr_bit_allocation(twolame_options * glopts,
 
 
     /* No need to worry about jsbound here as JS is disabled for VBR mode */
-    for (sb = 0; sb < sblimit; sb++)
-        bbal += nch * nbal[line[glopts->tablenum][sb]];
+    bbal = alloc_bits(glopts, jsbound);
     *adb -= bbal + berr + banc;
     ad = *adb;
 
@@ -1203,10 +1653,7 @@ int a_bit_allocation(twolame_options * glopts, FLOAT SMR[2][SBLIMIT],
         banc = 32;
     }
 
-    for (sb = 0; sb < jsbound; sb++)
-        bbal += nch * nbal[line[glopts->tablenum][sb]]; // (*alloc)[sb][0].bits;
-    for (sb = jsbound; sb < sblimit; sb++)
-        bbal += nbal[line[glopts->tablenum][sb]];   // (*alloc)[sb][0].bits;
+    bbal = alloc_bits(glopts, jsbound);
     *adb -= bbal + berr + banc;
     ad = *adb;
 
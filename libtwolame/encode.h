@@ -30,12 +30,20 @@ int encode_init(twolame_options * glopts);
 
 void scalefactor_calc(FLOAT sb_sample[][3][SCALE_BLOCK][SBLIMIT],
                       unsigned int scalar[][3][SBLIMIT], int nch, int sblimit);
+void scalefactor_calc_fixed(int sb_sample[][3][SCALE_BLOCK][SBLIMIT],
+                            unsigned int scalar[][3][SBLIMIT], int nch, int sblimit);
 
 void combine_lr(FLOAT sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
-                FLOAT joint_sample[3][SCALE_BLOCK][SBLIMIT], int sblimit);
+                FLOAT joint_sample[3][SCALE_BLOCK][SBLIMIT],
+                unsigned int j_scale[3][SBLIMIT], int jsbound, int sblimit);
+void combine_lr_fixed(int sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
+                      int joint_sample[3][SCALE_BLOCK][SBLIMIT],
+                      unsigned int j_scale[3][SBLIMIT], int jsbound, int sblimit);
 
 void find_sf_max(twolame_options * glopts,
                  unsigned int sf_index[2][3][SBLIMIT], FLOAT sf_max[2][SBLIMIT]);
+void find_sf_max_channel(twolame_options * glopts,
+                         unsigned int sf_index[3][SBLIMIT], FLOAT sf_max[SBLIMIT]);
 
 void sf_transmission_pattern(twolame_options * glopts,
                              unsigned int sf_index[2][3][SBLIMIT],
@@ -57,6 +65,13 @@ void subband_quantization(twolame_options * glopts,
                           FLOAT j_samps[3][SCALE_BLOCK][SBLIMIT],
                           unsigned int bit_alloc[2][SBLIMIT],
                           unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT]);
+void subband_quantization_fixed(twolame_options * glopts,
+                                unsigned int sf_index[2][3][SBLIMIT],
+                                int sb_samples[2][3][SCALE_BLOCK][SBLIMIT],
+                                unsigned int j_scale[3][SBLIMIT],
+                                int j_samps[3][SCALE_BLOCK][SBLIMIT],
+                                unsigned int bit_alloc[2][SBLIMIT],
+                                unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT]);
 
 void write_samples(twolame_options * glopts,
                    unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
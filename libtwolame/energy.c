@@ -51,7 +51,7 @@ int get_required_energy_bits(twolame_options * glopts)
 
 // Calculates the energy levels of current frame and
 // inserts it into the end of the frame
-void do_energy_levels(twolame_options * glopts, bit_stream * bs)
+void do_energy_levels(twolame_options * glopts, const short int *buffer[2], bit_stream * bs)
 {
     /* Reference: Using the BWF Energy Levels in AudioScience Bitstreams
        http://www.audioscience.com/internet/download/notes/note0001_MPEG_energy.pdf
@@ -66,8 +66,8 @@ void do_energy_levels(twolame_options * glopts, bit_stream * bs)
        The last 5 bytes *must* be reserved for this to work correctly (otherwise you'll be
        overwriting mpeg audio data) */
 
-    short int *leftpcm = glopts->buffer[0];
-    short int *rightpcm = glopts->buffer[1];
+    const short int *leftpcm = buffer[0];
+    const short int *rightpcm = buffer[1];
 
     int i, leftMax, rightMax;
     unsigned char rhibyte, rlobyte, lhibyte, llobyte;
@@ -28,7 +28,7 @@
 #define TWOLAME_ENERGY_H
 
 int get_required_energy_bits(twolame_options * glopts);
-void do_energy_levels(twolame_options * glopts, bit_stream * bs);
+void do_energy_levels(twolame_options * glopts, const short int *buffer[2], bit_stream * bs);
 
 #endif
 
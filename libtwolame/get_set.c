@@ -69,6 +69,7 @@ const char *twolame_get_mode_name(twolame_options * glopts)
 int twolame_set_psymodel(twolame_options * glopts, int psymodel)
 {
     glopts->psymodel = psymodel;
+    glopts->psymodel_set = TRUE;
     return (0);
 }
 
@@ -336,6 +337,98 @@ int twolame_get_quick_count(twolame_options * glopts)
     return (glopts->quickcount);
 }
 
+int twolame_set_frame_budget(twolame_options * glopts, int usec)
+{
+    if (usec < 0) {
+        fprintf(stderr, "invalid frame budget %i\n", usec);
+        return (-1);
+    }
+    glopts->frame_budget = usec;
+    return (0);
+}
+
+int twolame_get_frame_budget(twolame_options * glopts)
+{
+    return (glopts->frame_budget);
+}
+
+int twolame_set_channel_threads(twolame_options * glopts, int channel_threads)
+{
+    glopts->channel_threads = channel_threads;
+    return (0);
+}
+
+int twolame_get_channel_threads(twolame_options * glopts)
+{
+    return (glopts->channel_threads);
+}
+
+int twolame_set_channel_thread_cpu(twolame_options * glopts, int cpu)
+{
+    if (cpu < -1) {
+        fprintf(stderr, "invalid CPU number %i\n", cpu);
+        return (-1);
+    }
+    glopts->channel_thread_cpu = cpu;
+    return (0);
+}
+
+int twolame_get_channel_thread_cpu(twolame_options * glopts)
+{
+    return (glopts->channel_thread_cpu);
+}
+
+int twolame_set_psy_single_run(twolame_options * glopts, int single_run)
+{
+    glopts->psy_single_run = single_run;
+    return (0);
+}
+
+int twolame_get_psy_single_run(twolame_options * glopts)
+{
+    return (glopts->psy_single_run);
+}
+
+int twolame_set_lowpass(twolame_options * glopts, int lowpass)
+{
+    if (lowpass < 0) {
+        fprintf(stderr, "invalid lowpass frequency %i\n", lowpass);
+        return (-1);
+    }
+    glopts->lowpass = lowpass;
+    return (0);
+}
+
+int twolame_get_lowpass(twolame_options * glopts)
+{
+    return (glopts->lowpass);
+}
+
+int twolame_set_fixed_point(twolame_options * glopts, int fixed_point)
+{
+    // The fixed point buffers are allocated by twolame_init_params()
+    if (glopts->twolame_init) {
+        fprintf(stderr, "twolame_set_fixed_point: must be called before twolame_init_params()\n");
+        return (-1);
+    }
+    glopts->fixed_point = fixed_point ? TRUE : FALSE;
+    return (0);
+}
+
+int twolame_get_fixed_point(twolame_options * glopts)
+{
+    return (glopts->fixed_point);
+}
+
+int twolame_get_realtime_stats(twolame_options * glopts, TWOLAME_realtime_stats * stats)
+{
+    if (stats == NULL)
+        return (-1);
+
+    memcpy(stats, &glopts->rtmem.stats, sizeof(TWOLAME_realtime_stats));
+    return (0);
+}
+
 
 int twolame_set_verbosity(twolame_options * glopts, int verbosity)
 {
@@ -0,0 +1,152 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "twolame.h"
+#include "common.h"
+#include "masking.h"
+
+
+/*
+  Masking thresholds for psycho models 1 and 3 (ISO11172 D.1 Step 6)
+
+  A masker only affects lines from 3 bark below it to 8 bark above
+  it, and the lines are in order of bark, so each masker only visits
+  the lines in its window. The maskers are collected in order of
+  frequency, so the window just moves up the lines from one masker
+  to the next. Each line still adds up its maskers in the same order,
+  which gives exactly the same sums as checking every masker against
+  every line.
+
+  Going through the maskers one at a time (rather than the lines)
+  also means that each add_db() in the inner loop is for a different
+  line, so they don't have to wait for each other.
+*/
+
+
+static inline FLOAT add_db(const FLOAT * dbtable, FLOAT a, FLOAT b)
+{
+    FLOAT fdiff;
+    int idiff;
+    fdiff = (10.0 * (a - b));
+
+    if (fdiff > 990.0) {
+        return a;
+    }
+    if (fdiff < -990.0) {
+        return (b);
+    }
+
+    idiff = (int) fdiff;
+    if (idiff >= 0) {
+        return (a + dbtable[idiff]);
+    }
+
+    return (b + dbtable[-idiff]);
+}
+
+
+void masking_clear(masker_list * list)
+{
+    list->count = 0;
+}
+
+
+/* Add a tonal (type TONE) or non-tonal (type NOISE) masker to the end of the list,
+   working out the parts of its masking function which don't depend on distance */
+void masking_add(masker_list * list, int line, FLOAT x, FLOAT bark, int type)
+{
+    int n = list->count;
+
+    if (n >= HAN_SIZE)
+        return;
+
+    list->line[n] = line;
+    list->x[n] = x;
+    list->bark[n] = bark;
+    if (type == TONE)
+        list->base[n] = -1.525 - 0.275 * bark - 4.5 + x;
+    else
+        list->base[n] = -1.525 - 0.175 * bark - 0.5 + x;
+    list->lower[n] = 0.4 * x + 6;
+    list->upper[n] = 17 - 0.15 * x;
+    list->count = n + 1;
+}
+
+
+/* The masking at bark (in dB) from masker m */
+static inline FLOAT masking_level(masker_list * list, int m, FLOAT bark)
+{
+    FLOAT dz = bark - list->bark[m];    /* distance of bark value */
+    FLOAT vf;
+
+    /* masking function for lower & upper slopes */
+    if (dz < -1)
+        vf = 17 * (dz + 1) - list->lower[m];
+    else if (dz < 0)
+        vf = list->lower[m] * dz;
+    else if (dz < 1)
+        vf = (-17 * dz);
+    else
+        vf = -(dz - 1) * list->upper[m] - 17;
+    return list->base[m] + vf;
+}
+
+
+/*
+  Add the masking from the maskers in list to the threshold of each of
+  the num_lines lines, whose frequencies (in bark) are given by bark[]
+  in increasing order.
+*/
+void masking_threshold(const FLOAT * dbtable, masker_list * list, const FLOAT * bark,
+                       int num_lines, FLOAT * thres)
+{
+    int n = list->count;
+    int first = 0, last = 0;
+    int i, m;
+
+    for (m = 0; m < n; m++) {
+        FLOAT z = list->bark[m];
+
+        /* The window of lines from 3 bark below to 8 bark above the masker
+           (the maskers are normally in order too, but start again if not) */
+        if (m > 0 && z < list->bark[m - 1])
+            first = last = 0;
+        while (first < num_lines && bark[first] - z < -3.0)
+            first++;
+        while (last < num_lines && bark[last] - z < 8.0)
+            last++;
+
+        /* add_db() isn't associative, so each line adds up
+           its maskers in the same order as ever */
+        for (i = first; i < last; i++)
+            thres[i] = add_db(dbtable, thres[i], masking_level(list, m, bark[i]));
+    }
+}
+
+
+// vim:ts=4:sw=4:nowrap:
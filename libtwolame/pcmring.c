@@ -0,0 +1,339 @@
+/*
+ *  TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *  Copyright (C) 2001-2004 Michael Cheng
+ *  Copyright (C) 2004-2006 The TwoLAME Project
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "twolame.h"
+#include "common.h"
+#include "mem.h"
+#include "pcmring.h"
+
+
+/*
+  Single producer, single consumer ring of PCM samples
+
+  The producer (usually a real-time audio callback) copies samples
+  in with twolame_ring_push(), and the consumer encodes every whole
+  frame in the ring with twolame_poll(). Neither of them ever waits
+  for the other: the producer only writes write_pos, the consumer
+  only writes read_pos, and each of them publishes its position with
+  a release store after it has finished with the samples, which the
+  other picks up with an acquire load.
+
+  Positions count sample frames (one sample for each channel) and
+  run from 0 to twice the size of the ring, so that a full ring can
+  be told apart from an empty one.
+*/
+
+#if defined(HAVE_ATOMIC_BUILTINS)
+# define PCMRING_SUPPORTED
+# define ring_load(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+# define ring_store(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#elif defined(_WIN32)
+# define PCMRING_SUPPORTED
+# include <windows.h>
+static unsigned long ring_load(volatile unsigned long *p)
+{
+    unsigned long v = *p;
+    MemoryBarrier();
+    return v;
+}
+
+static void ring_store(volatile unsigned long *p, unsigned long v)
+{
+    MemoryBarrier();
+    *p = v;
+}
+#endif
+
+
+struct pcmring_struct {
+    short int *pcm;             // interleaved samples
+    unsigned long size;         // in sample frames (a multiple of TWOLAME_SAMPLES_PER_FRAME)
+    int channels;
+
+    volatile unsigned long write_pos;   // only written by the producer
+    volatile unsigned long read_pos;    // only written by the consumer
+
+    // Written by the producer
+    unsigned long overruns;
+    unsigned long dropped_samples;
+    unsigned long max_fill;
+
+    // Written by the consumer
+    unsigned long underruns;
+    unsigned long frames;
+};
+
+
+/* Number of sample frames between two positions */
+static unsigned long ring_distance(pcmring * ring, unsigned long from, unsigned long to)
+{
+    return (to + 2 * ring->size - from) % (2 * ring->size);
+}
+
+
+static unsigned long ring_advance(pcmring * ring, unsigned long pos, unsigned long count)
+{
+    return (pos + count) % (2 * ring->size);
+}
+
+
+int twolame_ring_init(twolame_options * glopts, int num_frames)
+{
+#ifdef PCMRING_SUPPORTED
+    pcmring *ring = NULL;
+
+    if (!glopts->twolame_init) {
+        fprintf(stderr, "Please call twolame_init_params() before twolame_ring_init().\n");
+        return -1;
+    }
+    if (glopts->ring != NULL) {
+        fprintf(stderr, "twolame_ring_init(): the ring has already been created.\n");
+        return -1;
+    }
+    if (num_frames < 2) {
+        fprintf(stderr, "twolame_ring_init(): the ring must hold at least 2 frames.\n");
+        return -1;
+    }
+
+    ring = (pcmring *) TWOLAME_MALLOC(sizeof(pcmring));
+    if (ring == NULL)
+        return -1;
+    ring->channels = glopts->num_channels_in;
+    ring->size = (unsigned long) num_frames * TWOLAME_SAMPLES_PER_FRAME;
+    ring->pcm = (short int *) TWOLAME_MALLOC(ring->size * ring->channels * sizeof(short int));
+    if (ring->pcm == NULL) {
+        TWOLAME_FREE(ring);
+        return -1;
+    }
+
+    glopts->ring = ring;
+    return 0;
+#else
+    fprintf(stderr, "twolame_ring_init(): not supported by this build of libtwolame.\n");
+    return -1;
+#endif
+}
+
+
+#ifdef PCMRING_SUPPORTED
+
+/* Producer: copy in as many samples as there is room for */
+int twolame_ring_push(twolame_options * glopts, const short int pcm[], int num_samples)
+{
+    pcmring *ring = glopts->ring;
+    unsigned long write_pos, fill, start;
+    int count, first;
+
+    if (ring == NULL || num_samples < 0)
+        return -1;
+
+    write_pos = ring->write_pos;
+    fill = ring_distance(ring, ring_load(&ring->read_pos), write_pos);
+
+    count = num_samples;
+    if ((unsigned long) count > ring->size - fill) {
+        count = ring->size - fill;
+        ring->overruns++;
+        ring->dropped_samples += num_samples - count;
+    }
+
+    // Copy in up to the end of the ring, then the rest at the start
+    start = write_pos % ring->size;
+    first = count;
+    if ((unsigned long) first > ring->size - start)
+        first = ring->size - start;
+    memcpy(ring->pcm + start * ring->channels, pcm, first * ring->channels * sizeof(short int));
+    memcpy(ring->pcm, pcm + first * ring->channels,
+           (count - first) * ring->channels * sizeof(short int));
+
+    fill += count;
+    if (fill > ring->max_fill)
+        ring->max_fill = fill;
+
+    ring_store(&ring->write_pos, ring_advance(ring, write_pos, count));
+
+    return count;
+}
+
+
+/* Consumer: encode whole frames while they fit into mp2buffer */
+int twolame_poll(twolame_options * glopts, unsigned char *mp2buffer, int mp2buffer_size)
+{
+    pcmring *ring = glopts->ring;
+    unsigned long read_pos, fill;
+    int mp2_size = 0;
+
+    if (ring == NULL) {
+        fprintf(stderr, "Please call twolame_ring_init() before twolame_poll().\n");
+        return -1;
+    }
+
+    read_pos = ring->read_pos;
+    fill = ring_distance(ring, read_pos, ring_load(&ring->write_pos));
+    if (fill < TWOLAME_SAMPLES_PER_FRAME) {
+        ring->underruns++;
+        return 0;
+    }
+
+    while (fill >= TWOLAME_SAMPLES_PER_FRAME &&
+           mp2buffer_size - mp2_size >= TWOLAME_MAX_FRAME_BYTES) {
+        unsigned long start = read_pos % ring->size;
+        int count = TWOLAME_SAMPLES_PER_FRAME;
+        int bytes;
+
+        // The frame may wrap round the end of the ring
+        if ((unsigned long) count > ring->size - start)
+            count = ring->size - start;
+        bytes = twolame_encode_buffer_interleaved(glopts, ring->pcm + start * ring->channels,
+                                                  count, mp2buffer + mp2_size,
+                                                  mp2buffer_size - mp2_size);
+        if (bytes >= 0 && count < TWOLAME_SAMPLES_PER_FRAME)
+            bytes = twolame_encode_buffer_interleaved(glopts, ring->pcm,
+                                                      TWOLAME_SAMPLES_PER_FRAME - count,
+                                                      mp2buffer + mp2_size,
+                                                      mp2buffer_size - mp2_size);
+        if (bytes < 0)
+            return bytes;
+        mp2_size += bytes;
+
+        // Hand the space back to the producer
+        read_pos = ring_advance(ring, read_pos, TWOLAME_SAMPLES_PER_FRAME);
+        fill -= TWOLAME_SAMPLES_PER_FRAME;
+        ring_store(&ring->read_pos, read_pos);
+        ring->frames++;
+    }
+
+    return mp2_size;
+}
+
+
+/* Consumer: throw away everything in the ring */
+void pcmring_discard(twolame_options * glopts)
+{
+    pcmring *ring = glopts->ring;
+
+    if (ring != NULL)
+        ring_store(&ring->read_pos, ring_load(&ring->write_pos));
+}
+
+
+/*
+  Consumer: move the samples left in the ring (less than a frame,
+  once twolame_poll() has had its go) into the frame buffer,
+  ready for twolame_encode_flush().
+*/
+void pcmring_flush(twolame_options * glopts)
+{
+    pcmring *ring = glopts->ring;
+    unsigned long read_pos, fill;
+    int count, i;
+
+    if (ring == NULL)
+        return;
+
+    read_pos = ring->read_pos;
+    fill = ring_distance(ring, read_pos, ring_load(&ring->write_pos));
+
+    count = TWOLAME_SAMPLES_PER_FRAME - glopts->samples_in_buffer;
+    if ((unsigned long) count > fill)
+        count = fill;
+    if (fill > (unsigned long) count)
+        fprintf(stderr, "twolame_encode_flush(): call twolame_poll() first, dropping %lu samples.\n",
+                fill - count);
+
+    for (i = 0; i < count; i++) {
+        const short int *pcm = ring->pcm + ((read_pos + i) % ring->size) * ring->channels;
+        glopts->buffer[0][glopts->samples_in_buffer + i] = pcm[0];
+        if (ring->channels == 2)
+            glopts->buffer[1][glopts->samples_in_buffer + i] = pcm[1];
+    }
+    glopts->samples_in_buffer += count;
+
+    ring_store(&ring->read_pos, ring_advance(ring, read_pos, fill));
+}
+
+#else                           /* PCMRING_SUPPORTED */
+
+int twolame_ring_push(twolame_options * glopts, const short int pcm[], int num_samples)
+{
+    return -1;
+}
+
+int twolame_poll(twolame_options * glopts, unsigned char *mp2buffer, int mp2buffer_size)
+{
+    return -1;
+}
+
+void pcmring_discard(twolame_options * glopts)
+{
+}
+
+void pcmring_flush(twolame_options * glopts)
+{
+}
+
+#endif                          /* PCMRING_SUPPORTED */
+
+
+int twolame_get_ring_stats(twolame_options * glopts, TWOLAME_ring_stats * stats)
+{
+    pcmring *ring = glopts->ring;
+
+    if (stats == NULL)
+        return (-1);
+
+    memset(stats, 0, sizeof(TWOLAME_ring_stats));
+    if (ring == NULL)
+        return (0);
+
+    stats->size = ring->size;
+    stats->fill = ring_distance(ring, ring->read_pos, ring->write_pos);
+    stats->max_fill = ring->max_fill;
+    stats->overruns = ring->overruns;
+    stats->dropped_samples = ring->dropped_samples;
+    stats->underruns = ring->underruns;
+    stats->frames = ring->frames;
+
+    return (0);
+}
+
+
+void pcmring_deinit(twolame_options * glopts)
+{
+    pcmring *ring = glopts->ring;
+
+    if (ring == NULL)
+        return;
+
+    TWOLAME_FREE(ring->pcm);
+    TWOLAME_FREE(ring);
+    glopts->ring = NULL;
+}
+
+
+// vim:ts=4:sw=4:nowrap: 
@@ -31,6 +31,7 @@
 #include "common.h"
 #include "mem.h"
 #include "fft.h"
+#include "masking.h"
 #include "psycho_1.h"
 
 /**********************************************************************
@@ -108,14 +109,35 @@ static void psycho_1_read_freq_band(g_ptr * ltg, int lay, int freq, int *sub_siz
 }
 
 
-static void psycho_1_make_map(int sub_size, mask power[HAN_SIZE], g_thres * ltg)
+static void psycho_1_make_map(int sub_size, mask_spectrum * power, g_thres * ltg)
 /* this function calculates the global masking threshold */
 {
     int i, j;
 
     for (i = 1; i < sub_size; i++)
         for (j = ltg[i - 1].line; j <= ltg[i].line; j++)
-            power[j].map = i;
+            power->map[j] = i;
+}
+
+/* The bark values of the frequency subbands in one array, for masking_threshold() */
+static void psycho_1_init_bark(psycho_1_mem * mem)
+{
+    int i;
+
+    mem->bark = (FLOAT *) TWOLAME_MALLOC(sizeof(FLOAT) * mem->sub_size);
+    mem->thres = (FLOAT *) TWOLAME_MALLOC(sizeof(FLOAT) * mem->sub_size);
+    for (i = 0; i < mem->sub_size; i++)
+        mem->bark[i] = mem->ltg[i].bark;
+}
+
+/* The thresholds are only needed up to the last subband that is coded,
+   and the first frequency subband above it (see psycho_1_minimum_mask()) */
+static void psycho_1_init_used_size(psycho_1_mem * mem, int sblimit)
+{
+    int i;
+
+    for (i = 1; i < mem->sub_size && mem->ltg[i].line >> 4 < sblimit; i++);
+    mem->used_size = (i < mem->sub_size) ? i + 1 : mem->sub_size;
 }
 
 static void psycho_1_init_add_db(psycho_1_mem * mem)
@@ -161,26 +183,26 @@ static inline FLOAT add_db(psycho_1_mem * mem, FLOAT a, FLOAT b)
 *	 
 *
 ****************************************************************/
-static void psycho_1_hann_fft_pickmax(FLOAT sample[FFT_SIZE], mask power[HAN_SIZE],
-                                      FLOAT spike[SBLIMIT], FLOAT energy[FFT_SIZE])
+static void psycho_1_init_window(FLOAT window[FFT_SIZE])
+{
+    FLOAT sqrt_8_over_3 = pow(8.0 / 3.0, 0.5);
+    int i;
+
+    /* calculate window function for the Fourier transform */
+    for (i = 0; i < FFT_SIZE; i++) {
+        /* Hann window formula */
+        window[i] = sqrt_8_over_3 * 0.5 * (1 - cos(2.0 * PI * i / (FFT_SIZE))) / FFT_SIZE;
+    }
+}
+
+static void psycho_1_hann_fft_pickmax(const FLOAT sample[FFT_SIZE], FLOAT window[FFT_SIZE],
+                                      mask_spectrum * power, FLOAT spike[SBLIMIT],
+                                      FLOAT energy[FFT_SIZE])
 {
     FLOAT x_real[FFT_SIZE];
     register int i, j;
-    register FLOAT sqrt_8_over_3;
-    static int init = 0;
-    static FLOAT window[FFT_SIZE];
     FLOAT sum;
 
-    if (!init) {
-        /* calculate window function for the Fourier transform */
-        /* These values need only be initiliased once, regardless of the caller */
-        sqrt_8_over_3 = pow(8.0 / 3.0, 0.5);
-        for (i = 0; i < FFT_SIZE; i++) {
-            /* Hann window formula */
-            window[i] = sqrt_8_over_3 * 0.5 * (1 - cos(2.0 * PI * i / (FFT_SIZE))) / FFT_SIZE;
-        }
-        init = 1;
-    }
     for (i = 0; i < FFT_SIZE; i++)
         x_real[i] = (FLOAT) (sample[i] * window[i]);
 
@@ -188,11 +210,11 @@ static void psycho_1_hann_fft_pickmax(FLOAT sample[FFT_SIZE], mask power[HAN_SIZ
 
     for (i = 0; i < HAN_SIZE; i++) {    /* calculate power density spectrum */
         if (energy[i] < 1E-20)
-            power[i].x = -200.0 + POWERNORM;
+            power->x[i] = -200.0 + POWERNORM;
         else
-            power[i].x = 10 * log10(energy[i]) + POWERNORM;
-        power[i].next = STOP;
-        power[i].type = FALSE;
+            power->x[i] = 10 * log10(energy[i]) + POWERNORM;
+        power->next[i] = STOP;
+        power->type[i] = FALSE;
     }
 
     /* Calculate the sum of spectral component in each subband from bound 4-16 */
@@ -217,15 +239,15 @@ static void psycho_1_tonal_label(psycho_1_mem * mem, int *tone)
 {
     int i, j, last = LAST, first, run, last_but_one = LAST; /* dpwe */
     FLOAT max;
-    mask *power = mem->power;
+    mask_spectrum *power = &mem->power;
 
     *tone = LAST;
     for (i = 2; i < HAN_SIZE - 12; i++) {
-        if (power[i].x > power[i - 1].x && power[i].x >= power[i + 1].x) {
-            power[i].type = TONE;
-            power[i].next = LAST;
+        if (power->x[i] > power->x[i - 1] && power->x[i] >= power->x[i + 1]) {
+            power->type[i] = TONE;
+            power->next[i] = LAST;
             if (last != LAST)
-                power[last].next = i;
+                power->next[last] = i;
             else
                 first = *tone = i;
             last = i;
@@ -245,45 +267,45 @@ static void psycho_1_tonal_label(psycho_1_mem * mem, int *tone)
             run = 6;            /* the tonal components */
         else
             run = 12;
-        max = power[first].x - 7;   /* after calculation of tonal */
+        max = power->x[first] - 7;   /* after calculation of tonal */
         for (j = 2; j <= run; j++)  /* components, set to local max */
-            if (max < power[first - j].x || max < power[first + j].x) {
-                power[first].type = FALSE;
+            if (max < power->x[first - j] || max < power->x[first + j]) {
+                power->type[first] = FALSE;
                 break;
             }
-        if (power[first].type == TONE) {    /* extract tonal components */
+        if (power->type[first] == TONE) {    /* extract tonal components */
             int help = first;
             if (*tone == LAST)
                 *tone = first;
-            while ((power[help].next != LAST) && (power[help].next - first) <= run)
-                help = power[help].next;
-            help = power[help].next;
-            power[first].next = help;
+            while ((power->next[help] != LAST) && (power->next[help] - first) <= run)
+                help = power->next[help];
+            help = power->next[help];
+            power->next[first] = help;
             if ((first - last) <= run) {
                 if (last_but_one != LAST)
-                    power[last_but_one].next = first;
+                    power->next[last_but_one] = first;
             }
             if (first > 1 && first < 500) { /* calculate the sum of the */
                 FLOAT tmp;      /* powers of the components */
-                tmp = add_db(mem, power[first - 1].x, power[first + 1].x);
-                power[first].x = add_db(mem, power[first].x, tmp);
+                tmp = add_db(mem, power->x[first - 1], power->x[first + 1]);
+                power->x[first] = add_db(mem, power->x[first], tmp);
             }
             for (j = 1; j <= run; j++) {
-                power[first - j].x = power[first + j].x = DBMIN;
-                power[first - j].next = power[first + j].next = STOP;
-                power[first - j].type = power[first + j].type = FALSE;
+                power->x[first - j] = power->x[first + j] = DBMIN;
+                power->next[first - j] = power->next[first + j] = STOP;
+                power->type[first - j] = power->type[first + j] = FALSE;
             }
             last_but_one = last;
             last = first;
-            first = power[first].next;
+            first = power->next[first];
         } else {
             int ll;
-            if (last == LAST);  /* *tone = power[first].next; dpwe */
+            if (last == LAST);  /* *tone = power->next[first]; dpwe */
             else
-                power[last].next = power[first].next;
+                power->next[last] = power->next[first];
             ll = first;
-            first = power[first].next;
-            power[ll].next = STOP;
+            first = power->next[first];
+            power->next[ll] = STOP;
         }
     }
 }
@@ -302,18 +324,18 @@ static void psycho_1_noise_label(psycho_1_mem * mem, int *noise, FLOAT energy[FF
     FLOAT index, weight, sum;
     int crit_band = mem->crit_band;
     int *cbound = mem->cbound;
-    mask *power = mem->power;
+    mask_spectrum *power = &mem->power;
     /* calculate the remaining spectral */
     for (i = 0; i < crit_band - 1; i++) {   /* lines for non-tonal components */
         for (j = cbound[i], weight = 0.0, sum = DBMIN; j < cbound[i + 1]; j++) {
-            if (power[j].type != TONE) {
-                if (power[j].x != DBMIN) {
-                    sum = add_db(mem, power[j].x, sum);
+            if (power->type[j] != TONE) {
+                if (power->x[j] != DBMIN) {
+                    sum = add_db(mem, power->x[j], sum);
                     /* Weight is used in finding the geometric mean of the noise energy within a
                        subband */
                     weight += CF * energy[j] * (FLOAT) (j - cbound[i]) / (FLOAT) (cbound[i + 1] - cbound[i]);   /* correction 
                                                                                                                  */
-                    power[j].x = DBMIN;
+                    power->x[j] = DBMIN;
                 }
             }                   /* check to see if the spectral line is low dB, and if */
         }                       /* so replace the center of the critical band, which is */
@@ -333,8 +355,8 @@ static void psycho_1_noise_label(psycho_1_mem * mem, int *noise, FLOAT energy[FF
         /* add to list of non-tonal components */
 
         /* Masahiro Iwadare's fix for infinite looping problem? */
-        if (power[centre].type == TONE) {
-            if (power[centre + 1].type == TONE) {
+        if (power->type[centre] == TONE) {
+            if (power->type[centre + 1] == TONE) {
                 centre++;
             } else
                 centre--;
@@ -343,11 +365,11 @@ static void psycho_1_noise_label(psycho_1_mem * mem, int *noise, FLOAT energy[FF
         if (last == LAST)
             *noise = centre;
         else {
-            power[centre].next = LAST;
-            power[last].next = centre;
+            power->next[centre] = LAST;
+            power->next[last] = centre;
         }
-        power[centre].x = sum;
-        power[centre].type = NOISE;
+        power->x[centre] = sum;
+        power->type[centre] = NOISE;
         last = centre;
     }
 }
@@ -359,7 +381,7 @@ static void psycho_1_noise_label(psycho_1_mem * mem, int *noise, FLOAT energy[FF
 *
 ****************************************************************/
 
-static void psycho_1_subsampling(mask power[HAN_SIZE], g_thres * ltg, int *tone, int *noise)
+static void psycho_1_subsampling(mask_spectrum * power, g_thres * ltg, int *tone, int *noise)
 {
     int i, old;
 
@@ -367,55 +389,55 @@ static void psycho_1_subsampling(mask power[HAN_SIZE], g_thres * ltg, int *tone,
     old = STOP;                 /* calculate tonal components for */
 
     while ((i != LAST) && (i != STOP)) {    /* reduction of spectral lines */
-        if (power[i].x < ltg[power[i].map].hear) {
-            power[i].type = FALSE;
-            power[i].x = DBMIN;
+        if (power->x[i] < ltg[power->map[i]].hear) {
+            power->type[i] = FALSE;
+            power->x[i] = DBMIN;
             if (old == STOP)
-                *tone = power[i].next;
+                *tone = power->next[i];
             else
-                power[old].next = power[i].next;
+                power->next[old] = power->next[i];
         } else
             old = i;
-        i = power[i].next;
+        i = power->next[i];
     }
     i = *noise;
     old = STOP;                 /* calculate non-tonal components for */
     while ((i != LAST) && (i != STOP)) {    /* reduction of spectral lines */
-        if (power[i].x < ltg[power[i].map].hear) {
-            power[i].type = FALSE;
-            power[i].x = DBMIN;
+        if (power->x[i] < ltg[power->map[i]].hear) {
+            power->type[i] = FALSE;
+            power->x[i] = DBMIN;
             if (old == STOP)
-                *noise = power[i].next;
+                *noise = power->next[i];
             else
-                power[old].next = power[i].next;
+                power->next[old] = power->next[i];
         } else
             old = i;
-        i = power[i].next;
+        i = power->next[i];
     }
     i = *tone;
     old = STOP;
     while ((i != LAST) && (i != STOP)) {    /* if more than one */
-        if (power[i].next == LAST)
+        if (power->next[i] == LAST)
             break;              /* tonal component */
-        if (ltg[power[power[i].next].map].bark -    /* is less than .5 */
-            ltg[power[i].map].bark < 0.5) { /* bark, take the */
-            if (power[power[i].next].x > power[i].x) {  /* maximum */
+        if (ltg[power->map[power->next[i]]].bark -    /* is less than .5 */
+            ltg[power->map[i]].bark < 0.5) { /* bark, take the */
+            if (power->x[power->next[i]] > power->x[i]) {  /* maximum */
                 if (old == STOP)
-                    *tone = power[i].next;
+                    *tone = power->next[i];
                 else
-                    power[old].next = power[i].next;
-                power[i].type = FALSE;
-                power[i].x = DBMIN;
-                i = power[i].next;
+                    power->next[old] = power->next[i];
+                power->type[i] = FALSE;
+                power->x[i] = DBMIN;
+                i = power->next[i];
             } else {
-                power[power[i].next].type = FALSE;
-                power[power[i].next].x = DBMIN;
-                power[i].next = power[power[i].next].next;
+                power->type[power->next[i]] = FALSE;
+                power->x[power->next[i]] = DBMIN;
+                power->next[i] = power->next[power->next[i]];
                 old = i;
             }
         } else {
             old = i;
-            i = power[i].next;
+            i = power->next[i];
         }
     }
 }
@@ -427,58 +449,40 @@ static void psycho_1_subsampling(mask power[HAN_SIZE], g_thres * ltg, int *tone,
 *
 ****************************************************************/
 
+/* Copy the components in a list into a compact array of maskers */
+static void psycho_1_collect(mask_spectrum * power, g_thres * ltg, int first, int type,
+                             masker_list * list)
+{
+    int t;
+
+    masking_clear(list);
+    for (t = first; (t != LAST) && (t != STOP); t = power->next[t])
+        masking_add(list, t, power->x[t], ltg[power->map[t]].bark, type);
+}
+
+
 /* mainly just changed the way range checking was done MFC Nov 1999 */
 static void psycho_1_threshold(psycho_1_mem * mem, int *tone, int *noise, int bit_rate)
 {
-    int sub_size = mem->sub_size;
-    mask *power = mem->power;
+    int used_size = mem->used_size;
     g_thres *ltg = mem->ltg;
-    int k, t;
-    FLOAT dz, tmps, vf;
-
-    for (k = 1; k < sub_size; k++) {
-        ltg[k].x = DBMIN;
-        t = *tone;              /* calculate individual masking threshold for */
-        while ((t != LAST) && (t != STOP)) {    /* components in order to find the global */
-            dz = ltg[k].bark - ltg[power[t].map].bark;  /* distance of bark value */
-            if (dz >= -3.0 && dz < 8.0) {
-                tmps = -1.525 - 0.275 * ltg[power[t].map].bark - 4.5 + power[t].x;
-                /* masking function for lower & upper slopes */
-                if (dz < -1)
-                    vf = 17 * (dz + 1) - (0.4 * power[t].x + 6);
-                else if (dz < 0)
-                    vf = (0.4 * power[t].x + 6) * dz;
-                else if (dz < 1)
-                    vf = (-17 * dz);
-                else
-                    vf = -(dz - 1) * (17 - 0.15 * power[t].x) - 17;
-                ltg[k].x = add_db(mem, ltg[k].x, tmps + vf);
-            }
-            t = power[t].next;
-        }
+    int k;
 
-        t = *noise;             /* calculate individual masking threshold */
-        while ((t != LAST) && (t != STOP)) {    /* for non-tonal components to find LTG */
-            dz = ltg[k].bark - ltg[power[t].map].bark;  /* distance of bark value */
-            if (dz >= -3.0 && dz < 8.0) {
-                tmps = -1.525 - 0.175 * ltg[power[t].map].bark - 0.5 + power[t].x;
-                /* masking function for lower & upper slopes */
-                if (dz < -1)
-                    vf = 17 * (dz + 1) - (0.4 * power[t].x + 6);
-                else if (dz < 0)
-                    vf = (0.4 * power[t].x + 6) * dz;
-                else if (dz < 1)
-                    vf = (-17 * dz);
-                else
-                    vf = -(dz - 1) * (17 - 0.15 * power[t].x) - 17;
-                ltg[k].x = add_db(mem, ltg[k].x, tmps + vf);
-            }
-            t = power[t].next;
-        }
+    psycho_1_collect(&mem->power, ltg, *tone, TONE, &mem->tonal);
+    psycho_1_collect(&mem->power, ltg, *noise, NOISE, &mem->noise);
+
+    /* calculate individual masking threshold for tonal and then
+       non-tonal components in order to find the global threshold */
+    for (k = 1; k < used_size; k++)
+        mem->thres[k] = DBMIN;
+    masking_threshold(mem->dbtable, &mem->tonal, &mem->bark[1], used_size - 1, &mem->thres[1]);
+    masking_threshold(mem->dbtable, &mem->noise, &mem->bark[1], used_size - 1, &mem->thres[1]);
+
+    for (k = 1; k < used_size; k++) {
         if (bit_rate < 96)
-            ltg[k].x = add_db(mem, ltg[k].hear, ltg[k].x);
+            ltg[k].x = add_db(mem, ltg[k].hear, mem->thres[k]);
         else
-            ltg[k].x = add_db(mem, ltg[k].hear - 12.0, ltg[k].x);
+            ltg[k].x = add_db(mem, ltg[k].hear - 12.0, mem->thres[k]);
     }
 
 }
@@ -534,105 +538,96 @@ static void psycho_1_smr(FLOAT ltmin[SBLIMIT], FLOAT spike[SBLIMIT], FLOAT scale
 
 
 /*
-static void psycho_1_dump(mask power[HAN_SIZE], int *tone, int *noise) {
+static void psycho_1_dump(mask_spectrum *power, int *tone, int *noise) {
   int t;
 
   fprintf(stderr,"1 Ton: ");
   t=*tone;
   while (t!=LAST && t!=STOP) {
-	fprintf(stderr,"[%i] %3.0f ",t, power[t].x);
-	t = power[t].next;
+	fprintf(stderr,"[%i] %3.0f ",t, power->x[t]);
+	t = power->next[t];
   }
   fprintf(stderr,"\n");
   
   fprintf(stderr,"1 Nos: ");
   t=*noise;
   while (t!=LAST && t!=STOP) {
-	fprintf(stderr,"[%i] %3.0f ",t, power[t].x);
-	t = power[t].next;
+	fprintf(stderr,"[%i] %3.0f ",t, power->x[t]);
+	t = power->next[t];
   }
   fprintf(stderr,"\n");
 }
 */
 
 
-void psycho_1(twolame_options * glopts, short buffer[2][1152], FLOAT scale[2][SBLIMIT],
-              FLOAT ltmin[2][SBLIMIT])
+static psycho_1_mem *psycho_1_init(twolame_options * glopts)
 {
-    psycho_1_mem *mem;
     frame_header *header = &glopts->header;
-    int nch = glopts->num_channels_out;
-    int sblimit = glopts->sblimit;
-    int k, i, tone = 0, noise = 0;
-    FLOAT sample[FFT_SIZE];
-    FLOAT spike[2][SBLIMIT];
-    FLOAT *fft_buf[2];
-    FLOAT energy[FFT_SIZE];
+    psycho_1_mem *mem;
 
     /* call functions for critical boundaries, freq. */
-    if (!glopts->p1mem) {       /* bands, bark values, and mapping */
-        mem = (psycho_1_mem *) TWOLAME_MALLOC(sizeof(psycho_1_mem));
-
-        mem->power = (mask_ptr) TWOLAME_MALLOC(sizeof(mask) * HAN_SIZE);
-        if (header->version == TWOLAME_MPEG1) {
-            mem->cbound =
-                psycho_1_read_cbound(header->lay, header->samplerate_idx, &mem->crit_band);
-            psycho_1_read_freq_band(&mem->ltg, header->lay, header->samplerate_idx, &mem->sub_size);
-        } else {
-            mem->cbound =
-                psycho_1_read_cbound(header->lay, header->samplerate_idx + 4, &mem->crit_band);
-            psycho_1_read_freq_band(&mem->ltg, header->lay, header->samplerate_idx + 4,
-                                    &mem->sub_size);
-        }
-        psycho_1_make_map(mem->sub_size, mem->power, mem->ltg);
-        for (i = 0; i < 1408; i++)
-            mem->fft_buf[0][i] = mem->fft_buf[1][i] = 0;
-
-        psycho_1_init_add_db(mem);  /* create the add_db table */
-
-        mem->off[0] = 256;
-        mem->off[1] = 256;
-
-        glopts->p1mem = mem;
+    mem = (psycho_1_mem *) TWOLAME_MALLOC(sizeof(psycho_1_mem));
+
+    /* bands, bark values, and mapping */
+    if (header->version == TWOLAME_MPEG1) {
+        mem->cbound = psycho_1_read_cbound(header->lay, header->samplerate_idx, &mem->crit_band);
+        psycho_1_read_freq_band(&mem->ltg, header->lay, header->samplerate_idx, &mem->sub_size);
+    } else {
+        mem->cbound =
+            psycho_1_read_cbound(header->lay, header->samplerate_idx + 4, &mem->crit_band);
+        psycho_1_read_freq_band(&mem->ltg, header->lay, header->samplerate_idx + 4,
+                                &mem->sub_size);
     }
-    {
-        mem = glopts->p1mem;
+    psycho_1_make_map(mem->sub_size, &mem->power, mem->ltg);
+    psycho_1_init_bark(mem);
+    psycho_1_init_used_size(mem, glopts->sblimit);
+    psycho_1_init_window(mem->window);
+    psycho_1_init_add_db(mem);  /* create the add_db table */
 
-        fft_buf[0] = mem->fft_buf[0];
-        fft_buf[1] = mem->fft_buf[1];
-    }
+    return mem;
+}
 
 
-    for (k = 0; k < nch; k++) {
-        /* check pcm input for 3 blocks of 384 samples */
-        /* sami's speedup, added in 02j saves about 4% overall during an encode */
-        int ok = mem->off[k] % 1408;
-        for (i = 0; i < 1152; i++) {
-            fft_buf[k][ok++] = (FLOAT) buffer[k][i] / SCALE;
-            if (ok >= 1408)
-                ok = 0;
-        }
-        ok = (mem->off[k] + 1216) % 1408;
-        for (i = 0; i < FFT_SIZE; i++) {
-            sample[i] = fft_buf[k][ok++];
-            if (ok >= 1408)
-                ok = 0;
-        }
-        mem->off[k] += 1152;
-        mem->off[k] %= 1408;
+/* Run the model for channel k only, using (and if need be creating) *memp */
+void psycho_1_channel(twolame_options * glopts, psycho_1_mem ** memp, int k,
+                      FLOAT * hist[2], FLOAT scale[2][SBLIMIT], FLOAT ltmin[2][SBLIMIT])
+{
+    psycho_1_mem *mem;
+    int nch = glopts->num_channels_out;
+    int sblimit = glopts->sblimit;
+    int tone = 0, noise = 0;
+    FLOAT spike[SBLIMIT];
+    FLOAT energy[FFT_SIZE];
+
+    if (!*memp)
+        *memp = psycho_1_init(glopts);
+    mem = *memp;
 
-        psycho_1_hann_fft_pickmax(sample, mem->power, &spike[k][0], energy);
+    {
+        /* The FFT window starts 192 samples before the frame,
+           and is read straight from the analysis history */
+        psycho_1_hann_fft_pickmax(hist[k] - 192, mem->window, &mem->power, spike, energy);
         psycho_1_tonal_label(mem, &tone);
         psycho_1_noise_label(mem, &noise, energy);
         // psycho_1_dump(power, &tone, &noise) ;
-        psycho_1_subsampling(mem->power, mem->ltg, &tone, &noise);
+        psycho_1_subsampling(&mem->power, mem->ltg, &tone, &noise);
         psycho_1_threshold(mem, &tone, &noise, glopts->bitrate / nch);
         psycho_1_minimum_mask(mem->sub_size, mem->ltg, &ltmin[k][0], sblimit);
-        psycho_1_smr(&ltmin[k][0], &spike[k][0], &scale[k][0], sblimit);
+        psycho_1_smr(&ltmin[k][0], spike, &scale[k][0], sblimit);
     }
 
 }
 
+
+void psycho_1(twolame_options * glopts, FLOAT * hist[2], FLOAT scale[2][SBLIMIT],
+              FLOAT ltmin[2][SBLIMIT])
+{
+    int k;
+
+    for (k = 0; k < glopts->num_channels_out; k++)
+        psycho_1_channel(glopts, &glopts->p1mem, k, hist, scale, ltmin);
+}
+
 void psycho_1_deinit(psycho_1_mem ** mem)
 {
 
@@ -641,7 +636,8 @@ void psycho_1_deinit(psycho_1_mem ** mem)
 
     TWOLAME_FREE((*mem)->cbound);
     TWOLAME_FREE((*mem)->ltg);
-    TWOLAME_FREE((*mem)->power);
+    TWOLAME_FREE((*mem)->bark);
+    TWOLAME_FREE((*mem)->thres);
     TWOLAME_FREE((*mem));
 }
 
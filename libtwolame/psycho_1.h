@@ -25,8 +25,10 @@
 #ifndef TWOLAME_PSYCHO_1_H
 #define TWOLAME_PSYCHO_1_H
 
-void psycho_1(twolame_options * glopts, short int buffer[2][1152], FLOAT scale[2][32],
+void psycho_1(twolame_options * glopts, FLOAT * hist[2], FLOAT scale[2][32],
               FLOAT ltmin[2][32]);
+void psycho_1_channel(twolame_options * glopts, psycho_1_mem ** memp, int k,
+                      FLOAT * hist[2], FLOAT scale[2][32], FLOAT ltmin[2][32]);
 void psycho_1_deinit(psycho_1_mem ** mem);
 
 #endif
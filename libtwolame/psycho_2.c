@@ -32,6 +32,7 @@
 #include "common.h"
 #include "mem.h"
 #include "fft.h"
+#include "spread.h"
 #include "psycho_2.h"
 
 /* The static variables "r", "phi_sav", "new", "old" and "oldest" have	  */
@@ -105,11 +106,6 @@ psycho_2_mem *psycho_2_init(twolame_options * glopts, int sfreq)
         mem->r = (F2HBLK *) TWOLAME_MALLOC(sizeof(F22HBLK));
         mem->phi_sav = (F2HBLK *) TWOLAME_MALLOC(sizeof(F22HBLK));
 
-        // static int new = 0, old = 1, oldest = 0;
-        mem->new = 0;
-        mem->old = 1;
-        mem->oldest = 0;
-
         mem->flush = (int) (384 * 3.0 / 2.0);
         mem->syncsize = 1056;
         mem->sync_flush = mem->syncsize - mem->flush;
@@ -151,14 +147,7 @@ psycho_2_mem *psycho_2_init(twolame_options * glopts, int sfreq)
     /* for(i=0;i<BLKSIZE;i++)window[i]=0.5*(1-cos(2.0*PI*i/(BLKSIZE-1.0))); */
     for (i = 0; i < BLKSIZE; i++)
         window[i] = 0.5 * (1 - cos(2.0 * PI * (i - 0.5) / BLKSIZE));
-    /* reset states used in unpredictability measure */
-    for (i = 0; i < HBLKSIZE; i++) {
-        mem->r[0][0][i] = mem->r[1][0][i] = mem->r[0][1][i] = mem->r[1][1][i] = 0;
-        mem->phi_sav[0][0][i] = mem->phi_sav[1][0][i] = 0;
-        mem->phi_sav[0][1][i] = mem->phi_sav[1][1][i] = 0;
-        mem->lthr[0][i] = 60802371420160.0;
-        mem->lthr[1][i] = 60802371420160.0;
-    }
+    psycho_2_reset(mem);
   /*****************************************************************************
    * Initialization: Compute the following constants for use later			   *
    *	partition[HBLKSIZE] = the partition number associated with each		   *
@@ -234,6 +223,8 @@ psycho_2_mem *psycho_2_init(twolame_options * glopts, int sfreq)
             rnorm[j] += s[j][i];
         }
     }
+    spread_init(mem);
+    spread_cutoff(mem, glopts->sblimit);
 
     if (glopts->verbosity > 5) {
         /* Dump All the Values to stderr and exit */
@@ -251,11 +242,48 @@ psycho_2_mem *psycho_2_init(twolame_options * glopts, int sfreq)
     return (mem);
 }
 
-void psycho_2(twolame_options * glopts, short int buffer[2][1152],
-              short int savebuf[2][1056], FLOAT smr[2][32])
+/* Run the model for channel ch only, using (and if need be creating) *memp */
+/*
+  Fill wsamp_r with the windowed samples for pass run (0 or 1) of psycho
+  models 2 and 4. frame points at the frame in the analysis history.
+
+  The first 480 samples of the window are the end of the previous pass's
+  1056 sample buffer: silence on the first pass, samples 96-575 of the
+  frame on the second. The other 544 are the first 544 samples of the
+  frame on both passes, so they are only windowed once, on the first
+  pass, and kept in wsamp_tail for the second.
+
+  With single_run there is just one pass, on a window centred between
+  the two (the same window as psycho model 1 uses).
+*/
+void psycho_2_window(psycho_2_mem * mem, const FLOAT * frame, int run, int single_run)
+{
+    FLOAT *wsamp_r = mem->wsamp_r;
+    FLOAT *window = mem->window;
+    int j;
+
+    if (single_run) {
+        for (j = 0; j < BLKSIZE; j++)
+            wsamp_r[j] = window[j] * (frame[j - 192] * SCALE);
+    } else if (run == 0) {
+        for (j = 0; j < 480; j++)
+            wsamp_r[j] = 0.0;
+        for (; j < BLKSIZE; j++)
+            wsamp_r[j] = window[j] * (frame[j - 480] * SCALE);
+        memcpy(mem->wsamp_tail, &wsamp_r[480], sizeof(mem->wsamp_tail));
+    } else {
+        for (j = 0; j < 480; j++)
+            wsamp_r[j] = window[j] * (frame[j + 576 - 480] * SCALE);
+        memcpy(&wsamp_r[480], mem->wsamp_tail, sizeof(mem->wsamp_tail));
+    }
+}
+
+
+void psycho_2_channel(twolame_options * glopts, psycho_2_mem ** memp, unsigned int ch,
+                      FLOAT * hist[2], FLOAT smr[2][32])
 {
     psycho_2_mem *mem;
-    unsigned int i, j, k, ch;
+    unsigned int i, j, k;
     int new, old, oldest;
     FLOAT r_prime, phi_prime;
     FLOAT minthres, sum_energy;
@@ -263,7 +291,7 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
     FLOAT *grouped_c, *grouped_e;
     FLOAT *nb, *cb, *ecb, *bc;
     FLOAT *cbval, *rnorm;
-    FLOAT *wsamp_r, *phi, *energy, *window;
+    FLOAT *wsamp_r, *phi, *energy;
     FLOAT *c;
     FLOAT *fthr;
 
@@ -271,19 +299,17 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
     int *numlines;
     int *partition;
     FLOAT *tmn;
-    FCB *s;
     FHBLK *lthr;
     F2HBLK *r, *phi_sav;
     FLOAT *absthr;
 
-    int nch = glopts->num_channels_out;
     int sfreq = glopts->samplerate_out;
 
 
-    if (!glopts->p2mem) {
-        glopts->p2mem = psycho_2_init(glopts, sfreq);
+    if (!*memp) {
+        *memp = psycho_2_init(glopts, sfreq);
     }
-    mem = glopts->p2mem;
+    mem = *memp;
     {
         grouped_c = mem->grouped_c;
         grouped_e = mem->grouped_e;
@@ -296,7 +322,6 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
         wsamp_r = mem->wsamp_r;
         phi = mem->phi;
         energy = mem->energy;
-        window = mem->window;
         c = mem->c;
 
         snrtmp[0] = mem->snrtmp[0];
@@ -305,7 +330,6 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
         numlines = mem->numlines;
         partition = mem->partition;
         tmn = mem->tmn;
-        s = mem->s;
         lthr = mem->lthr;
         r = mem->r;
         phi_sav = mem->phi_sav;
@@ -314,8 +338,10 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
     }
 
 
-    for (ch = 0; ch < nch; ch++) {
-        for (i = 0; i < 2; i++) {
+    {
+        unsigned int runs = glopts->psy_single_run ? 1 : 2;
+
+        for (i = 0; i < runs; i++) {
       /*****************************************************************************
 	   * Net offset is 480 samples (1056-576) for layer 2; this is because one must*
 	   * stagger input data by 256 samples to synchronize psychoacoustic model with*
@@ -327,19 +353,7 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
 		   sync_flush = syncsize - flush;	480
 		   BLKSIZE = 1024
 	   *****************************************************************************/
-            {
-                short int *bufferp = buffer[ch];
-                for (j = 0; j < 480; j++) {
-                    savebuf[ch][j] = savebuf[ch][j + mem->flush];
-                    wsamp_r[j] = window[j] * ((FLOAT) savebuf[ch][j]);
-                }
-                for (; j < 1024; j++) {
-                    savebuf[ch][j] = *bufferp++;
-                    wsamp_r[j] = window[j] * ((FLOAT) savebuf[ch][j]);
-                }
-                for (; j < 1056; j++)
-                    savebuf[ch][j] = *bufferp++;
-            }
+            psycho_2_window(mem, hist[ch], i, glopts->psy_single_run);
 
       /**Compute FFT****************************************************************/
             psycho_2_fft(wsamp_r, energy, phi);
@@ -368,7 +382,7 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
             }
 
 
-            for (j = 0; j < HBLKSIZE; j++) {
+            for (j = 0; j < mem->c_lines; j++) {
                 r_prime = 2.0 * r[ch][old][j] - r[ch][oldest][j];
                 phi_prime = 2.0 * phi_sav[ch][old][j] - phi_sav[ch][oldest][j];
                 r[ch][new][j] = sqrt((FLOAT) energy[j]);
@@ -405,7 +419,7 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
             }
             grouped_e[0] = energy[0];
             grouped_c[0] = energy[0] * c[0];
-            for (j = 1; j < HBLKSIZE; j++) {
+            for (j = 1; j < mem->c_lines; j++) {
                 grouped_e[partition[j]] += energy[j];
                 grouped_c[partition[j]] += energy[j] * c[j];
             }
@@ -414,26 +428,13 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
 	   * convolve the grouped energy-weighted unpredictability measure			   *
 	   * and the grouped energy with the spreading function, s[j][k]			   *
 	   *****************************************************************************/
-            for (j = 0; j < CBANDS; j++) {
-                ecb[j] = 0;
-                cb[j] = 0;
-                for (k = 0; k < CBANDS; k++) {
-                    if (s[j][k] != 0.0) {
-                        ecb[j] += s[j][k] * grouped_e[k];
-                        cb[j] += s[j][k] * grouped_c[k];
-                    }
-                }
-                if (ecb[j] != 0)
-                    cb[j] = cb[j] / ecb[j];
-                else
-                    cb[j] = 0;
-            }
+            spread_convolve(mem);
 
       /*****************************************************************************
 	   * Calculate the required SNR for each of the frequency partitions		   *
 	   *		 this whole section can be accomplished by a table lookup		   *
 	   *****************************************************************************/
-            for (j = 0; j < CBANDS; j++) {
+            for (j = 0; j < mem->used_bands; j++) {
                 if (cb[j] < .05)
                     cb[j] = 0.05;
                 else if (cb[j] > .5)
@@ -451,12 +452,12 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
 	   * partitions. Include absolute threshold and pre-echo controls			   *
 	   *		 this whole section can be accomplished by a table lookup		   *
 	   *****************************************************************************/
-            for (j = 0; j < CBANDS; j++)
+            for (j = 0; j < mem->used_bands; j++)
                 if (rnorm[j] && numlines[j])
                     nb[j] = ecb[j] * bc[j] / (rnorm[j] * numlines[j]);
                 else
                     nb[j] = 0;
-            for (j = 0; j < HBLKSIZE; j++) {
+            for (j = 0; j < mem->used_lines; j++) {
                 /* temp1 is the preliminary threshold */
                 temp1 = nb[partition[j]];
                 temp1 = (temp1 > absthr[j]) ? temp1 : absthr[j];
@@ -479,7 +480,7 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
       /*****************************************************************************
 	   * Translate the 512 threshold values to the 32 filter bands of the coder	   *
 	   *****************************************************************************/
-            for (j = 0; j < 193; j += 16) {
+            for (j = 0; j < 193 && j + 16 < mem->used_lines; j += 16) {
                 minthres = 60802371420160.0;
                 sum_energy = 0.0;
                 for (k = 0; k < 17; k++) {
@@ -490,7 +491,7 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
                 snrtmp[i][j / 16] = sum_energy / (minthres * 17.0);
                 snrtmp[i][j / 16] = 4.342944819 * log((FLOAT) snrtmp[i][j / 16]);
             }
-            for (j = 208; j < (HBLKSIZE - 1); j += 16) {
+            for (j = 208; j < mem->used_lines - 1; j += 16) {
                 minthres = 0.0;
                 sum_energy = 0.0;
                 for (k = 0; k < 17; k++) {
@@ -500,16 +501,53 @@ void psycho_2(twolame_options * glopts, short int buffer[2][1152],
                 snrtmp[i][j / 16] = sum_energy / minthres;
                 snrtmp[i][j / 16] = 4.342944819 * log((FLOAT) snrtmp[i][j / 16]);
             }
+            /* The subbands above sblimit aren't coded */
+            for (j = mem->used_lines - 1; j < HBLKSIZE - 1; j += 16)
+                snrtmp[i][j / 16] = 0;
       /*****************************************************************************
 	   * End of Psychoacuostic calculation loop									   *
 	   *****************************************************************************/
         }
         for (i = 0; i < 32; i++) {
-            smr[ch][i] = (snrtmp[0][i] > snrtmp[1][i]) ? snrtmp[0][i] : snrtmp[1][i];
+            if (runs == 1)
+                smr[ch][i] = snrtmp[0][i];
+            else
+                smr[ch][i] = (snrtmp[0][i] > snrtmp[1][i]) ? snrtmp[0][i] : snrtmp[1][i];
         }
 
-    }                           // next channel
+    }
+
+}
+
+
+void psycho_2(twolame_options * glopts, FLOAT * hist[2], FLOAT smr[2][32])
+{
+    unsigned int ch;
+
+    for (ch = 0; ch < glopts->num_channels_out; ch++)
+        psycho_2_channel(glopts, &glopts->p2mem, ch, hist, smr);
+}
+
+/* Reset the states used in the unpredictability measure */
+void psycho_2_reset(psycho_2_mem * mem)
+{
+    int i;
+
+    if (mem == NULL)
+        return;
+
+    // static int new = 0, old = 1, oldest = 0;
+    mem->new = 0;
+    mem->old = 1;
+    mem->oldest = 0;
 
+    for (i = 0; i < HBLKSIZE; i++) {
+        mem->r[0][0][i] = mem->r[1][0][i] = mem->r[0][1][i] = mem->r[1][1][i] = 0;
+        mem->phi_sav[0][0][i] = mem->phi_sav[1][0][i] = 0;
+        mem->phi_sav[0][1][i] = mem->phi_sav[1][1][i] = 0;
+        mem->lthr[0][i] = 60802371420160.0;
+        mem->lthr[1][i] = 60802371420160.0;
+    }
 }
 
 void psycho_2_deinit(psycho_2_mem ** mem)
@@ -520,6 +558,7 @@ void psycho_2_deinit(psycho_2_mem ** mem)
 
     TWOLAME_FREE((*mem)->tmn);
     TWOLAME_FREE((*mem)->s);
+    TWOLAME_FREE((*mem)->spread);
     TWOLAME_FREE((*mem)->lthr);
     TWOLAME_FREE((*mem)->r);
     TWOLAME_FREE((*mem)->phi_sav);
@@ -26,8 +26,11 @@
 #define TWOLAME_PSYCHO_2_H
 
 psycho_2_mem *psycho_2_init(twolame_options * glopts, int sfreq);
-void psycho_2(twolame_options * glopts, short int buffer[2][1152], short int savebuf[2][1056],
-              FLOAT smr[2][32]);
+void psycho_2(twolame_options * glopts, FLOAT * hist[2], FLOAT smr[2][32]);
+void psycho_2_channel(twolame_options * glopts, psycho_2_mem ** memp, unsigned int ch,
+                      FLOAT * hist[2], FLOAT smr[2][32]);
+void psycho_2_window(psycho_2_mem * mem, const FLOAT * frame, int run, int single_run);
+void psycho_2_reset(psycho_2_mem * mem);
 void psycho_2_deinit(psycho_2_mem ** mem);
 
 #endif
@@ -32,6 +32,7 @@
 #include "mem.h"
 #include "fft.h"
 #include "ath.h"
+#include "masking.h"
 #include "psycho_3.h"
 
 /* This is a reimplementation of psy model 1 using the ISO11172 standard.
@@ -70,20 +71,21 @@ static inline FLOAT psycho_3_add_db(psycho_3_mem * mem, FLOAT a, FLOAT b)
 
 
 /* ISO11172 Sec D.1 Step 1 - Window with HANN and then perform the FFT */
-static void psycho_3_fft(FLOAT sample[BLKSIZE], FLOAT energy[BLKSIZE])
+static void psycho_3_init_window(FLOAT window[BLKSIZE])
 {
-    FLOAT x_real[BLKSIZE];
+    /* calculate window function for the Fourier transform */
+    FLOAT sqrt_8_over_3 = pow(8.0 / 3.0, 0.5);
     int i;
-    static int init = 0;
-    static FLOAT window[FFT_SIZE];
 
-    if (!init) {                /* calculate window function for the Fourier transform */
-        FLOAT sqrt_8_over_3 = pow(8.0 / 3.0, 0.5);
-        for (i = 0; i < BLKSIZE; i++) {
-            window[i] = sqrt_8_over_3 * 0.5 * (1 - cos(2.0 * PI * i / (BLKSIZE))) / BLKSIZE;
-        }
-        init=1;
+    for (i = 0; i < BLKSIZE; i++) {
+        window[i] = sqrt_8_over_3 * 0.5 * (1 - cos(2.0 * PI * i / (BLKSIZE))) / BLKSIZE;
     }
+}
+
+static void psycho_3_fft(const FLOAT sample[BLKSIZE], FLOAT window[BLKSIZE], FLOAT energy[BLKSIZE])
+{
+    FLOAT x_real[BLKSIZE];
+    int i;
 
     /* convolve the samples with the hann window */
     for (i = 0; i < BLKSIZE; i++)
@@ -304,64 +306,30 @@ static void psycho_3_threshold(psycho_3_mem * mem, FLOAT * LTg, int *tonelabel,
                                int *noiselabel, FLOAT * Xnm, FLOAT * bark, FLOAT * ath,
                                int bit_rate, int *freq_subset)
 {
-    int i, j, k;
+    int used = mem->used_subset;
+    int i, k;
     FLOAT LTtm[SUBSIZE];
     FLOAT LTnm[SUBSIZE];
 
-    for (i = 0; i < SUBSIZE; i++) {
+    for (i = 0; i < used; i++) {
         LTtm[i] = DBMIN;
         LTnm[i] = DBMIN;
     }
     /* Loop over the entire spectrum and find every noise and tone And then with each noise/tone
-       work out how it masks the spectral lines around it */
+       work out how it masks the spectral lines around it (see masking.c) */
+    masking_clear(&mem->tonal);
+    masking_clear(&mem->noise);
     for (k = 1; k < HBLKSIZE; k++) {
-        /* Find every tone */
-        if (tonelabel[k] == TONE) {
-            for (j = 0; j < SUBSIZE; j++) {
-                /* figure out how it masks the levels around it */
-                FLOAT dz = bark[freq_subset[j]] - bark[k];
-                if (dz >= -3.0 && dz < 8.0) {
-                    FLOAT vf;
-                    FLOAT av = -1.525 - 0.275 * bark[k] - 4.5 + Xtm[k];
-                    /* masking function for lower & upper slopes */
-                    if (dz < -1)
-                        vf = 17 * (dz + 1) - (0.4 * Xtm[k] + 6);
-                    else if (dz < 0)
-                        vf = (0.4 * Xtm[k] + 6) * dz;
-                    else if (dz < 1)
-                        vf = (-17 * dz);
-                    else
-                        vf = -(dz - 1) * (17 - 0.15 * Xtm[k]) - 17;
-                    LTtm[j] = psycho_3_add_db(mem, LTtm[j], av + vf);
-                }
-            }
-        }
-
-        /* find every noise label */
-        if (noiselabel[k] == NOISE) {
-            for (j = 0; j < SUBSIZE; j++) {
-                /* figure out how it masks the levels around it */
-                FLOAT dz = bark[freq_subset[j]] - bark[k];
-                if (dz >= -3.0 && dz < 8.0) {
-                    FLOAT vf;
-                    FLOAT av = -1.525 - 0.175 * bark[k] - 0.5 + Xnm[k];
-                    /* masking function for lower & upper slopes */
-                    if (dz < -1)
-                        vf = 17 * (dz + 1) - (0.4 * Xnm[k] + 6);
-                    else if (dz < 0)
-                        vf = (0.4 * Xnm[k] + 6) * dz;
-                    else if (dz < 1)
-                        vf = (-17 * dz);
-                    else
-                        vf = -(dz - 1) * (17 - 0.15 * Xnm[k]) - 17;
-                    LTnm[j] = psycho_3_add_db(mem, LTnm[j], av + vf);
-                }
-            }
-        }
+        if (tonelabel[k] == TONE)
+            masking_add(&mem->tonal, k, Xtm[k], bark[k], TONE);
+        if (noiselabel[k] == NOISE)
+            masking_add(&mem->noise, k, Xnm[k], bark[k], NOISE);
     }
+    masking_threshold(mem->dbtable, &mem->tonal, mem->subset_bark, used, LTtm);
+    masking_threshold(mem->dbtable, &mem->noise, mem->subset_bark, used, LTnm);
 
     /* ISO11172 D.1 Step 7 Calculate the global masking threhold */
-    for (i = 0; i < SUBSIZE; i++) {
+    for (i = 0; i < used; i++) {
         LTg[i] = psycho_3_add_db(mem, LTnm[i], LTtm[i]);
         if (bit_rate < 96)
             LTg[i] = psycho_3_add_db(mem, ath[freq_subset[i]], LTg[i]);
@@ -372,14 +340,14 @@ static void psycho_3_threshold(psycho_3_mem * mem, FLOAT * LTg, int *tonelabel,
 
 
 /* Find the minimum LTg for each subband. ISO11172 Sec D.1 Step 8 */
-static void psycho_3_minimummasking(FLOAT * LTg, FLOAT * LTmin, int *freq_subset)
+static void psycho_3_minimummasking(FLOAT * LTg, FLOAT * LTmin, int *freq_subset, int used)
 {
     int i;
 
     for (i = 0; i < SBLIMIT; i++)
         LTmin[i] = 999999.9;
 
-    for (i = 0; i < SUBSIZE; i++) {
+    for (i = 0; i < used; i++) {
         int index = freq_subset[i] >> 4;
         if (LTmin[index] > LTg[i]) {
             LTmin[index] = LTg[i];
@@ -416,7 +384,7 @@ static psycho_3_mem *psycho_3_init(twolame_options * glopts)
     int *cbandindex;
 
     mem = (psycho_3_mem *) TWOLAME_MALLOC(sizeof(psycho_3_mem));
-    mem->off[0] = mem->off[1] = 256;
+    psycho_3_init_window(mem->window);
     freq_subset = mem->freq_subset;
     bark = mem->bark;
     ath = mem->ath;
@@ -488,6 +456,13 @@ static psycho_3_mem *psycho_3_init(twolame_options * glopts)
             freq_subset[freq_index++] = i;
         for (; i < (32 * 16) + 1; i += 8)
             freq_subset[freq_index++] = i;
+
+        for (i = 0; i < SUBSIZE; i++)
+            mem->subset_bark[i] = bark[freq_subset[i]];
+
+        /* Only the subbands up to sblimit are coded, so the masking above them isn't needed */
+        for (i = 0; i < SUBSIZE && (freq_subset[i] >> 4) < glopts->sblimit; i++);
+        mem->used_subset = (glopts->sblimit > 0) ? i : SUBSIZE;
     }
 
     if (glopts->verbosity > 4) {
@@ -523,14 +498,12 @@ static void psycho_3_dump(int *tonelabel, FLOAT * Xtm, int *noiselabel, FLOAT *
 }
 
 
-void psycho_3(twolame_options * glopts, short int buffer[2][1152], FLOAT scale[2][32],
-              FLOAT ltmin[2][32])
+/* Run the model for channel k only, using (and if need be creating) *memp */
+void psycho_3_channel(twolame_options * glopts, psycho_3_mem ** memp, int k,
+                      FLOAT * hist[2], FLOAT scale[2][32], FLOAT ltmin[2][32])
 {
     psycho_3_mem *mem;
     int nch = glopts->num_channels_out;
-    int k, i;
-    FLOAT sample[BLKSIZE];
-
     FLOAT energy[BLKSIZE];
     FLOAT power[HBLKSIZE] = {0};
     FLOAT Xtm[HBLKSIZE], Xnm[HBLKSIZE];
@@ -538,29 +511,15 @@ void psycho_3(twolame_options * glopts, short int buffer[2][1152], FLOAT scale[2
     FLOAT LTg[HBLKSIZE];
     FLOAT Lsb[SBLIMIT];
 
-    if (!glopts->p3mem) {
-        glopts->p3mem = psycho_3_init(glopts);
+    if (!*memp) {
+        *memp = psycho_3_init(glopts);
     }
-    mem = glopts->p3mem;
-
-    for (k = 0; k < nch; k++) {
-        int ok = mem->off[k] % 1408;
-        for (i = 0; i < 1152; i++) {
-            mem->fft_buf[k][ok++] = (FLOAT) buffer[k][i] / SCALE;
-            if (ok >= 1408)
-                ok = 0;
-        }
-        ok = (mem->off[k] + 1216) % 1408;
-        for (i = 0; i < BLKSIZE; i++) {
-            sample[i] = mem->fft_buf[k][ok++];
-            if (ok >= 1408)
-                ok = 0;
-        }
-
-        mem->off[k] += 1152;
-        mem->off[k] %= 1408;
+    mem = *memp;
 
-        psycho_3_fft(sample, energy);
+    {
+        /* The FFT window starts 192 samples before the frame,
+           and is read straight from the analysis history */
+        psycho_3_fft(hist[k] - 192, mem->window, energy);
         psycho_3_powerdensityspectrum(energy, power);
         psycho_3_spl(Lsb, power, &scale[k][0]);
         psycho_3_tonal_label(mem, power, tonelabel, Xtm);
@@ -570,12 +529,22 @@ void psycho_3(twolame_options * glopts, short int buffer[2][1152], FLOAT scale[2
         psycho_3_decimation(mem->ath, tonelabel, Xtm, noiselabel, Xnm, mem->bark);
         psycho_3_threshold(mem, LTg, tonelabel, Xtm, noiselabel, Xnm, mem->bark, mem->ath,
                            glopts->bitrate / nch, mem->freq_subset);
-        psycho_3_minimummasking(LTg, &ltmin[k][0], mem->freq_subset);
+        psycho_3_minimummasking(LTg, &ltmin[k][0], mem->freq_subset, mem->used_subset);
         psycho_3_smr(&ltmin[k][0], Lsb);
     }
 }
 
 
+void psycho_3(twolame_options * glopts, FLOAT * hist[2], FLOAT scale[2][32],
+              FLOAT ltmin[2][32])
+{
+    int k;
+
+    for (k = 0; k < glopts->num_channels_out; k++)
+        psycho_3_channel(glopts, &glopts->p3mem, k, hist, scale, ltmin);
+}
+
+
 void psycho_3_deinit(psycho_3_mem ** mem)
 {
 
@@ -25,8 +25,10 @@
 #ifndef TWOLAME_PSYCHO_3_H
 #define TWOLAME_PSYCHO_3_H
 
-void psycho_3(twolame_options * glopts, short int buffer[2][1152], FLOAT scale[2][32],
+void psycho_3(twolame_options * glopts, FLOAT * hist[2], FLOAT scale[2][32],
               FLOAT ltmin[2][32]);
+void psycho_3_channel(twolame_options * glopts, psycho_3_mem ** memp, int k,
+                      FLOAT * hist[2], FLOAT scale[2][32], FLOAT ltmin[2][32]);
 void psycho_3_deinit(psycho_3_mem ** mem);
 
 #endif
@@ -31,7 +31,9 @@
 #include "common.h"
 #include "mem.h"
 #include "fft.h"
+#include "spread.h"
 #include "ath.h"
+#include "psycho_2.h"
 #include "psycho_4.h"
 
 /****************************************************************
@@ -185,9 +187,7 @@ static psycho_4_mem *psycho_4_init(twolame_options * glopts, int sfreq)
         mem->r = (F2HBLK *) TWOLAME_MALLOC(sizeof(F22HBLK));
         mem->phi_sav = (F2HBLK *) TWOLAME_MALLOC(sizeof(F22HBLK));
 
-        mem->new = 0;
-        mem->old = 1;
-        mem->oldest = 0;
+        psycho_4_reset(mem);
     }
 
     {
@@ -270,6 +270,9 @@ static psycho_4_mem *psycho_4_init(twolame_options * glopts, int sfreq)
         }
     }
 
+    spread_init(mem);
+    spread_cutoff(mem, glopts->sblimit);
+
     /* Calculate Tone Masking Noise values. ISO 11172 Tables D.3.x */
     for (j = 0; j < CBANDS; j++)
         tmn[j] = MAX(15.5 + cbval[j], 24.5);
@@ -296,36 +299,35 @@ static psycho_4_mem *psycho_4_init(twolame_options * glopts, int sfreq)
 }
 
 
-void psycho_4(twolame_options * glopts,
-              short int buffer[2][1152], short int savebuf[2][1056], FLOAT smr[2][32])
+/* Run the model for channel ch only, using (and if need be creating) *memp */
+void psycho_4_channel(twolame_options * glopts, psycho_4_mem ** memp, unsigned int ch,
+                      FLOAT * hist[2], FLOAT smr[2][32])
 /* to match prototype : FLOAT args are always FLOAT */
 {
     psycho_4_mem *mem;
-    unsigned int run, i, j, k, ch;
+    unsigned int run, i, j, k;
     FLOAT r_prime, phi_prime;
     FLOAT npart, epart;
     int new, old, oldest;
     FLOAT *grouped_c, *grouped_e;
     FLOAT *nb, *cb, *tb, *ecb, *bc;
     FLOAT *cbval, *rnorm;
-    FLOAT *wsamp_r, *phi, *energy, *window;
+    FLOAT *wsamp_r, *phi, *energy;
     FLOAT *ath, *thr, *c;
 
     FLOAT *snrtmp[2];
     int *numlines;
     int *partition;
     FLOAT *tmn;
-    FCB *s;
     F2HBLK *r, *phi_sav;
 
-    int nch = glopts->num_channels_out;
     int sfreq = glopts->samplerate_out;
 
-    if (!glopts->p4mem) {
-        glopts->p4mem = psycho_4_init(glopts, sfreq);
+    if (!*memp) {
+        *memp = psycho_4_init(glopts, sfreq);
     }
 
-    mem = glopts->p4mem;
+    mem = *memp;
     {
         grouped_c = mem->grouped_c;
         grouped_e = mem->grouped_e;
@@ -339,7 +341,6 @@ void psycho_4(twolame_options * glopts,
         wsamp_r = mem->wsamp_r;
         phi = mem->phi;
         energy = mem->energy;
-        window = mem->window;
         ath = mem->ath;
         thr = mem->thr;
         c = mem->c;
@@ -350,13 +351,14 @@ void psycho_4(twolame_options * glopts,
         numlines = mem->numlines;
         partition = mem->partition;
         tmn = mem->tmn;
-        s = mem->s;
         r = mem->r;
         phi_sav = mem->phi_sav;
     }
 
-    for (ch = 0; ch < nch; ch++) {
-        for (run = 0; run < 2; run++) {
+    {
+        unsigned int runs = glopts->psy_single_run ? 1 : 2;
+
+        for (run = 0; run < runs; run++) {
             /* Net offset is 480 samples (1056-576) for layer 2; this is because one must stagger
                input data by 256 samples to synchronize psychoacoustic model with filter bank
                outputs, then stagger so that center of 1024 FFT window lines up with center of 576
@@ -364,19 +366,7 @@ void psycho_4(twolame_options * glopts,
 
                flush = 384*3.0/2.0; = 576 syncsize = 1056; sync_flush = syncsize - flush; 480
                BLKSIZE = 1024 */
-            {
-                short int *bufferp = buffer[ch];
-                for (j = 0; j < 480; j++) {
-                    savebuf[ch][j] = savebuf[ch][j + 576];
-                    wsamp_r[j] = window[j] * ((FLOAT) savebuf[ch][j]);
-                }
-                for (; j < 1024; j++) {
-                    savebuf[ch][j] = *bufferp++;
-                    wsamp_r[j] = window[j] * ((FLOAT) savebuf[ch][j]);
-                }
-                for (; j < 1056; j++)
-                    savebuf[ch][j] = *bufferp++;
-            }
+            psycho_2_window(mem, hist[ch], run, glopts->psy_single_run);
 
             /* Compute FFT */
             psycho_2_fft(wsamp_r, energy, phi);
@@ -401,7 +391,7 @@ void psycho_4(twolame_options * glopts,
             oldest = mem->oldest;
 
 
-            for (j = 0; j < HBLKSIZE; j++) {
+            for (j = 0; j < mem->c_lines; j++) {
 #ifdef NEWATAN
                 FLOAT temp1, temp2, temp3;
                 r_prime = 2.0 * r[ch][old][j] - r[ch][oldest][j];
@@ -454,30 +444,17 @@ void psycho_4(twolame_options * glopts,
             }
             grouped_e[0] = energy[0];
             grouped_c[0] = energy[0] * c[0];
-            for (j = 1; j < HBLKSIZE; j++) {
+            for (j = 1; j < mem->c_lines; j++) {
                 grouped_e[partition[j]] += energy[j];
                 grouped_c[partition[j]] += energy[j] * c[j];
             }
 
             /* convolve the grouped energy-weighted unpredictability measure and the grouped energy 
                with the spreading function ISO 11172 D.2.4.f */
-            for (j = 0; j < CBANDS; j++) {
-                ecb[j] = 0;
-                cb[j] = 0;
-                for (k = 0; k < CBANDS; k++) {
-                    if (s[j][k] != 0.0) {
-                        ecb[j] += s[j][k] * grouped_e[k];
-                        cb[j] += s[j][k] * grouped_c[k];
-                    }
-                }
-                if (ecb[j] != 0)
-                    cb[j] = cb[j] / ecb[j];
-                else
-                    cb[j] = 0;
-            }
+            spread_convolve(mem);
 
             /* Convert cb to tb (the tonality index) ISO11172 SecD.2.4.g */
-            for (i = 0; i < CBANDS; i++) {
+            for (i = 0; i < mem->used_bands; i++) {
                 if (cb[i] < 0.05)
                     cb[i] = 0.05;
                 else if (cb[i] > 0.5)
@@ -488,7 +465,7 @@ void psycho_4(twolame_options * glopts,
 
             /* Calculate the required SNR for each of the frequency partitions ISO 11172 Sect
                D.2.4.h */
-            for (j = 0; j < CBANDS; j++) {
+            for (j = 0; j < mem->used_bands; j++) {
                 FLOAT SNR, SNRtemp;
                 SNRtemp = tmn[j] * tb[j] + NMT * (1.0 - tb[j]);
                 SNR = MAX(SNRtemp, minval[(int) cbval[j]]);
@@ -498,7 +475,7 @@ void psycho_4(twolame_options * glopts,
             /* Calculate the permissible noise energy level in each of the frequency partitions.
                This section used to have pre-echo control but only for LayerI ISO 11172 Sec D.2.4.k 
                - Spread the threshold energy over FFT lines */
-            for (j = 0; j < CBANDS; j++) {
+            for (j = 0; j < mem->used_bands; j++) {
                 if (rnorm[j] && numlines[j])
                     nb[j] = ecb[j] * bc[j] / (rnorm[j] * numlines[j]);
                 else
@@ -506,12 +483,12 @@ void psycho_4(twolame_options * glopts,
             }
 
             /* ISO11172 Sec D.2.4.l - thr[] the final energy threshold of audibility */
-            for (j = 0; j < HBLKSIZE; j++)
+            for (j = 0; j < mem->used_lines; j++)
                 thr[j] = MAX(nb[partition[j]], ath[j]);
 
             /* Translate the 512 threshold values to the 32 filter bands of the coder Using ISO
                11172 Table D.5 and Section D.2.4.n */
-            for (j = 0; j < 193; j += 16) {
+            for (j = 0; j < 193 && j + 16 < mem->used_lines; j += 16) {
                 /* WIDTH = 0 */
                 npart = 60802371420160.0;
                 epart = 0.0;
@@ -523,7 +500,7 @@ void psycho_4(twolame_options * glopts,
                 }
                 snrtmp[run][j / 16] = 4.342944819 * log((FLOAT) (epart / (npart * 17.0)));
             }
-            for (j = 208; j < (HBLKSIZE - 1); j += 16) {
+            for (j = 208; j < mem->used_lines - 1; j += 16) {
                 /* WIDTH = 1 */
                 npart = 0.0;
                 epart = 0.0;
@@ -533,17 +510,49 @@ void psycho_4(twolame_options * glopts,
                 }
                 snrtmp[run][j / 16] = 4.342944819 * log((FLOAT) (epart / npart));
             }
+            /* The subbands above sblimit aren't coded */
+            for (j = mem->used_lines - 1; j < HBLKSIZE - 1; j += 16)
+                snrtmp[run][j / 16] = 0;
         }
 
         /* Pick the maximum value of the two runs ISO 11172 Sect D.2.1 */
         for (i = 0; i < 32; i++)
-            smr[ch][i] = MAX(snrtmp[0][i], snrtmp[1][i]);
+            smr[ch][i] = (runs == 1) ? snrtmp[0][i] : MAX(snrtmp[0][i], snrtmp[1][i]);
 
-    }                           // now do other channel
+    }
 
 }
 
 
+void psycho_4(twolame_options * glopts, FLOAT * hist[2], FLOAT smr[2][32])
+{
+    unsigned int ch;
+
+    for (ch = 0; ch < glopts->num_channels_out; ch++)
+        psycho_4_channel(glopts, &glopts->p4mem, ch, hist, smr);
+}
+
+
+/* Reset the states used in the unpredictability measure */
+void psycho_4_reset(psycho_4_mem * mem)
+{
+    int i;
+
+    if (mem == NULL)
+        return;
+
+    mem->new = 0;
+    mem->old = 1;
+    mem->oldest = 0;
+
+    for (i = 0; i < HBLKSIZE; i++) {
+        mem->r[0][0][i] = mem->r[1][0][i] = mem->r[0][1][i] = mem->r[1][1][i] = 0;
+        mem->phi_sav[0][0][i] = mem->phi_sav[1][0][i] = 0;
+        mem->phi_sav[0][1][i] = mem->phi_sav[1][1][i] = 0;
+        mem->lthr[0][i] = mem->lthr[1][i] = 0;
+    }
+}
+
 void psycho_4_deinit(psycho_4_mem ** mem)
 {
 
@@ -552,6 +561,7 @@ void psycho_4_deinit(psycho_4_mem ** mem)
 
     TWOLAME_FREE((*mem)->tmn);
     TWOLAME_FREE((*mem)->s);
+    TWOLAME_FREE((*mem)->spread);
     TWOLAME_FREE((*mem)->lthr);
     TWOLAME_FREE((*mem)->r);
     TWOLAME_FREE((*mem)->phi_sav);
@@ -25,8 +25,10 @@
 #ifndef TWOLAME_PSYCHO_4_H
 #define TWOLAME_PSYCHO_4_H
 
-void psycho_4(twolame_options * glopts, short int buffer[2][1152], short int savebuf[2][1056],
-              FLOAT smr[2][32]);
+void psycho_4(twolame_options * glopts, FLOAT * hist[2], FLOAT smr[2][32]);
+void psycho_4_channel(twolame_options * glopts, psycho_4_mem ** memp, unsigned int ch,
+                      FLOAT * hist[2], FLOAT smr[2][32]);
+void psycho_4_reset(psycho_4_mem * mem);
 void psycho_4_deinit(psycho_4_mem ** mem);
 
 #endif
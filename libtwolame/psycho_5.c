@@ -0,0 +1,266 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+
+#include <stdio.h>
+#include <math.h>
+
+#include "twolame.h"
+#include "common.h"
+#include "ath.h"
+#include "mem.h"
+#include "psycho_5.h"
+
+/*
+  PSYCHO_5: a psycho model which works on the subband samples
+
+  Models 1 to 4 all need at least one 1024 point FFT of each channel for
+  every frame. This model uses the subband samples from the filterbank
+  instead, which have already been worked out for the encoder, so it
+  costs little more than model 0. It follows the outline of model 2
+  (ISO 11172 Annex D.2), with the 32 subbands as its partitions:
+
+  - The energy in each subband is measured for each granule (12 samples).
+  - How tonal each subband is (between 0 and 1) is estimated from how
+    steady its energy is from one granule to the next (including the
+    last granule of the previous frame), and how far it stands out from
+    the quieter of its neighbours. A steady tone is confined to one or
+    two subbands, while noise is neither steady nor a peak.
+  - Each subband masks the ones around it through the spreading
+    function of model 4, less 24.5 dB or more for tones
+    (15.5 dB + bark, as in model 4) and 5.5 dB for noise.
+  - The threshold is the spread masking, or the absolute threshold
+    of hearing if that is higher.
+
+  The SMR is the loudest granule of each subband over that threshold.
+  The values are in between those of models 0 and 3, and much closer
+  to model 3's.
+*/
+
+
+/* NMT is a constant 5.5dB. ISO11172 Sec D.2.4.h */
+static const FLOAT NMT = 5.5;
+
+/* 10*log10 of the energy of a full scale sine in a subband, below 96 dB */
+#define PSYCHO_5_FULL_SCALE		(-3.0)
+
+
+/* The spreading function of psycho model 4 (ISO 11172 Section D.2.3) */
+static FLOAT psycho_5_spreading_function(FLOAT bark)
+{
+    FLOAT x = 0.0, y;
+
+    if (bark >= 0.5 && bark <= 2.5) {
+        FLOAT temp = bark - 0.5;
+        x = 8.0 * (temp * temp - 2.0 * temp);
+    }
+    bark += 0.474;
+    y = 15.811389 + 7.5 * bark - 17.5 * sqrt(1.0 + bark * bark);
+    if (y <= -60.0)
+        return 0.0;
+
+    return exp((x + y) * LN_TO_LOG10);
+}
+
+
+static psycho_5_mem *psycho_5_init(twolame_options * glopts)
+{
+    psycho_5_mem *mem = (psycho_5_mem *) TWOLAME_MALLOC(sizeof(psycho_5_mem));
+    FLOAT sfreq = (FLOAT) glopts->samplerate_out;
+    int i, j;
+
+    for (i = 0; i < SBLIMIT; i++) {
+        FLOAT ath_min = 1000.0;
+
+        /* The bark value at the centre of the subband */
+        mem->bark[i] = ath_freq2bark((i + 0.5) * sfreq / 64.0);
+
+        /* The lowest ATH in the subband, in the units of the subband energy */
+        for (j = 0; j < 16; j++) {
+            FLOAT ath = ath_db((i * 16 + j) * sfreq / 1024.0, glopts->athlevel);
+            if (ath < ath_min)
+                ath_min = ath;
+        }
+        mem->ath[i] = exp((ath_min - 96.0 + PSYCHO_5_FULL_SCALE) * LN_TO_LOG10);
+
+        /* Tone masking noise */
+        mem->tmn[i] = MAX(15.5 + mem->bark[i], 24.5);
+    }
+
+    /* The spreading function from each subband j to each subband i, and the
+       range of i for each j that it is worth adding up (see psycho_5_spread) */
+    for (j = 0; j < SBLIMIT; j++) {
+        mem->spread_first[j] = SBLIMIT;
+        mem->spread_last[j] = 0;
+        for (i = 0; i < SBLIMIT; i++) {
+            mem->spread[j][i] = psycho_5_spreading_function(1.05 * (mem->bark[i] - mem->bark[j]));
+            if (mem->spread[j][i] != 0.0) {
+                if (i < mem->spread_first[j])
+                    mem->spread_first[j] = i;
+                mem->spread_last[j] = i + 1;
+            }
+        }
+    }
+    for (i = 0; i < SBLIMIT; i++) {
+        mem->rnorm[i] = 0.0;
+        for (j = 0; j < SBLIMIT; j++)
+            mem->rnorm[i] += mem->spread[j][i];
+    }
+
+    psycho_5_reset(mem);
+
+    return mem;
+}
+
+
+/* The energy of each granule of each subband, and how tonal each subband is */
+static void psycho_5_energy(psycho_5_mem * mem, int ch, FLOAT sb_sample[3][SCALE_BLOCK][SBLIMIT],
+                            int sblimit, FLOAT energy[3][SBLIMIT], FLOAT tonality[SBLIMIT])
+{
+    FLOAT mean[SBLIMIT];
+    int gr, j, sb;
+
+    for (gr = 0; gr < 3; gr++) {
+        for (sb = 0; sb < sblimit; sb++)
+            energy[gr][sb] = 1E-20;
+        for (j = 0; j < SCALE_BLOCK; j++)
+            for (sb = 0; sb < sblimit; sb++)
+                energy[gr][sb] += sb_sample[gr][j][sb] * sb_sample[gr][j][sb];
+        for (sb = 0; sb < sblimit; sb++)
+            energy[gr][sb] /= SCALE_BLOCK;
+    }
+
+    for (sb = 0; sb < sblimit; sb++)
+        mean[sb] = (energy[0][sb] + energy[1][sb] + energy[2][sb]) / 3.0;
+
+    for (sb = 0; sb < sblimit; sb++) {
+        FLOAT last = mem->last_energy[ch][sb];
+        FLOAT lo, hi, neighbour, steady, peak;
+
+        /* Steadiness: the ratio of the quietest to the loudest of the four granules */
+        lo = MIN(MIN(energy[0][sb], energy[1][sb]), MIN(energy[2][sb], last));
+        hi = MAX(MAX(energy[0][sb], energy[1][sb]), MAX(energy[2][sb], last));
+        steady = lo / hi;
+
+        /* Peakiness: how far above the quieter neighbour, 10 dB being a clear peak.
+           With only one subband there is no neighbour, so no peak either */
+        if (sblimit == 1) {
+            peak = 0.0;
+        } else {
+            if (sb == 0)
+                neighbour = mean[1];
+            else if (sb == sblimit - 1)
+                neighbour = mean[sb - 1];
+            else
+                neighbour = MIN(mean[sb - 1], mean[sb + 1]);
+            peak = log10(mean[sb] / neighbour);
+        }
+
+        tonality[sb] = MIN(1.0, MAX(0.0, (steady - 0.3) / 0.5)) * MIN(1.0, MAX(0.0, peak));
+        mem->last_energy[ch][sb] = energy[2][sb];
+    }
+}
+
+
+/* Spread the masking from each subband (ISO 11172 D.2.4.f-k) */
+static void psycho_5_spread(psycho_5_mem * mem, int sblimit, FLOAT mean[SBLIMIT],
+                            FLOAT tonality[SBLIMIT], FLOAT thr[SBLIMIT])
+{
+    int i, j;
+
+    for (i = 0; i < SBLIMIT; i++)
+        thr[i] = 0.0;
+
+    for (j = 0; j < sblimit; j++) {
+        const FLOAT *spread = mem->spread[j];
+        FLOAT offset = tonality[j] * mem->tmn[j] + (1.0 - tonality[j]) * NMT;
+        FLOAT masker = mean[j] * exp(-offset * LN_TO_LOG10);
+        int last = mem->spread_last[j];
+
+        for (i = mem->spread_first[j]; i < last; i++)
+            thr[i] += spread[i] * masker;
+    }
+
+    for (i = 0; i < sblimit; i++)
+        thr[i] = MAX(thr[i] / mem->rnorm[i], mem->ath[i]);
+}
+
+
+void psycho_5(twolame_options * glopts, FLOAT sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
+              FLOAT smr[2][SBLIMIT])
+{
+    psycho_5_mem *mem;
+    int sblimit = glopts->sblimit;
+    int ch, sb;
+
+    if (!glopts->p5mem)
+        glopts->p5mem = psycho_5_init(glopts);
+    mem = glopts->p5mem;
+
+    for (ch = 0; ch < glopts->num_channels_out; ch++) {
+        FLOAT energy[3][SBLIMIT];
+        FLOAT mean[SBLIMIT];
+        FLOAT tonality[SBLIMIT];
+        FLOAT thr[SBLIMIT];
+
+        psycho_5_energy(mem, ch, sb_sample[ch], sblimit, energy, tonality);
+        for (sb = 0; sb < sblimit; sb++)
+            mean[sb] = (energy[0][sb] + energy[1][sb] + energy[2][sb]) / 3.0;
+        psycho_5_spread(mem, sblimit, mean, tonality, thr);
+
+        /* The loudest granule over the threshold */
+        for (sb = 0; sb < sblimit; sb++) {
+            FLOAT loudest = MAX(MAX(energy[0][sb], energy[1][sb]), energy[2][sb]);
+            smr[ch][sb] = 10.0 * log10(loudest / thr[sb]);
+        }
+        for (; sb < SBLIMIT; sb++)
+            smr[ch][sb] = 0.0;
+    }
+}
+
+
+/* Forget the energy of the previous frame */
+void psycho_5_reset(psycho_5_mem * mem)
+{
+    int i;
+
+    if (mem == NULL)
+        return;
+
+    for (i = 0; i < SBLIMIT; i++)
+        mem->last_energy[0][i] = mem->last_energy[1][i] = 0.0;
+}
+
+
+void psycho_5_deinit(psycho_5_mem ** mem)
+{
+
+    if (mem == NULL || *mem == NULL)
+        return;
+
+    TWOLAME_FREE(*mem);
+}
+
+
+
+// vim:ts=4:sw=4:nowrap:
@@ -0,0 +1,185 @@
+/*
+ *  TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *  Copyright (C) 2001-2004 Michael Cheng
+ *  Copyright (C) 2004-2006 The TwoLAME Project
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "twolame.h"
+#include "common.h"
+#include "realtime.h"
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+
+/*
+  The real-time governor times each call to encode_frame() and
+  compares it against the budget set with twolame_set_frame_budget().
+
+  When a frame goes over budget we step down a ladder of cheaper
+  psycho models: 4 -> 3 -> 1 -> 0 -> re-use the previous SMR values
+  (the same thing quick mode does between calculations). When there
+  has been plenty of headroom for a while, we step back up again.
+  Each failed attempt to step up doubles the time we wait before
+  trying again, so that we don't keep bouncing off the budget.
+*/
+
+#define RT_MIN_HOLD		(16)    // Frames of headroom needed before stepping up
+#define RT_MAX_HOLD		(1024)
+#define RT_HEADROOM		(0.5)   // Fraction of the budget that counts as headroom
+
+
+/* Get the current time in microseconds */
+static double realtime_clock(void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+#else
+    return clock() * (1000000.0 / CLOCKS_PER_SEC);
+#endif
+}
+
+
+/* Build the ladder of psycho models, starting with the one the user chose */
+void realtime_init(twolame_options * glopts)
+{
+    realtime_mem *rt = &glopts->rtmem;
+    static const int cheaper[] = { 3, 1, 5, 0 };
+    int first, i;
+
+    rt->ladder_len = 0;
+    rt->ladder[rt->ladder_len++] = glopts->psymodel;
+
+    // Models 2 and 4 are the most expensive, followed by 3, 1, 5 and 0
+    first = (glopts->psymodel == 2 || glopts->psymodel == 4) ? 0 : 4;
+    for (i = 0; i < 4; i++)
+        if (cheaper[i] == glopts->psymodel)
+            first = i + 1;
+    for (i = first; i < 4; i++)
+        rt->ladder[rt->ladder_len++] = cheaper[i];
+    rt->ladder[rt->ladder_len++] = RT_REUSE_SMR;
+
+    rt->rung = 0;
+    rt->settle = 0;
+    rt->good_frames = 0;
+    rt->hold = RT_MIN_HOLD;
+    rt->frame_start = 0.0;
+
+    memset(&rt->stats, 0, sizeof(rt->stats));
+    rt->stats.psymodel = glopts->psymodel;
+}
+
+
+/* The psycho model to use for this frame, or RT_REUSE_SMR */
+int realtime_psymodel(twolame_options * glopts)
+{
+    realtime_mem *rt = &glopts->rtmem;
+    return rt->ladder[rt->rung];
+}
+
+
+void realtime_frame_start(twolame_options * glopts)
+{
+    glopts->rtmem.frame_start = realtime_clock();
+}
+
+
+static void realtime_step(twolame_options * glopts, int rung)
+{
+    realtime_mem *rt = &glopts->rtmem;
+
+    rt->rung = rung;
+    rt->good_frames = 0;
+
+    // The next frame may include the set-up time of a psycho model
+    // that hasn't been used yet, so don't judge it
+    rt->settle = 1;
+
+    rt->stats.level = rung;
+    rt->stats.reusing = (rt->ladder[rung] == RT_REUSE_SMR);
+    if (!rt->stats.reusing)
+        rt->stats.psymodel = rt->ladder[rung];
+
+    if (glopts->verbosity > 2) {
+        if (rt->stats.reusing)
+            fprintf(stderr, "Real-time: re-using previous psycho model values\n");
+        else
+            fprintf(stderr, "Real-time: switched to psycho model %d\n", rt->stats.psymodel);
+    }
+}
+
+
+void realtime_frame_end(twolame_options * glopts)
+{
+    realtime_mem *rt = &glopts->rtmem;
+    int elapsed = (int) (realtime_clock() - rt->frame_start);
+    int budget = glopts->frame_budget;
+
+    if (elapsed < 0)
+        elapsed = 0;
+
+    rt->stats.frames++;
+    rt->stats.last_frame_usec = elapsed;
+    if (elapsed > rt->stats.max_frame_usec)
+        rt->stats.max_frame_usec = elapsed;
+    if (elapsed > budget)
+        rt->stats.frames_over_budget++;
+    if (rt->ladder[rt->rung] == RT_REUSE_SMR)
+        rt->stats.reused_frames++;
+
+    if (rt->settle > 0) {
+        rt->settle--;
+        return;
+    }
+
+    if (elapsed > budget) {
+        // Too slow: step down, and be more cautious about stepping up again
+        if (rt->rung < rt->ladder_len - 1) {
+            rt->stats.degrade_events++;
+            rt->hold *= 2;
+            if (rt->hold > RT_MAX_HOLD)
+                rt->hold = RT_MAX_HOLD;
+            realtime_step(glopts, rt->rung + 1);
+        }
+    } else if (elapsed < budget * RT_HEADROOM) {
+        // Plenty of time to spare: step up once it has lasted a while
+        if (rt->rung > 0 && ++rt->good_frames >= rt->hold) {
+            rt->stats.recover_events++;
+            realtime_step(glopts, rt->rung - 1);
+            if (rt->rung == 0)
+                rt->hold = RT_MIN_HOLD;
+        }
+    } else {
+        rt->good_frames = 0;
+    }
+}
+
+
+// vim:ts=4:sw=4:nowrap: 
@@ -0,0 +1,154 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "twolame.h"
+#include "common.h"
+#include "mem.h"
+#include "spread.h"
+
+
+/*
+  Spreading function convolution for psycho models 2 and 4
+  (ISO 11172 D.2.4.f)
+
+  The spreading function is only non-zero for partitions within
+  a few bark of each other, so most of the 64x64 matrix is zero.
+  spread_init() keeps just the band of each column of s[][] that
+  isn't, stored contiguously, and spread_convolve() adds each
+  partition's energy into the partitions in its band.
+
+  Each partition still adds up its terms in order of k, as it did
+  when the zeros were skipped one by one, and adding the zeros that
+  are left inside a band changes nothing, so the results are exactly
+  the same as before. The inner loop has no branches and no sum
+  carried from one j to the next, so the compiler can vectorise it.
+
+  The encoder doesn't code the subbands above the sblimit of its
+  bit allocation table (only 8 of the 32 at 48kbps per channel and
+  44.1kHz), so spread_cutoff() works out how much of the spectrum
+  the models actually need for the rest: the lines up to that
+  subband, the partitions they fall in, and the lines of the
+  partitions that spread into those. Everything above is skipped.
+  The sblimit doesn't change while encoding, so the histories of
+  the skipped lines are never looked at again.
+*/
+
+
+/* Find the non-zero band of each column of mem->s */
+void spread_init(psycho_2_mem * mem)
+{
+    FCB *s = mem->s;
+    int j, k;
+
+    mem->spread = (FCB *) TWOLAME_MALLOC(sizeof(FCBCB));
+
+    for (k = 0; k < CBANDS; k++) {
+        int first = CBANDS, last = 0;
+
+        for (j = 0; j < CBANDS; j++) {
+            if (s[j][k] != 0.0) {
+                if (j < first)
+                    first = j;
+                last = j + 1;
+            }
+        }
+        if (first > last)
+            first = last = 0;
+
+        mem->spread_first[k] = first;
+        mem->spread_last[k] = last;
+        for (j = 0; j < CBANDS; j++)
+            mem->spread[k][j] = s[j][k];
+    }
+}
+
+
+/* Work out the parts of the spectrum needed for the first sblimit subbands */
+void spread_cutoff(psycho_2_mem * mem, int sblimit)
+{
+    int *partition = mem->partition;
+    unsigned int j;
+    int k;
+
+    if (sblimit < 1 || sblimit > SBLIMIT)
+        sblimit = SBLIMIT;
+
+    /* Each subband's SMR looks at 17 lines, from 16*sb to 16*sb+16 */
+    mem->used_lines = 16 * sblimit + 1;
+    if (mem->used_lines > HBLKSIZE)
+        mem->used_lines = HBLKSIZE;
+    mem->used_bands = partition[mem->used_lines - 1] + 1;
+
+    /* Up to the last line in a partition which spreads into those */
+    for (j = HBLKSIZE; j > mem->used_lines; j--) {
+        k = partition[j - 1];
+        if ((unsigned int) mem->spread_first[k] < mem->used_bands && mem->spread_last[k] > 0)
+            break;
+    }
+    mem->c_lines = j;
+}
+
+
+/* Convolve grouped_e and grouped_c with the spreading function, giving
+   ecb[] and the normalised unpredictability cb[] for each partition
+   (up to mem->used_bands) */
+void spread_convolve(psycho_2_mem * mem)
+{
+    FLOAT *ecb = mem->ecb;
+    FLOAT *cb = mem->cb;
+    int bands = mem->used_bands;
+    int j, k;
+
+    for (j = 0; j < CBANDS; j++) {
+        ecb[j] = 0;
+        cb[j] = 0;
+    }
+
+    for (k = 0; k < CBANDS; k++) {
+        const FLOAT *spread = mem->spread[k];
+        FLOAT e = mem->grouped_e[k];
+        FLOAT c = mem->grouped_c[k];
+        int last = (mem->spread_last[k] < bands) ? mem->spread_last[k] : bands;
+
+        for (j = mem->spread_first[k]; j < last; j++) {
+            ecb[j] += spread[j] * e;
+            cb[j] += spread[j] * c;
+        }
+    }
+
+    for (j = 0; j < bands; j++) {
+        if (ecb[j] != 0)
+            cb[j] = cb[j] / ecb[j];
+        else
+            cb[j] = 0;
+    }
+}
+
+
+// vim:ts=4:sw=4:nowrap:
@@ -49,97 +49,76 @@ static void create_dct_matrix(FLOAT filter[16][32])
         }
 }
 
-int init_subband(subband_mem * smem)
+/* x in Q28, rounded to the nearest */
+static int fixed_q28(FLOAT x)
 {
-    register int i, j;
-    smem->off[0] = 0;
-    smem->off[1] = 0;
-    smem->half[0] = 0;
-    smem->half[1] = 0;
-    for (i = 0; i < 2; i++)
-        for (j = 0; j < 512; j++)
-            smem->x[i][j] = 0;
+    return (int) floor(x * (1 << FIXED_BITS) + 0.5);
+}
+
+int init_subband(subband_mem * smem, int sblimit)
+{
+    int i, k;
+
     create_dct_matrix(smem->m);
+    smem->sblimit = (sblimit > 0 && sblimit < SBLIMIT) ? sblimit : SBLIMIT;
+
+    for (i = 0; i < 512; i++)
+        smem->fixed_window[i] = fixed_q28(enwindow[i]);
+    for (i = 0; i < 16; i++)
+        for (k = 0; k < 32; k++)
+            smem->fixed_m[i][k] = fixed_q28(smem->m[i][k]);
 
     return 0;
 }
 
 
-void window_filter_subband(subband_mem * smem, short *pBuffer, int ch, FLOAT s[SBLIMIT])
+/*
+  Filter the 32 samples at pBuffer into 32 subband samples.
+  The window reaches back over the 480 samples before pBuffer,
+  which are read from the analysis history (see history_stage()).
+
+  Only the subbands below smem->sblimit are ever coded, and the
+  others are set to zero. Each row i of the DCT gives subbands i
+  and 31-i, so below 16 subbands the rows from sblimit up are
+  skipped.
+*/
+void window_filter_subband(subband_mem * smem, const FLOAT * pBuffer, FLOAT s[SBLIMIT])
 {
     register int i, j;
-    int pa, pb, pc, pd, pe, pf, pg, ph;
-    FLOAT t;
-    FLOAT *dp, *dp2;
+    const FLOAT *dp;
     const FLOAT *pEnw;
+    FLOAT t;
     FLOAT y[64];
     FLOAT yprime[32];
+    int rows = (smem->sblimit < 16) ? smem->sblimit : 16;
 
-    dp = smem->x[ch] + smem->off[ch] + smem->half[ch] * 256;
-
-    /* replace 32 oldest samples with 32 new samples */
-    for (i = 0; i < 32; i++)
-        dp[(31 - i) * 8] = (FLOAT) pBuffer[i] / SCALE;
-
-    // looks like "school example" but does faster ...
-    dp = (smem->x[ch] + smem->half[ch] * 256);
-    pa = smem->off[ch];
-    pb = (pa + 1) % 8;
-    pc = (pa + 2) % 8;
-    pd = (pa + 3) % 8;
-    pe = (pa + 4) % 8;
-    pf = (pa + 5) % 8;
-    pg = (pa + 6) % 8;
-    ph = (pa + 7) % 8;
-
-    for (i = 0; i < 32; i++) {
-        dp2 = dp + i * 8;
+    /* The window is read newest sample first, from pBuffer[31]
+       back to pBuffer[-480] */
+    for (i = 0; i < 64; i++) {
+        dp = pBuffer + 31 - i;
         pEnw = enwindow + i;
-        t = dp2[pa] * pEnw[0];
-        t += dp2[pb] * pEnw[64];
-        t += dp2[pc] * pEnw[128];
-        t += dp2[pd] * pEnw[192];
-        t += dp2[pe] * pEnw[256];
-        t += dp2[pf] * pEnw[320];
-        t += dp2[pg] * pEnw[384];
-        t += dp2[ph] * pEnw[448];
+        t = dp[0] * pEnw[0];
+        t += dp[-64] * pEnw[64];
+        t += dp[-128] * pEnw[128];
+        t += dp[-192] * pEnw[192];
+        t += dp[-256] * pEnw[256];
+        t += dp[-320] * pEnw[320];
+        t += dp[-384] * pEnw[384];
+        t += dp[-448] * pEnw[448];
         y[i] = t;
     }
 
     yprime[0] = y[16];          // Michael Chen's dct filter
 
-    dp = smem->half[ch] ? smem->x[ch] : (smem->x[ch] + 256);
-    pa = smem->half[ch] ? (smem->off[ch] + 1) & 7 : smem->off[ch];
-    pb = (pa + 1) % 8;
-    pc = (pa + 2) % 8;
-    pd = (pa + 3) % 8;
-    pe = (pa + 4) % 8;
-    pf = (pa + 5) % 8;
-    pg = (pa + 6) % 8;
-    ph = (pa + 7) % 8;
-
-    for (i = 0; i < 32; i++) {
-        dp2 = dp + i * 8;
-        pEnw = enwindow + i + 32;
-        t = dp2[pa] * pEnw[0];
-        t += dp2[pb] * pEnw[64];
-        t += dp2[pc] * pEnw[128];
-        t += dp2[pd] * pEnw[192];
-        t += dp2[pe] * pEnw[256];
-        t += dp2[pf] * pEnw[320];
-        t += dp2[pg] * pEnw[384];
-        t += dp2[ph] * pEnw[448];
-        y[i + 32] = t;
-        // 1st pass on Michael Chen's dct filter
-        if (i > 0 && i < 17)
-            yprime[i] = y[i + 16] + y[16 - i];
-    }
+    // 1st pass on Michael Chen's dct filter
+    for (i = 1; i < 17; i++)
+        yprime[i] = y[i + 16] + y[16 - i];
 
     // 2nd pass on Michael Chen's dct filter
     for (i = 17; i < 32; i++)
         yprime[i] = y[i + 16] - y[80 - i];
 
-    for (i = 15; i >= 0; i--) {
+    for (i = rows - 1; i >= 0; i--) {
         register FLOAT s0 = 0.0, s1 = 0.0;
         register FLOAT *mp = smem->m[i];
         register FLOAT *xinp = yprime;
@@ -152,12 +131,130 @@ void window_filter_subband(subband_mem * smem, short *pBuffer, int ch, FLOAT s[S
         s[i] = s0 + s1;
         s[31 - i] = s0 - s1;
     }
+    for (i = smem->sblimit; i < SBLIMIT; i++)
+        s[i] = 0;
+}
+
+
+/*
+  window_filter_subband() in fixed point, for the 32 PCM samples at
+  pBuffer (with the 480 before them). The window and the DCT matrix
+  are in Q28, and so are the subband samples it gives. The products
+  are added up in 64 bits: the windowed samples fit in 32 bits with
+  room for the sums of two in the DCT (the window adds up to less
+  than 2.2 at each tap), and the DCT sums fit in 64 bits.
+*/
+void window_filter_subband_fixed(subband_mem * smem, const short int *pBuffer, int s[SBLIMIT])
+{
+    register int i, j;
+    const short int *dp;
+    const int *pEnw;
+    FIXED_ACC t;
+    int y[64];
+    int yprime[32];
+    int rows = (smem->sblimit < 16) ? smem->sblimit : 16;
+
+    /* The samples are Q15, so Q43 products back to Q28 */
+    for (i = 0; i < 64; i++) {
+        dp = pBuffer + 31 - i;
+        pEnw = smem->fixed_window + i;
+        t = (FIXED_ACC) dp[0] * pEnw[0];
+        t += (FIXED_ACC) dp[-64] * pEnw[64];
+        t += (FIXED_ACC) dp[-128] * pEnw[128];
+        t += (FIXED_ACC) dp[-192] * pEnw[192];
+        t += (FIXED_ACC) dp[-256] * pEnw[256];
+        t += (FIXED_ACC) dp[-320] * pEnw[320];
+        t += (FIXED_ACC) dp[-384] * pEnw[384];
+        t += (FIXED_ACC) dp[-448] * pEnw[448];
+        y[i] = (int) ((t + (1 << 14)) >> 15);
+    }
 
-    smem->half[ch] = (smem->half[ch] + 1) & 1;
+    yprime[0] = y[16];
+    for (i = 1; i < 17; i++)
+        yprime[i] = y[i + 16] + y[16 - i];
+    for (i = 17; i < 32; i++)
+        yprime[i] = y[i + 16] - y[80 - i];
 
-    if (smem->half[ch] == 1)
-        smem->off[ch] = (smem->off[ch] + 7) & 7;
+    /* Q56 sums back to Q28 */
+    for (i = rows - 1; i >= 0; i--) {
+        register FIXED_ACC s0 = 0, s1 = 0;
+        register const int *mp = smem->fixed_m[i];
+        register const int *xinp = yprime;
+        for (j = 0; j < 8; j++) {
+            s0 += (FIXED_ACC) * mp++ * *xinp++;
+            s1 += (FIXED_ACC) * mp++ * *xinp++;
+            s0 += (FIXED_ACC) * mp++ * *xinp++;
+            s1 += (FIXED_ACC) * mp++ * *xinp++;
+        }
+        s[i] = (int) ((s0 + s1 + (1 << (FIXED_BITS - 1))) >> FIXED_BITS);
+        s[31 - i] = (int) ((s0 - s1 + (1 << (FIXED_BITS - 1))) >> FIXED_BITS);
+    }
+    for (i = smem->sblimit; i < SBLIMIT; i++)
+        s[i] = 0;
 }
 
 
+/*
+  window_filter_subband() for LANE_BLOCK streams at once. Sample n of
+  stream l is at pBuffer[n * LANE_BLOCK + l], and subband sb of stream
+  l goes to s[sb][l]. The innermost loops are over the
+  streams, so the compiler can run them in SIMD lanes. Each stream's
+  sums are added up in the same order as in window_filter_subband(),
+  so the results are exactly the same.
+*/
+void window_filter_subband_lanes(subband_mem * smem, const FLOAT * pBuffer,
+                                 FLOAT s[SBLIMIT][LANE_BLOCK])
+{
+    int i, k, l;
+    FLOAT y[64][LANE_BLOCK];
+    FLOAT yprime[32][LANE_BLOCK];
+    int rows = (smem->sblimit < 16) ? smem->sblimit : 16;
+
+    for (i = 0; i < 64; i++) {
+        const FLOAT *dp = pBuffer + (31 - i) * LANE_BLOCK;
+        const FLOAT *pEnw = enwindow + i;
+        for (l = 0; l < LANE_BLOCK; l++) {
+            FLOAT t = dp[l] * pEnw[0];
+            t += dp[l - 64 * LANE_BLOCK] * pEnw[64];
+            t += dp[l - 128 * LANE_BLOCK] * pEnw[128];
+            t += dp[l - 192 * LANE_BLOCK] * pEnw[192];
+            t += dp[l - 256 * LANE_BLOCK] * pEnw[256];
+            t += dp[l - 320 * LANE_BLOCK] * pEnw[320];
+            t += dp[l - 384 * LANE_BLOCK] * pEnw[384];
+            t += dp[l - 448 * LANE_BLOCK] * pEnw[448];
+            y[i][l] = t;
+        }
+    }
+
+    for (l = 0; l < LANE_BLOCK; l++)
+        yprime[0][l] = y[16][l];
+    for (i = 1; i < 17; i++)
+        for (l = 0; l < LANE_BLOCK; l++)
+            yprime[i][l] = y[i + 16][l] + y[16 - i][l];
+    for (i = 17; i < 32; i++)
+        for (l = 0; l < LANE_BLOCK; l++)
+            yprime[i][l] = y[i + 16][l] - y[80 - i][l];
+
+    /* The even terms go into s0 and the odd ones into s1, as before */
+    for (i = rows - 1; i >= 0; i--) {
+        FLOAT s0[LANE_BLOCK], s1[LANE_BLOCK];
+        const FLOAT *mp = smem->m[i];
+
+        for (l = 0; l < LANE_BLOCK; l++)
+            s0[l] = s1[l] = 0.0;
+        for (k = 0; k < 32; k += 2)
+            for (l = 0; l < LANE_BLOCK; l++) {
+                s0[l] += mp[k] * yprime[k][l];
+                s1[l] += mp[k + 1] * yprime[k + 1][l];
+            }
+        for (l = 0; l < LANE_BLOCK; l++) {
+            s[i][l] = s0[l] + s1[l];
+            s[31 - i][l] = s0[l] - s1[l];
+        }
+    }
+    for (i = smem->sblimit; i < SBLIMIT; i++)
+        for (l = 0; l < LANE_BLOCK; l++)
+            s[i][l] = 0;
+}
+
 // vim:ts=4:sw=4:nowrap: 
@@ -26,8 +26,11 @@
 #ifndef TWOLAME_SUBBAND_H
 #define TWOLAME_SUBBAND_H
 
-int init_subband(subband_mem * smem);
-void window_filter_subband(subband_mem * smem, short *pBuffer, int ch, FLOAT s[SBLIMIT]);
+int init_subband(subband_mem * smem, int sblimit);
+void window_filter_subband(subband_mem * smem, const FLOAT * pBuffer, FLOAT s[SBLIMIT]);
+void window_filter_subband_fixed(subband_mem * smem, const short int *pBuffer, int s[SBLIMIT]);
+void window_filter_subband_lanes(subband_mem * smem, const FLOAT * pBuffer,
+                                 FLOAT s[SBLIMIT][LANE_BLOCK]);
 
 #endif
 
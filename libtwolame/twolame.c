@@ -42,11 +42,15 @@
 #include "psycho_2.h"
 #include "psycho_3.h"
 #include "psycho_4.h"
+#include "psycho_5.h"
 #include "availbits.h"
 #include "subband.h"
 #include "encode.h"
 #include "energy.h"
 #include "util.h"
+#include "realtime.h"
+#include "chanthread.h"
+#include "pcmring.h"
 
 #include "bitbuffer_inline.h"
 
@@ -75,6 +79,7 @@ twolame_options *twolame_init(void)
 
     newoptions->mode = TWOLAME_AUTO_MODE;   // Choose a proper mode later
     newoptions->psymodel = 3;
+    newoptions->psymodel_set = FALSE;
     newoptions->bitrate = -1;   // Default bitrate is set in init_params
     newoptions->vbr = FALSE;
     newoptions->vbrlevel = 5.0;
@@ -82,12 +87,20 @@ twolame_options *twolame_init(void)
 
     newoptions->quickmode = FALSE;
     newoptions->quickcount = 10;
+    newoptions->frame_budget = 0;
+    newoptions->channel_threads = FALSE;
+    newoptions->channel_thread_cpu = -1;
+    newoptions->psy_single_run = FALSE;
+    newoptions->chanthread = NULL;
+    newoptions->ring = NULL;
     newoptions->emphasis = TWOLAME_EMPHASIS_N;
     newoptions->private_bit = 0;
     newoptions->copyright = FALSE;
     newoptions->original = TRUE;
     newoptions->error_protection = FALSE;
     newoptions->padding = TWOLAME_PAD_NO;
+    newoptions->lowpass = 0;
+    newoptions->fixed_point = FALSE;
     newoptions->do_dab = FALSE;
     newoptions->dab_crc_len = 2;
     newoptions->dab_xpad_len = 0;
@@ -109,6 +122,8 @@ twolame_options *twolame_init(void)
     newoptions->subband = NULL;
     newoptions->j_sample = NULL;
     newoptions->sb_sample = NULL;
+    newoptions->fixed_sample = NULL;
+    newoptions->fixed_j_sample = NULL;
     newoptions->psycount = 0;
 
     newoptions->p0mem = NULL;
@@ -116,6 +131,7 @@ twolame_options *twolame_init(void)
     newoptions->p2mem = NULL;
     newoptions->p3mem = NULL;
     newoptions->p4mem = NULL;
+    newoptions->p5mem = NULL;
 
     memset(newoptions->vbrstats, 0, sizeof(newoptions->vbrstats));
 
@@ -170,6 +186,50 @@ static int init_header_info(twolame_options * glopts)
 
 
 
+/* Put every piece of per-stream state back to how it was
+   immediately after twolame_init_params(), keeping the
+   tables and memory that depend only on the parameters.
+*/
+static int reset_state(twolame_options * glopts)
+{
+    glopts->samples_in_buffer = 0;
+    glopts->psycount = 0;
+    glopts->vbr_frame_count = 0;
+    memset(glopts->vbrstats, 0, sizeof(glopts->vbrstats));
+    memset(&glopts->slots, 0, sizeof(glopts->slots));
+
+    // clear buffers
+    memset((char *) glopts->buffer, 0, sizeof(glopts->buffer));
+    memset((char *) glopts->history, 0, sizeof(glopts->history));
+    memset((char *) glopts->fixed_history, 0, sizeof(glopts->fixed_history));
+    memset((char *) glopts->bit_alloc, 0, sizeof(glopts->bit_alloc));
+    memset((char *) glopts->scfsi, 0, sizeof(glopts->scfsi));
+    memset((char *) glopts->scalar, 0, sizeof(glopts->scalar));
+    memset((char *) glopts->j_scale, 0, sizeof(glopts->j_scale));
+    memset((char *) glopts->smrdef, 0, sizeof(glopts->smrdef));
+    memset((char *) glopts->smr, 0, sizeof(glopts->smr));
+    memset((char *) glopts->max_sc, 0, sizeof(glopts->max_sc));
+
+    // Initialise subband windowfilter
+    if (init_subband(&glopts->smem, glopts->sblimit) < 0) {
+        return -1;
+    }
+    // Forget any audio history held by the psychoacoustic models
+    psycho_2_reset(glopts->p2mem);
+    psycho_4_reset(glopts->p4mem);
+    psycho_5_reset(glopts->p5mem);
+    chanthread_reset(glopts);
+
+    // Throw away any audio waiting in the ring
+    pcmring_discard(glopts);
+
+    // Reset the real-time governor
+    realtime_init(glopts);
+
+    return (0);
+}
+
+
 /**
  * This function should actually *check* the parameters to see if they
  * make sense. 
@@ -314,6 +374,18 @@ int twolame_init_params(twolame_options * glopts)
         fprintf(stderr, "Error: Can't do padding and VBR at same time\n");
         return -1;
     }
+    /* The other psycho models need floating point spectra,
+       so the default model gives way to model 0 */
+    if (glopts->fixed_point && glopts->psymodel != -1 && glopts->psymodel != 0) {
+        if (glopts->psymodel_set) {
+            fprintf(stderr,
+                    "Error: The fixed point engine only works with psycho models -1 and 0\n");
+            return -1;
+        }
+        fprintf(stderr,
+                "Warning: The fixed point engine only works with psycho models -1 and 0, using psycho model 0.\n");
+        glopts->psymodel = 0;
+    }
     // Set the Number of output channels
     glopts->num_channels_out = (glopts->mode == TWOLAME_MONO) ? 1 : 2;
 
@@ -338,28 +410,21 @@ int twolame_init_params(twolame_options * glopts)
         return -1;
     }
 
-    // Initialise interal variables
-    glopts->samples_in_buffer = 0;
-    glopts->psycount = 0;
-
-
     // Allocate memory to larger buffers 
     glopts->subband = (subband_t *) TWOLAME_MALLOC(sizeof(subband_t));
     glopts->j_sample = (jsb_sample_t *) TWOLAME_MALLOC(sizeof(jsb_sample_t));
     glopts->sb_sample = (sb_sample_t *) TWOLAME_MALLOC(sizeof(sb_sample_t));
+    if (glopts->fixed_point) {
+        glopts->fixed_sample = (fixed_sample_t *) TWOLAME_MALLOC(sizeof(fixed_sample_t));
+        glopts->fixed_j_sample = (fixed_jsb_sample_t *) TWOLAME_MALLOC(sizeof(fixed_jsb_sample_t));
+    }
 
-    // clear buffers
-    memset((char *) glopts->buffer, 0, sizeof(glopts->buffer));
-    memset((char *) glopts->bit_alloc, 0, sizeof(glopts->bit_alloc));
-    memset((char *) glopts->scfsi, 0, sizeof(glopts->scfsi));
-    memset((char *) glopts->scalar, 0, sizeof(glopts->scalar));
-    memset((char *) glopts->j_scale, 0, sizeof(glopts->j_scale));
-    memset((char *) glopts->smrdef, 0, sizeof(glopts->smrdef));
-    memset((char *) glopts->smr, 0, sizeof(glopts->smr));
-    memset((char *) glopts->max_sc, 0, sizeof(glopts->max_sc));
-
-    // Initialise subband windowfilter
-    if (init_subband(&glopts->smem) < 0) {
+    // Start the second channel's thread
+    if (chanthread_init(glopts) < 0) {
+        return -1;
+    }
+    // Initialise interal variables and buffers
+    if (reset_state(glopts) < 0) {
         return -1;
     }
     // All initalised now :)
@@ -369,80 +434,273 @@ int twolame_init_params(twolame_options * glopts)
 }
 
 
-/* Scale the samples in the frame sample buffer
+int twolame_reset(twolame_options * glopts)
+{
+    if (glopts == NULL || !glopts->twolame_init) {
+        fprintf(stderr, "Please call twolame_init_params() before twolame_reset().\n");
+        return -1;
+    }
+
+    return reset_state(glopts);
+}
+
+
+int twolame_seek_frame(twolame_options * glopts, int frame)
+{
+    int i;
+
+    if (frame < 0 || twolame_reset(glopts) < 0)
+        return -1;
+
+    // Step the padding accumulator on, exactly as encode_frame() would have done
+    for (i = 0; i < frame; i++)
+        available_bits(glopts);
+
+    // Keep quick mode in step with a serial encode
+    glopts->psycount = frame;
+
+    return 0;
+}
+
+
+/* Scale the samples in a frame sample buffer
    using the user specified values
    and downmix/upmix according to the number of input/output channels 
 */
-static void scale_and_mix_samples(twolame_options * glopts)
+static void scale_and_mix_samples(twolame_options * glopts,
+                                  short int buffer[2][TWOLAME_SAMPLES_PER_FRAME], int num_samples)
 {
-    int num_samples = glopts->samples_in_buffer;
     int i;
 
     // apply scaling to both channels 
     if (glopts->scale != 0 && glopts->scale != 1.0) {
         for (i = 0; i < num_samples; ++i) {
-            glopts->buffer[0][i] *= glopts->scale;
+            buffer[0][i] *= glopts->scale;
             if (glopts->num_channels_in == 2)
-                glopts->buffer[1][i] *= glopts->scale;
+                buffer[1][i] *= glopts->scale;
         }
     }
     // apply scaling to channel 0 (left) 
     if (glopts->scale_left != 0 && glopts->scale_left != 1.0) {
         for (i = 0; i < num_samples; ++i) {
-            glopts->buffer[0][i] *= glopts->scale_left;
+            buffer[0][i] *= glopts->scale_left;
         }
     }
     // apply scaling to channel 1 (right) 
     if (glopts->scale_right != 0 && glopts->scale_right != 1.0) {
         for (i = 0; i < num_samples; ++i) {
-            glopts->buffer[1][i] *= glopts->scale_right;
+            buffer[1][i] *= glopts->scale_right;
         }
     }
     // Downmix to Mono if 2 channels in and 1 channel out 
     if (glopts->num_channels_in == 2 && glopts->num_channels_out == 1) {
         for (i = 0; i < num_samples; ++i) {
-            glopts->buffer[0][i] = ((long) glopts->buffer[0][i] + glopts->buffer[1][i]) / 2;
-            glopts->buffer[1][i] = 0;
+            buffer[0][i] = ((long) buffer[0][i] + buffer[1][i]) / 2;
+            buffer[1][i] = 0;
         }
     }
     // Upmix to Stereo if 2 channels out and 1 channel in
     if (glopts->num_channels_in == 1 && glopts->num_channels_out == 2) {
         for (i = 0; i < num_samples; ++i) {
-            glopts->buffer[1][i] = glopts->buffer[0][i];
+            buffer[1][i] = buffer[0][i];
         }
     }
 
 }
 
+
 /*
-	Encode a single frame of audio from 1152 samples
-	Audio samples are taken from glopts->buffer
-	Encoded bit stream is placed in to parameter bs
-	(not intended for use outside the library)
-	
-	Returns the size of the frame
-	or -1 if there is an error
+	The stages of encoding a frame, which encode_frame_pcm() runs
+	one after the other.
 */
-static int encode_frame(twolame_options * glopts, bit_stream * bs)
+
+/*
+	Convert a frame of samples into the analysis history read by
+	the filterbank and the psycho models. hist[ch] is where the frame
+	goes, and the HISTORY_SIZE samples in front of it must already
+	hold the end of the previous frame. That way the 512 sample
+	filterbank window and the psycho model FFT windows are always
+	in one piece, and are read where they are.
+*/
+static void history_stage(twolame_options * glopts, const short int *buffer[2], FLOAT * hist[2])
 {
     int nch = glopts->num_channels_out;
-    int sb, ch, adb, i;
-    unsigned long frameBits, initial_bits;
-    short sam[2][1056];
+    int ch, i;
 
-    if (!glopts->twolame_init) {
-        fprintf(stderr, "Please call twolame_init_params() before starting encoding.\n");
+    for (ch = 0; ch < nch; ch++)
+        for (i = 0; i < TWOLAME_SAMPLES_PER_FRAME; i++)
+            hist[ch][i] = (FLOAT) buffer[ch][i] / SCALE;
+}
+
+
+/* Polyphase filterbank */
+static void filter_stage(twolame_options * glopts, FLOAT * hist[2], sb_sample_t * sb_sample)
+{
+    int nch = glopts->num_channels_out;
+    int gr, bl, ch;
+
+    /* New polyphase filter Combines windowing and filtering. Ricardo Feb'03 */
+    for (gr = 0; gr < 3; gr++)
+        for (bl = 0; bl < 12; bl++)
+            for (ch = 0; ch < nch; ch++)
+                window_filter_subband(&glopts->smem, &hist[ch][gr * 12 * 32 + 32 * bl],
+                                      &(*sb_sample)[ch][gr][bl][0]);
+}
+
+
+/*
+	The analysis history for the fixed point engine, which keeps the
+	16 bit samples as they are. The floating point history isn't
+	needed, as psycho models -1 and 0 don't look at the samples.
+*/
+static void history_stage_fixed(twolame_options * glopts, const short int *buffer[2])
+{
+    int nch = glopts->num_channels_out;
+    int ch;
+
+    for (ch = 0; ch < nch; ch++) {
+        memmove(glopts->fixed_history[ch], glopts->fixed_history[ch] + TWOLAME_SAMPLES_PER_FRAME,
+                HISTORY_SIZE * sizeof(short int));
+        memcpy(glopts->fixed_history[ch] + HISTORY_SIZE, buffer[ch],
+               TWOLAME_SAMPLES_PER_FRAME * sizeof(short int));
+    }
+}
+
+
+/* Polyphase filterbank in fixed point */
+static void filter_stage_fixed(twolame_options * glopts, fixed_sample_t * fixed_sample)
+{
+    int nch = glopts->num_channels_out;
+    int gr, bl, ch;
+
+    for (ch = 0; ch < nch; ch++)
+        for (gr = 0; gr < 3; gr++)
+            for (bl = 0; bl < 12; bl++)
+                window_filter_subband_fixed(&glopts->smem,
+                                            &glopts->fixed_history[ch][HISTORY_SIZE + gr * 12 * 32 +
+                                                                       32 * bl],
+                                            &(*fixed_sample)[ch][gr][bl][0]);
+}
+
+
+/* Scalefactors */
+static void scalefactor_stage(twolame_options * glopts, sb_sample_t * sb_sample,
+                              unsigned int scalar[2][3][SBLIMIT], FLOAT max_sc[2][SBLIMIT])
+{
+    int nch = glopts->num_channels_out;
+
+    scalefactor_calc(*sb_sample, scalar, nch, glopts->sblimit);
+    find_sf_max(glopts, scalar, max_sc);
+}
+
+
+/* Scalefactors of the fixed point subband samples */
+static void scalefactor_stage_fixed(twolame_options * glopts, fixed_sample_t * fixed_sample,
+                                    unsigned int scalar[2][3][SBLIMIT], FLOAT max_sc[2][SBLIMIT])
+{
+    int nch = glopts->num_channels_out;
+
+    scalefactor_calc_fixed(*fixed_sample, scalar, nch, glopts->sblimit);
+    find_sf_max(glopts, scalar, max_sc);
+}
+
+
+/* Which psycho model to run for the next frame: psymodel, or
+   RT_REUSE_SMR if quick mode says to re-use the last values */
+static int psycho_due(twolame_options * glopts, int psymodel)
+{
+    if ((glopts->quickmode == TRUE) && (++glopts->psycount % glopts->quickcount != 0))
+        return RT_REUSE_SMR;
+
+    return psymodel;
+}
+
+
+/* Signal to mask ratios from the psychoacoustic model.
+   If analysed is TRUE, models 1-4 have already been run by chanthread_analyse() */
+static int psycho_stage(twolame_options * glopts, int psymodel, int analysed, FLOAT * hist[2],
+                        sb_sample_t * sb_sample, unsigned int scalar[2][3][SBLIMIT],
+                        FLOAT max_sc[2][SBLIMIT], FLOAT smr[2][SBLIMIT])
+{
+    int nch = glopts->num_channels_out;
+    int ch, sb;
+
+    if (psymodel == RT_REUSE_SMR) {
+        /* We're using quick mode, so we're only calculating the model every 'quickcount' frames.
+           (or the real-time governor has run out of time for the psycho model)
+           Otherwise, just copy the old ones across */
+        for (ch = 0; ch < nch; ch++) {
+            for (sb = 0; sb < SBLIMIT; sb++) {
+                smr[ch][sb] = glopts->smrdef[ch][sb];
+            }
+        }
+        return 0;
+    }
+
+    // calculate the psymodel 
+    switch (psymodel) {
+    case -1:
+        psycho_n1(glopts, smr, nch);
+        break;
+    case 0:                    // Psy Model A
+        psycho_0(glopts, smr, scalar);
+        break;
+    case 1:
+        if (!analysed)
+            psycho_1(glopts, hist, max_sc, smr);
+        break;
+    case 2:
+        if (!analysed)
+            psycho_2(glopts, hist, smr);
+        break;
+    case 3:
+        // Modified psy model 1
+        if (!analysed)
+            psycho_3(glopts, hist, max_sc, smr);
+        break;
+    case 4:
+        // Modified psy model 2
+        if (!analysed)
+            psycho_4(glopts, hist, smr);
+        break;
+    case 5:
+        // Works on the subband samples, so there's nothing for the channel threads to do
+        psycho_5(glopts, *sb_sample, smr);
+        break;
+    default:
+        fprintf(stderr, "Invalid psy model specification: %i\n", psymodel);
         return -1;
+        break;
     }
-    // Scale and mix the input buffer
-    scale_and_mix_samples(glopts);
 
+    if (glopts->quickmode == TRUE || glopts->frame_budget) {
+        // copy the smr values and reuse them later 
+        for (ch = 0; ch < nch; ch++) {
+            for (sb = 0; sb < SBLIMIT; sb++)
+                glopts->smrdef[ch][sb] = smr[ch][sb];
+        }
+    }
 
-    // Clear the saved audio buffer
-    memset((char *) sam, 0, sizeof(sam));
+    return 0;
+}
+
+
+/*
+	Bit allocation, quantisation and writing the frame to the bitstream.
+	This stays frame by frame: the bitrate (for VBR) and the joint
+	stereo bound chosen for a frame are kept in the header.
 
-    // Number of bits to calculate CRC on
-    glopts->num_crc_bits = 0;
+	Returns the size of the frame
+	or -1 if there is an error
+*/
+static int output_stage(twolame_options * glopts, bit_stream * bs,
+                        const short int *buffer[2],
+                        sb_sample_t * sb_sample, jsb_sample_t * j_sample,
+                        unsigned int scalar[2][3][SBLIMIT], unsigned int j_scale[3][SBLIMIT],
+                        FLOAT smr[2][SBLIMIT])
+{
+    int adb, i;
+    unsigned long frameBits, initial_bits;
 
     // Store the number of bits initially in the bit buffer
     initial_bits = buffer_sstell(bs);
@@ -475,86 +733,36 @@ static int encode_frame(twolame_options * glopts, bit_stream * bs)
        memory. As of 26July all that needs to be done is for the frontend to buffer one frame in
        memory, such that the CRC for the next frame can be written in at the end of it. */
 
-    {
-        int gr, bl, ch;
-        /* New polyphase filter Combines windowing and filtering. Ricardo Feb'03 */
-        for (gr = 0; gr < 3; gr++)
-            for (bl = 0; bl < 12; bl++)
-                for (ch = 0; ch < nch; ch++)
-                    window_filter_subband(&glopts->smem,
-                                          &glopts->buffer[ch][gr * 12 * 32 + 32 * bl], ch,
-                                          &(*glopts->sb_sample)[ch][gr][bl][0]);
-    }
-
-    scalefactor_calc(*glopts->sb_sample, glopts->scalar, nch, glopts->sblimit);
-    find_sf_max(glopts, glopts->scalar, glopts->max_sc);
-    if (glopts->mode == TWOLAME_JOINT_STEREO) {
-        // this way we calculate more mono than we need but it is cheap 
-        combine_lr(*glopts->sb_sample, *glopts->j_sample, glopts->sblimit);
-        scalefactor_calc(glopts->j_sample, &glopts->j_scale, 1, glopts->sblimit);
-    }
+    sf_transmission_pattern(glopts, scalar, glopts->scfsi);
+    main_bit_allocation(glopts, smr, glopts->scfsi, glopts->bit_alloc, &adb);
 
-    if ((glopts->quickmode == TRUE) && (++glopts->psycount % glopts->quickcount != 0)) {
-        /* We're using quick mode, so we're only calculating the model every 'quickcount' frames.
-           Otherwise, just copy the old ones across */
-        for (ch = 0; ch < nch; ch++) {
-            for (sb = 0; sb < SBLIMIT; sb++) {
-                glopts->smr[ch][sb] = glopts->smrdef[ch][sb];
-            }
-        }
-    } else {
-        // calculate the psymodel 
-        switch (glopts->psymodel) {
-        case -1:
-            psycho_n1(glopts, glopts->smr, nch);
-            break;
-        case 0:                // Psy Model A
-            psycho_0(glopts, glopts->smr, glopts->scalar);
-            break;
-        case 1:
-            psycho_1(glopts, glopts->buffer, glopts->max_sc, glopts->smr);
-            break;
-        case 2:
-            psycho_2(glopts, glopts->buffer, sam, glopts->smr);
-            break;
-        case 3:
-            // Modified psy model 1
-            psycho_3(glopts, glopts->buffer, glopts->max_sc, glopts->smr);
-            break;
-        case 4:
-            // Modified psy model 2
-            psycho_4(glopts, glopts->buffer, sam, glopts->smr);
-            break;
-        default:
-            fprintf(stderr, "Invalid psy model specification: %i\n", glopts->psymodel);
-            return -1;
-            break;
-        }
-
-        if (glopts->quickmode == TRUE) {
-            // copy the smr values and reuse them later 
-            for (ch = 0; ch < nch; ch++) {
-                for (sb = 0; sb < SBLIMIT; sb++)
-                    glopts->smrdef[ch][sb] = glopts->smr[ch][sb];
-            }
-        }
+    /* Joint stereo samples and scalefactors, for the subbands above
+       the bound that main_bit_allocation() has just chosen */
+    if (glopts->header.mode == TWOLAME_JOINT_STEREO) {
+        if (glopts->fixed_point)
+            combine_lr_fixed(*glopts->fixed_sample, *glopts->fixed_j_sample, j_scale,
+                             glopts->jsbound, glopts->sblimit);
+        else
+            combine_lr(*sb_sample, *j_sample, j_scale, glopts->jsbound, glopts->sblimit);
     }
 
-
-    sf_transmission_pattern(glopts, glopts->scalar, glopts->scfsi);
-    main_bit_allocation(glopts, glopts->smr, glopts->scfsi, glopts->bit_alloc, &adb);
-
     write_header(glopts, bs);
 
-    // Leave space for 2 bytes of CRC to be filled in later
-    if (glopts->error_protection)
+    // Leave space for 2 bytes of CRC to be filled in later, and carry on with the CRC after them
+    if (glopts->error_protection) {
         buffer_putbits(bs, 0, 16);
+        buffer_crc_resume(bs);
+    }
 
     write_bit_alloc(glopts, glopts->bit_alloc, bs);
-    write_scalefactors(glopts, glopts->bit_alloc, glopts->scfsi, glopts->scalar, bs);
-
-    subband_quantization(glopts, glopts->scalar, *glopts->sb_sample, glopts->j_scale,
-                         *glopts->j_sample, glopts->bit_alloc, *glopts->subband);
+    write_scalefactors(glopts, glopts->bit_alloc, glopts->scfsi, scalar, bs);
+
+    if (glopts->fixed_point)
+        subband_quantization_fixed(glopts, scalar, *glopts->fixed_sample, j_scale,
+                                   *glopts->fixed_j_sample, glopts->bit_alloc, *glopts->subband);
+    else
+        subband_quantization(glopts, scalar, *sb_sample, j_scale,
+                             *j_sample, glopts->bit_alloc, *glopts->subband);
     write_samples(glopts, *glopts->subband, glopts->bit_alloc, bs);
 
     // If not all the bits were used, write out a stack of zeros 
@@ -568,15 +776,9 @@ static int encode_frame(twolame_options * glopts, bit_stream * bs)
         // input file
         buffer_putbits(bs, 0, 8);
 
-    if (glopts->do_dab) {
-        // Do the CRC calc for DAB stuff if required.
-        // It will be up to the frontend to insert it into the end of the 
-        // previous frame.
-        for (i = glopts->dab_crc_len - 1; i >= 0; i--) {
-            dab_crc_calc(glopts, glopts->bit_alloc, glopts->scfsi, glopts->scalar,
-                         &glopts->dab_crc[i], i);
-        }
-    }
+    // The CRCs for DAB were worked out by write_scalefactors().
+    // It will be up to the frontend to insert them into the end of the 
+    // previous frame.
 
     if (glopts->do_dvb_anc)
         write_dvb_bits(glopts, bs);
@@ -599,12 +801,12 @@ static int encode_frame(twolame_options * glopts, bit_stream * bs)
     }
     // Store the energy levels at the end of the frame
     if (glopts->do_energy_levels)
-        do_energy_levels(glopts, bs);
+        do_energy_levels(glopts, buffer, bs);
 
-    // MEANX: Recompute checksum from bitstream
+    // The checksum was worked out as the bits were written
     if (glopts->error_protection) {
         unsigned char *frame_ptr = bs->buf + (initial_bits >> 3);
-        crc_writeheader(frame_ptr, glopts->num_crc_bits);
+        crc_writeheader(frame_ptr, bs->crc);
     }
     // fprintf(stderr,"Frame size: %li\n\n",frameBits/8);
 
@@ -612,6 +814,88 @@ static int encode_frame(twolame_options * glopts, bit_stream * bs)
 }
 
 
+/*
+	Encode a single frame of audio from 1152 samples per channel,
+	read from buffer[0] and buffer[1] where they are
+	Encoded bit stream is placed in to parameter bs
+	(not intended for use outside the library)
+	
+	Returns the size of the frame
+	or -1 if there is an error
+*/
+static int encode_frame_pcm(twolame_options * glopts, const short int *buffer[2], bit_stream * bs)
+{
+    int psymodel = glopts->psymodel;
+    FLOAT *hist[2];
+    int bytes, ch;
+
+    if (!glopts->twolame_init) {
+        fprintf(stderr, "Please call twolame_init_params() before starting encoding.\n");
+        return -1;
+    }
+    // Start the clock for the real-time governor, and let it choose the psycho model
+    if (glopts->frame_budget) {
+        realtime_frame_start(glopts);
+        psymodel = realtime_psymodel(glopts);
+    }
+    psymodel = psycho_due(glopts, psymodel);
+
+    if (glopts->fixed_point) {
+        history_stage_fixed(glopts, buffer);
+        hist[0] = hist[1] = NULL;
+        filter_stage_fixed(glopts, glopts->fixed_sample);
+        scalefactor_stage_fixed(glopts, glopts->fixed_sample, glopts->scalar, glopts->max_sc);
+    } else {
+        // Move the end of the last frame to the front of the history, and add this one after it
+        for (ch = 0; ch < glopts->num_channels_out; ch++) {
+            memmove(glopts->history[ch], glopts->history[ch] + TWOLAME_SAMPLES_PER_FRAME,
+                    HISTORY_SIZE * sizeof(FLOAT));
+            hist[ch] = glopts->history[ch] + HISTORY_SIZE;
+        }
+        history_stage(glopts, buffer, hist);
+
+        if (glopts->chanthread != NULL) {
+            // Left and right channels at the same time
+            chanthread_analyse(glopts, psymodel, hist, glopts->sb_sample,
+                               glopts->scalar, glopts->max_sc, glopts->smr);
+        } else {
+            filter_stage(glopts, hist, glopts->sb_sample);
+            scalefactor_stage(glopts, glopts->sb_sample, glopts->scalar, glopts->max_sc);
+        }
+    }
+    if (psycho_stage(glopts, psymodel, glopts->chanthread != NULL, hist, glopts->sb_sample,
+                     glopts->scalar, glopts->max_sc, glopts->smr) < 0)
+        return -1;
+    bytes = output_stage(glopts, bs, buffer, glopts->sb_sample, glopts->j_sample,
+                         glopts->scalar, glopts->j_scale, glopts->smr);
+
+    if (glopts->frame_budget && bytes > 0)
+        realtime_frame_end(glopts);
+
+    return bytes;
+}
+
+
+/*
+	Encode a single frame of audio from the 1152 samples
+	in glopts->buffer, after scaling and mixing them
+	(not intended for use outside the library)
+*/
+static int encode_frame(twolame_options * glopts, bit_stream * bs)
+{
+    const short int *buffer[2];
+
+    // Scale and mix the input buffer
+    scale_and_mix_samples(glopts, glopts->buffer, glopts->samples_in_buffer);
+
+    buffer[0] = glopts->buffer[0];
+    buffer[1] = glopts->buffer[1];
+    return encode_frame_pcm(glopts, buffer, bs);
+}
+
+
+
+
 
 /*
   glopts
@@ -738,6 +1022,264 @@ int twolame_encode_buffer_interleaved(twolame_options * glopts,
 }
 
 
+/* Do the samples have to be changed by scale_and_mix_samples() ? */
+static int samples_need_mixing(twolame_options * glopts)
+{
+    if (glopts->scale != 0 && glopts->scale != 1.0)
+        return TRUE;
+    if (glopts->scale_left != 0 && glopts->scale_left != 1.0)
+        return TRUE;
+    if (glopts->scale_right != 0 && glopts->scale_right != 1.0)
+        return TRUE;
+
+    return glopts->num_channels_in != glopts->num_channels_out;
+}
+
+
+int twolame_encode_frame_direct(twolame_options * glopts,
+                                const short int leftpcm[],
+                                const short int rightpcm[],
+                                unsigned char *mp2buffer, int mp2buffer_size)
+{
+    const short int *buffer[2];
+    bit_stream *mybs;
+    int bytes;
+
+    if (glopts->samples_in_buffer != 0) {
+        fprintf(stderr,
+                "twolame_encode_frame_direct: %d samples from an earlier call are waiting to be encoded.\n",
+                glopts->samples_in_buffer);
+        return -1;
+    }
+    // The caller's samples mustn't be changed, so scaling and mixing needs a copy
+    if (samples_need_mixing(glopts))
+        return twolame_encode_buffer(glopts, leftpcm, rightpcm, TWOLAME_SAMPLES_PER_FRAME,
+                                     mp2buffer, mp2buffer_size);
+
+    buffer[0] = leftpcm;
+    // The right channel of mono audio is only read by the energy levels, and is silent
+    buffer[1] = (glopts->num_channels_in == 2) ? rightpcm : glopts->buffer[1];
+
+    mybs = buffer_init(mp2buffer, mp2buffer_size);
+    bytes = encode_frame_pcm(glopts, buffer, mybs);
+    buffer_deinit(&mybs);
+
+    return bytes;
+}
+
+
+/* Do the streams of a multi-stream encoder need their own history for the psycho model ? */
+static int psycho_needs_history(twolame_options * glopts)
+{
+    return glopts->psymodel >= 1 && glopts->psymodel <= 4;
+}
+
+
+twolame_multi *twolame_multi_init(twolame_options * glopts[], int num_streams)
+{
+    twolame_multi *multi = NULL;
+    int s, b, l, i;
+
+    if (num_streams < 1 || num_streams > TWOLAME_MAX_STREAMS) {
+        fprintf(stderr, "twolame_multi_init: can't encode %d streams at once (1 to %d).\n",
+                num_streams, TWOLAME_MAX_STREAMS);
+        return NULL;
+    }
+    for (s = 0; s < num_streams; s++) {
+        twolame_options *opts = glopts[s];
+
+        if (!opts->twolame_init) {
+            fprintf(stderr, "Please call twolame_init_params() before starting encoding.\n");
+            return NULL;
+        }
+        if (opts->num_channels_in != 1 || opts->num_channels_out != 1
+            || opts->samplerate_out != glopts[0]->samplerate_out
+            || opts->bitrate != glopts[0]->bitrate || opts->mode != glopts[0]->mode
+            || opts->vbr != glopts[0]->vbr || opts->sblimit != glopts[0]->sblimit
+            || opts->fixed_point || opts->frame_budget) {
+            fprintf(stderr, "twolame_multi_init: stream %d can't be encoded with the others.\n",
+                    s);
+            return NULL;
+        }
+        for (i = 0; i < s; i++) {
+            if (glopts[i] == opts) {
+                fprintf(stderr, "twolame_multi_init: stream %d is also stream %d.\n", s, i);
+                return NULL;
+            }
+        }
+    }
+
+    multi = (twolame_multi *) TWOLAME_MALLOC(sizeof(twolame_multi));
+    if (multi == NULL)
+        return NULL;
+    multi->num_streams = num_streams;
+    multi->num_blocks = num_streams / LANE_BLOCK;
+    for (s = 0; s < num_streams; s++)
+        multi->glopts[s] = glopts[s];
+
+    if (multi->num_blocks > 0) {
+        multi->lanes = (multi_lanes *) TWOLAME_MALLOC(multi->num_blocks * sizeof(multi_lanes));
+        if (multi->lanes == NULL) {
+            TWOLAME_FREE(multi);
+            return NULL;
+        }
+    }
+    // Carry on from where each stream has got to
+    for (b = 0; b < multi->num_blocks; b++)
+        for (l = 0; l < LANE_BLOCK; l++)
+            for (i = 0; i < HISTORY_SIZE + TWOLAME_SAMPLES_PER_FRAME; i++)
+                multi->lanes[b].history[i][l] = glopts[b * LANE_BLOCK + l]->history[0][i];
+
+    return multi;
+}
+
+
+/*
+	Move a block's history on by a frame, and add this frame
+	of each of its streams to the end of it
+*/
+static void lanes_history_stage(twolame_multi * multi, int b, const short int *buffer[][2])
+{
+    FLOAT (*history)[LANE_BLOCK] = multi->lanes[b].history;
+    int i, l;
+
+    memmove(history[0], history[TWOLAME_SAMPLES_PER_FRAME],
+            HISTORY_SIZE * LANE_BLOCK * sizeof(FLOAT));
+    for (l = 0; l < LANE_BLOCK; l++) {
+        const short int *pcm = buffer[b * LANE_BLOCK + l][0];
+
+        for (i = 0; i < TWOLAME_SAMPLES_PER_FRAME; i++)
+            history[HISTORY_SIZE + i][l] = (FLOAT) pcm[i] / SCALE;
+    }
+}
+
+
+/* Polyphase filterbank for a block of streams, one in each lane */
+static void lanes_filter_stage(twolame_multi * multi, int b)
+{
+    multi_lanes *lanes = &multi->lanes[b];
+    twolame_options **glopts = &multi->glopts[b * LANE_BLOCK];
+    FLOAT *sample[LANE_BLOCK];
+    int gr, bl, sb, l;
+
+    for (gr = 0; gr < 3; gr++)
+        for (bl = 0; bl < 12; bl++) {
+            window_filter_subband_lanes(&glopts[0]->smem,
+                                        lanes->history[HISTORY_SIZE + gr * 12 * 32 + 32 * bl],
+                                        lanes->sb_sample);
+            for (l = 0; l < LANE_BLOCK; l++)
+                sample[l] = (*glopts[l]->sb_sample)[0][gr][bl];
+            for (sb = 0; sb < SBLIMIT; sb++)
+                for (l = 0; l < LANE_BLOCK; l++)
+                    sample[l][sb] = lanes->sb_sample[sb][l];
+        }
+}
+
+
+int twolame_encode_frame_multi(twolame_multi * multi, const short int *pcm[],
+                               unsigned char *mp2buffer[], int mp2buffer_size, int mp2_size[])
+{
+    const short int *buffer[TWOLAME_MAX_STREAMS][2];
+    FLOAT *hist[TWOLAME_MAX_STREAMS][2];
+    int psymodel[TWOLAME_MAX_STREAMS];
+    int laned = multi->num_blocks * LANE_BLOCK;
+    int mp2_total = 0;
+    int s, b, i;
+
+    // Nothing can fail after this unless the encoder is broken,
+    // so no stream is changed until it has been checked
+    for (s = 0; s < multi->num_streams; s++) {
+        if (multi->glopts[s]->samples_in_buffer != 0) {
+            fprintf(stderr,
+                    "twolame_encode_frame_multi: %d samples from an earlier call are waiting to be encoded.\n",
+                    multi->glopts[s]->samples_in_buffer);
+            return -1;
+        }
+    }
+
+    for (s = 0; s < multi->num_streams; s++) {
+        twolame_options *opts = multi->glopts[s];
+
+        psymodel[s] = psycho_due(opts, opts->psymodel);
+
+        // The caller's samples mustn't be changed, so scaling needs a copy
+        if (samples_need_mixing(opts)) {
+            for (i = 0; i < TWOLAME_SAMPLES_PER_FRAME; i++)
+                opts->buffer[0][i] = pcm[s][i];
+            scale_and_mix_samples(opts, opts->buffer, TWOLAME_SAMPLES_PER_FRAME);
+            buffer[s][0] = opts->buffer[0];
+        } else {
+            buffer[s][0] = pcm[s];
+        }
+        buffer[s][1] = opts->buffer[1];
+
+        // The streams in the lanes only need their own history for the psycho model
+        hist[s][0] = hist[s][1] = NULL;
+        if (s >= laned || psycho_needs_history(opts)) {
+            memmove(opts->history[0], opts->history[0] + TWOLAME_SAMPLES_PER_FRAME,
+                    HISTORY_SIZE * sizeof(FLOAT));
+            hist[s][0] = opts->history[0] + HISTORY_SIZE;
+            hist[s][1] = opts->history[1] + HISTORY_SIZE;
+            history_stage(opts, buffer[s], hist[s]);
+        }
+    }
+
+    for (b = 0; b < multi->num_blocks; b++) {
+        lanes_history_stage(multi, b, buffer);
+        lanes_filter_stage(multi, b);
+    }
+    for (s = laned; s < multi->num_streams; s++)
+        filter_stage(multi->glopts[s], hist[s], multi->glopts[s]->sb_sample);
+
+    for (s = 0; s < multi->num_streams; s++) {
+        twolame_options *opts = multi->glopts[s];
+        bit_stream *mybs;
+        int bytes;
+
+        scalefactor_stage(opts, opts->sb_sample, opts->scalar, opts->max_sc);
+        if (psycho_stage(opts, psymodel[s], FALSE, hist[s], opts->sb_sample,
+                         opts->scalar, opts->max_sc, opts->smr) < 0)
+            return -1;
+
+        mybs = buffer_init(mp2buffer[s], mp2buffer_size);
+        bytes = output_stage(opts, mybs, buffer[s], opts->sb_sample, opts->j_sample,
+                             opts->scalar, opts->j_scale, opts->smr);
+        buffer_deinit(&mybs);
+        if (bytes <= 0)
+            return bytes;
+
+        mp2_size[s] = bytes;
+        mp2_total += bytes;
+    }
+
+    return mp2_total;
+}
+
+
+void twolame_multi_close(twolame_multi ** multi)
+{
+    twolame_multi *m = NULL;
+    int b, l, i;
+
+    // Check input pointers aren't NULL
+    if (multi == NULL)
+        return;
+    m = *multi;
+    if (m == NULL)
+        return;
+
+    // Hand each stream's history back, so that it can carry on by itself
+    for (b = 0; b < m->num_blocks; b++)
+        for (l = 0; l < LANE_BLOCK; l++)
+            for (i = 0; i < HISTORY_SIZE + TWOLAME_SAMPLES_PER_FRAME; i++)
+                m->glopts[b * LANE_BLOCK + l]->history[0][i] = m->lanes[b].history[i][l];
+
+    TWOLAME_FREE(m->lanes);
+    TWOLAME_FREE(m);
+    *multi = NULL;
+}
+
+
 static void float32_to_short(const float in[], short out[], int num_samples, int stride)
 {
     int n;
@@ -888,6 +1430,9 @@ int twolame_encode_flush(twolame_options * glopts, unsigned char *mp2buffer, int
     int mp2_size = 0;
     int i;
 
+    // Take the last few samples out of the ring
+    pcmring_flush(glopts);
+
     if (glopts->samples_in_buffer == 0) {
         // No samples left over
         return 0;
@@ -924,8 +1469,13 @@ void twolame_close(twolame_options ** glopts)
     if (opts == NULL)
         return;
 
+    // stop the channel thread before freeing the memory it uses
+    chanthread_deinit(opts);
+    pcmring_deinit(opts);
+
     // free mem
     psycho_4_deinit(&opts->p4mem);
+    psycho_5_deinit(&opts->p5mem);
     psycho_3_deinit(&opts->p3mem);
     psycho_2_deinit(&opts->p2mem);
     psycho_1_deinit(&opts->p1mem);
@@ -934,6 +1484,8 @@ void twolame_close(twolame_options ** glopts)
     TWOLAME_FREE(opts->subband);
     TWOLAME_FREE(opts->j_sample);
     TWOLAME_FREE(opts->sb_sample);
+    TWOLAME_FREE(opts->fixed_sample);
+    TWOLAME_FREE(opts->fixed_j_sample);
 
     // Free the memory and zero the pointer
     TWOLAME_FREE(opts);
@@ -137,9 +137,40 @@ typedef struct {
     int acm_compr;
 } TWOLAME_dvb_anc;
 
+/** Statistics from the real-time governor. */
+typedef struct {
+    int frames;                 /**< Number of frames encoded */
+    int frames_over_budget;     /**< Number of frames that took longer than the budget */
+    int degrade_events;         /**< Number of times a cheaper psycho model was chosen */
+    int recover_events;         /**< Number of times a better psycho model was restored */
+    int reused_frames;          /**< Number of frames that re-used old psycho model values */
+    int level;                  /**< Current degradation level (0 = as configured) */
+    int psymodel;               /**< Psycho model currently (or last) in use */
+    int reusing;                /**< TRUE if old psycho model values are being re-used */
+    int last_frame_usec;        /**< Time taken to encode the last frame (microseconds) */
+    int max_frame_usec;         /**< Longest time taken to encode a frame (microseconds) */
+} TWOLAME_realtime_stats;
+
+/** Statistics from the real-time input ring (see twolame_ring_init()). */
+typedef struct {
+    unsigned long size;         /**< Size of the ring (samples per channel) */
+    unsigned long fill;         /**< Samples waiting in the ring */
+    unsigned long max_fill;     /**< Most samples there have been waiting in the ring */
+    unsigned long overruns;     /**< Number of pushes that found the ring full */
+    unsigned long dropped_samples;  /**< Number of samples lost to overruns */
+    unsigned long underruns;    /**< Number of polls that found less than a frame */
+    unsigned long frames;       /**< Number of frames encoded from the ring */
+} TWOLAME_ring_stats;
+
 /** Number of samples per frame of Layer 2 MPEG Audio */
 #define TWOLAME_SAMPLES_PER_FRAME		(1152)
 
+/** Largest possible frame of Layer 2 MPEG Audio, in bytes (384 kbps at 32 kHz, padded) */
+#define TWOLAME_MAX_FRAME_BYTES		(1730)
+
+/** Most streams that twolame_encode_frame_multi() can encode at once */
+#define TWOLAME_MAX_STREAMS		(16)
+
 
 /** Opaque structure for the twolame encoder options. */
     struct twolame_options_struct;
@@ -147,6 +178,12 @@ typedef struct {
 /** Opaque data type for the twolame encoder options. */
     typedef struct twolame_options_struct twolame_options;
 
+/** Opaque structure for a multi-stream encoder. */
+    struct twolame_multi_struct;
+
+/** Opaque data type for a multi-stream encoder (see twolame_multi_init()). */
+    typedef struct twolame_multi_struct twolame_multi;
+
 
 
 
@@ -246,6 +283,157 @@ typedef struct {
                                                      unsigned char *mp2buffer, int mp2buffer_size);
 
 
+/** Encode exactly one frame of 16-bit PCM audio to MP2, without copying it.
+ *
+ *	The audio is read from leftpcm and rightpcm where it is, instead
+ *	of being copied into the encoder's own buffer first, and the
+ *	caller's buffers are never written to. Only the few samples the
+ *	filterbank and psycho-acoustic model need from one frame to the
+ *	next are kept by the library.
+ *
+ *	There must not be any samples left over from twolame_encode_buffer()
+ *	waiting to be encoded. If the audio has to be scaled or mixed between
+ *	mono and stereo it is copied as usual.
+ *
+ *	\param glopts			twolame options pointer
+ *	\param leftpcm			TWOLAME_SAMPLES_PER_FRAME left channel audio samples
+ *	\param rightpcm			TWOLAME_SAMPLES_PER_FRAME right channel audio samples
+ *							(may be NULL for mono input)
+ *	\param mp2buffer		Buffer to place encoded audio into
+ *	\param mp2buffer_size	Size of the output buffer
+ *	
+ *	\return					The number of bytes put in output buffer
+ *							or a negative value on error
+ */
+    DLL_EXPORT int twolame_encode_frame_direct(twolame_options * glopts,
+                                               const short int leftpcm[],
+                                               const short int rightpcm[],
+                                               unsigned char *mp2buffer, int mp2buffer_size);
+
+
+/** Set up an encoder for several mono streams at once.
+ *
+ *	The streams are separate encoders with the same settings (set up
+ *	with twolame_init_params() as usual), each making its own bitstream.
+ *	twolame_encode_frame_multi() encodes a frame of each of them in
+ *	lockstep, but only the polyphase filterbank is shared: it runs
+ *	over blocks of four streams, one stream to a lane, and the
+ *	history of each block is kept interleaved from one frame to the
+ *	next. The scalefactors, the psycho model and the quantization
+ *	run over each stream in turn. The output is exactly the same as
+ *	encoding each stream on its own with twolame_encode_frame_direct().
+ *
+ *	The streams must all have one channel in and out, the same sample
+ *	rate, bitrate, mode and VBR setting, and not use the fixed point
+ *	engine or the real-time governor. Until twolame_multi_close(),
+ *	they must only be encoded with twolame_encode_frame_multi().
+ *
+ *	\param glopts			array of num_streams twolame options pointers
+ *	\param num_streams		Number of streams (1 to TWOLAME_MAX_STREAMS)
+ *	\return					pointer to the multi-stream encoder,
+ *							or NULL if the streams can't be encoded together
+ */
+    DLL_EXPORT twolame_multi *twolame_multi_init(twolame_options * glopts[], int num_streams);
+
+
+/** Encode a frame of audio for each stream of a multi-stream encoder.
+ *
+ *	None of the streams may have samples left over from
+ *	twolame_encode_buffer() waiting to be encoded; this is checked
+ *	before any stream is touched. If encoding still fails part of
+ *	the way through, the streams are left out of step: close the
+ *	multi-stream encoder and reset each stream with twolame_reset().
+ *
+ *	\param multi			pointer to the multi-stream encoder
+ *	\param pcm				TWOLAME_SAMPLES_PER_FRAME audio samples for each stream
+ *	\param mp2buffer		Buffer to place each stream's encoded audio into
+ *	\param mp2buffer_size	Size of each of the output buffers
+ *	\param mp2_size			The number of bytes put in each output buffer
+ *	
+ *	\return					The number of bytes put in all the output buffers
+ *							or a negative value on error
+ */
+    DLL_EXPORT int twolame_encode_frame_multi(twolame_multi * multi, const short int *pcm[],
+                                              unsigned char *mp2buffer[], int mp2buffer_size,
+                                              int mp2_size[]);
+
+
+/** Shut down a multi-stream encoder.
+ *
+ *	Each stream is handed its history back, so it can carry on
+ *	being encoded by itself. The streams aren't closed.
+ *
+ *	\param multi			pointer to the multi-stream encoder pointer
+ */
+    DLL_EXPORT void twolame_multi_close(twolame_multi ** multi);
+
+
+/** Create a ring for passing PCM audio from a real-time thread.
+ *
+ *	The ring is for when audio arrives on a thread which mustn't
+ *	block or allocate memory, such as an audio capture callback.
+ *	That thread (the producer) copies audio into the ring with
+ *	twolame_ring_push(), and one other thread (the consumer) encodes
+ *	it with twolame_poll(). Neither of them ever waits for the
+ *	other, and nothing is allocated after this call.
+ *
+ *	All other calls on these options, including
+ *	twolame_encode_flush() at the end, must be made by the consumer.
+ *
+ *	\param glopts			twolame options pointer
+ *	\param num_frames		Size of the ring in frames of audio
+ *							(of 1152 samples per channel, at least 2)
+ *	\return					0 if successful, 
+ *							or a negative value on error
+ */
+    DLL_EXPORT int twolame_ring_init(twolame_options * glopts, int num_frames);
+
+
+/** Add some 16-bit PCM audio to the ring.
+ *
+ *	Called by the producer. Never blocks. If there isn't room for
+ *	all of the audio then as much as fits is copied, the rest is
+ *	dropped and an overrun is counted.
+ *
+ *	\param glopts			twolame options pointer
+ *	\param pcm				Audio samples (interleaved if there are two channels)
+ *	\param num_samples		Number of samples per channel
+ *	\return					The number of samples per channel copied into the ring
+ *							or a negative value on error
+ */
+    DLL_EXPORT int twolame_ring_push(twolame_options * glopts, const short int pcm[],
+                                     int num_samples);
+
+
+/** Encode the audio waiting in the ring.
+ *
+ *	Called by the consumer. Encodes every whole frame of audio
+ *	in the ring, as long as there is room for another
+ *	TWOLAME_MAX_FRAME_BYTES in mp2buffer. If there isn't a whole
+ *	frame waiting, an underrun is counted.
+ *
+ *	\param glopts			twolame options pointer
+ *	\param mp2buffer		Buffer to place encoded audio into
+ *	\param mp2buffer_size	Size of the output buffer
+ *	\return					The number of bytes put in output buffer
+ *							or a negative value on error
+ */
+    DLL_EXPORT int twolame_poll(twolame_options * glopts, unsigned char *mp2buffer,
+                                int mp2buffer_size);
+
+
+/** Get the overrun and underrun counters for the ring.
+ *
+ *	Can be called from any thread, but the figures may be 
+ *	slightly out of date when called by the producer.
+ *
+ *	\param glopts	twolame options pointer
+ *	\param stats	structure to copy the statistics into
+ *	\return			0 if successful, -1 if stats is NULL
+ */
+    DLL_EXPORT int twolame_get_ring_stats(twolame_options * glopts, TWOLAME_ring_stats * stats);
+
+
 /** Encode some 32-bit PCM audio to MP2.
  *
  *	Takes 32-bit floating point PCM audio samples from seperate 
@@ -292,8 +480,9 @@ typedef struct {
 /** Encode any remains buffered PCM audio to MP2.
  *
  *	Encodes any remaining audio samples in the libtwolame
- *	internal sample buffer. This function will return at
- *	most a single frame of MPEG Audio, and at least 0 frames.
+ *	internal sample buffer (and in the ring, if there is one).
+ *	This function will return at most a single frame of MPEG
+ *	Audio, and at least 0 frames.
  *	
  *	\param glopts			twolame options pointer
  *	\param mp2buffer		Buffer to place encoded audio into
@@ -305,6 +494,44 @@ typedef struct {
                                         unsigned char *mp2buffer, int mp2buffer_size);
 
 
+/** Reset the encoder ready to encode a new stream.
+ *
+ *	Discards any buffered PCM audio and all of the state
+ *	carried between frames (filterbank and psychoacoustic
+ *	model history, padding, statistics), so that the next
+ *	frame is encoded exactly as it would be by a freshly
+ *	initialised encoder with the same parameters.
+ *	This is much cheaper than closing and re-initialising
+ *	when encoding many files with the same settings.
+ *	Call twolame_encode_flush() first if you still want
+ *	the buffered audio.
+ *
+ *	\param glopts			twolame options pointer
+ *	\return					0 if successful,
+ *							-1 if twolame_init_params() has not been called
+ */
+    DLL_EXPORT int twolame_reset(twolame_options * glopts);
+
+
+/** Reset the encoder ready to start encoding part way through a stream.
+ *
+ *	As twolame_reset(), but the next frame encoded will be
+ *	treated as frame number 'frame' of the stream: the
+ *	padding pattern and quick mode counter are set to
+ *	what they would be if the earlier frames had been encoded.
+ *	The filterbank and psychoacoustic models can't know about
+ *	the earlier audio, so to get the same output as encoding
+ *	the whole stream, start a few frames early and throw
+ *	away those frames (two is enough, or twice the quick
+ *	mode count if quick mode is on).
+ *
+ *	\param glopts			twolame options pointer
+ *	\param frame			number of the next frame (0 is the first)
+ *	\return					0 if successful, -1 on error
+ */
+    DLL_EXPORT int twolame_seek_frame(twolame_options * glopts, int frame);
+
+
 /** Shut down the twolame encoder.
  *
  *	Shuts down the twolame encoder and frees all memory
@@ -410,7 +637,34 @@ typedef struct {
     DLL_EXPORT int twolame_get_framelength(twolame_options * glopts);
 
 
+/** Get the algorithmic delay of the encoder, in samples.
+ *
+ *	This is the number of samples by which the audio carried
+ *	in the MPEG stream lags the PCM audio given to the encoder,
+ *	caused by the polyphase analysis filterbank.
+ *
+ *	The psychoacoustic models never look at samples beyond the
+ *	frame being encoded, and a frame is encoded and returned by
+ *	the twolame_encode_buffer*() call that supplies its last sample.
+ *	So for live encoding the mouth-to-ear delay added by the
+ *	encoder is this value plus the time taken to fill a frame
+ *	(at most TWOLAME_SAMPLES_PER_FRAME samples, if PCM is fed
+ *	in as it arrives). A decoder adds the delay of its synthesis
+ *	filterbank (typically a further 241 samples).
+ *
+ *	\param glopts			pointer to twolame options pointer
+ *	\return					the encoder delay in samples, or -1 if
+ *							twolame_init_params() hasn't been called
+ *
+ */
+    DLL_EXPORT int twolame_get_encoder_delay(twolame_options * glopts);
+
+
 /** Set the Psychoacoustic Model used to encode the audio.
+ *
+ *	Models -1 to 5 are available (see doc/psycho.txt).
+ *	Model 5 works from the subband samples rather than an FFT,
+ *	so it is nearly as cheap as model 0.
  *
  *	Default: 3
  *
@@ -897,6 +1151,194 @@ typedef struct {
     DLL_EXPORT int twolame_get_quick_count(twolame_options * glopts);
 
 
+/** Set the time allowed to encode each frame (real-time governor).
+ *
+ *	When a budget is set, the time taken to encode every frame
+ *	is measured. If a frame takes longer than the budget, the
+ *	encoder steps down to a cheaper psychoacoustic model
+ *	(4 -> 3 -> 1 -> 5 -> 0), and finally to re-using the values
+ *	from the last frame that was analysed, as quick mode does.
+ *	Once there is plenty of headroom again, it steps back up
+ *	towards the model chosen with twolame_set_psymodel().
+ *
+ *	For real-time encoding the budget should be a little less
+ *	than the duration of a frame (1152 samples).
+ *
+ *	Default: 0 (no budget, governor disabled)
+ *
+ *	\param glopts			pointer to twolame options pointer
+ *	\param usec				time allowed per frame in microseconds
+ *	\return					0 if successful, 
+ *							non-zero on failure
+ */
+    DLL_EXPORT int twolame_set_frame_budget(twolame_options * glopts, int usec);
+
+/** Get the time allowed to encode each frame.
+ *
+ *	\param glopts	pointer to twolame options pointer
+ *	\return			time allowed per frame in microseconds (0 = no limit)
+ */
+    DLL_EXPORT int twolame_get_frame_budget(twolame_options * glopts);
+
+
+/** Enable/Disable channel threads.
+ *
+ *	In stereo, analyse the right channel (filterbank, scalefactors
+ *	and psychoacoustic model) on a second thread while the left
+ *	channel is analysed on the calling thread. This nearly halves
+ *	the time taken to encode each frame when there is a spare
+ *	CPU core, which is useful for low latency live encoding.
+ *	The output is exactly the same as without threads.
+ *
+ *	It has no effect for mono output, or if libtwolame was built
+ *	without pthreads.
+ *
+ *	Default: FALSE
+ *
+ *	\param glopts			pointer to twolame options pointer
+ *	\param channel_threads	TRUE to use a second thread
+ *	\return					0 if successful, 
+ *							non-zero on failure
+ */
+    DLL_EXPORT int twolame_set_channel_threads(twolame_options * glopts, int channel_threads);
+
+/** Get the channel threads setting.
+ *
+ *	\param glopts	pointer to twolame options pointer
+ *	\return			TRUE if channel threads are enabled
+ */
+    DLL_EXPORT int twolame_get_channel_threads(twolame_options * glopts);
+
+
+/** Set the CPU to run the second channel's thread on.
+ *
+ *	Pins the thread started by twolame_set_channel_threads()
+ *	to a single CPU, where the system supports it.
+ *	It is up to the application to pin the calling thread
+ *	(which analyses the left channel) to a different CPU.
+ *
+ *	Default: -1 (not pinned)
+ *
+ *	\param glopts			pointer to twolame options pointer
+ *	\param cpu				CPU number, or -1 to let the system choose
+ *	\return					0 if successful, 
+ *							non-zero on failure
+ */
+    DLL_EXPORT int twolame_set_channel_thread_cpu(twolame_options * glopts, int cpu);
+
+/** Get the CPU that the second channel's thread is pinned to.
+ *
+ *	\param glopts	pointer to twolame options pointer
+ *	\return			CPU number, or -1 if not pinned
+ */
+    DLL_EXPORT int twolame_get_channel_thread_cpu(twolame_options * glopts);
+
+
+/** Enable/Disable single run psycho models 2 and 4.
+ *
+ *	Psycho models 2 and 4 normally analyse two overlapping
+ *	windows of each frame and use the higher of the two
+ *	signal to mask ratios for each subband. In single run
+ *	mode they analyse a single window centred on the frame
+ *	instead, which takes about half the time. The output is
+ *	slightly different: the ratios are a little lower,
+ *	so slightly fewer bits are spent on each frame.
+ *	It has no effect on the other psycho models.
+ *
+ *	Default: FALSE
+ *
+ *	\param glopts			pointer to twolame options pointer
+ *	\param single_run		TRUE to analyse one window per frame
+ *	\return					0 if successful, 
+ *							non-zero on failure
+ */
+    DLL_EXPORT int twolame_set_psy_single_run(twolame_options * glopts, int single_run);
+
+/** Get the single run psycho model setting.
+ *
+ *	\param glopts	pointer to twolame options pointer
+ *	\return			TRUE if psycho models 2 and 4 analyse one window per frame
+ */
+    DLL_EXPORT int twolame_get_psy_single_run(twolame_options * glopts);
+
+
+/** Set the lowpass frequency.
+ *
+ *	Subbands which lie entirely above this frequency are not
+ *	coded, and the filterbank, psycho model, scalefactor and
+ *	bit allocation stages all skip them. Each subband is
+ *	1/64th of the sampling frequency wide, so the cutoff is
+ *	rounded up to the top of the subband it falls in.
+ *	The bitrate already limits the subbands coded (to 8 of
+ *	the 32 at 48kbps per channel and 44.1kHz), and the lowpass
+ *	can only lower this.
+ *
+ *	Default: 0 (no lowpass)
+ *
+ *	\param glopts		pointer to twolame options pointer
+ *	\param lowpass		frequency in Hz, or 0 for none
+ *	\return				0 if successful, 
+ *						non-zero on failure
+ */
+    DLL_EXPORT int twolame_set_lowpass(twolame_options * glopts, int lowpass);
+
+/** Get the lowpass frequency.
+ *
+ *	\param glopts	pointer to twolame options pointer
+ *	\return			frequency in Hz, or 0 for none
+ */
+    DLL_EXPORT int twolame_get_lowpass(twolame_options * glopts);
+
+
+/** Enable/Disable the fixed point engine.
+ *
+ *	The analysis history, the filterbank, the scalefactors,
+ *	the joint stereo samples and the quantization are worked
+ *	out with integers (the subband samples are in Q28) rather
+ *	than floating point, so nothing is done in floating point
+ *	for each sample. Only psycho models -1 and 0 can be used,
+ *	as the others work on floating point spectra: model 0 is
+ *	used if no model was chosen with twolame_set_psymodel(),
+ *	and any other model is an error in twolame_init_params().
+ *	The psycho model and the bit allocation still use floating
+ *	point for each subband. The output is not bit-identical to the
+ *	floating point engine, but very close: tests/fixedbench
+ *	reports how close. The fixed point engine encodes a frame
+ *	at a time, without the channel threads.
+ *
+ *	Must be called before twolame_init_params().
+ *
+ *	Default: FALSE
+ *
+ *	\param glopts		pointer to twolame options pointer
+ *	\param fixed_point	fixed point engine state (TRUE/FALSE)
+ *	\return				0 if successful, 
+ *						non-zero on failure
+ */
+    DLL_EXPORT int twolame_set_fixed_point(twolame_options * glopts, int fixed_point);
+
+/** Get the state of the fixed point engine.
+ *
+ *	\param glopts	pointer to twolame options pointer
+ *	\return			TRUE if the fixed point engine is used
+ */
+    DLL_EXPORT int twolame_get_fixed_point(twolame_options * glopts);
+
+
+/** Get statistics from the real-time governor.
+ *
+ *	The counters are reset by twolame_init_params().
+ *	Check degrade_events to find out if the encoder has had to
+ *	lower the quality to keep up.
+ *
+ *	\param glopts	pointer to twolame options pointer
+ *	\param stats	structure to copy the statistics into
+ *	\return			0 if successful, -1 if stats is NULL
+ */
+    DLL_EXPORT int twolame_get_realtime_stats(twolame_options * glopts,
+                                              TWOLAME_realtime_stats * stats);
+
+
 
 
 
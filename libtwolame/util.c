@@ -171,6 +171,22 @@ int twolame_get_framelength(twolame_options * glopts)
 }
 
 
+// Get the algorithmic delay of the encoder, in samples
+// The analysis window is HAN_SIZE samples long, ending with the newest
+// SBLIMIT, and is centred half way back, less the SBLIMIT/2 sample
+// shift built into the filterbank phase (240 samples).
+// None of the psycho models look ahead of the frame being encoded
+// and frames are output as soon as they are complete, so there
+// is no other delay inside the library.
+int twolame_get_encoder_delay(twolame_options * glopts)
+{
+    if (glopts == NULL || !glopts->twolame_init)
+        return -1;
+
+    return HAN_SIZE / 2 - SBLIMIT / 2;
+}
+
+
 
 // Print the library version and 
 //  encoder parameter settings to STDERR
@@ -231,6 +247,11 @@ void twolame_print_config(twolame_options * glopts)
             }
 
             fprintf(fd, " - ATH adjustment %f\n", twolame_get_ATH_level(glopts));
+            if (twolame_get_lowpass(glopts))
+                fprintf(fd, " - Lowpass at %i Hz (coding %i subbands)\n",
+                        twolame_get_lowpass(glopts), glopts->sblimit);
+            if (twolame_get_fixed_point(glopts))
+                fprintf(fd, " - Fixed point engine\n");
             if (twolame_get_num_ancillary_bits(glopts))
                 fprintf(fd, " - Reserving %i ancillary bits\n",
                         twolame_get_num_ancillary_bits(glopts));
@@ -0,0 +1,55 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "benchutil.h"
+
+
+/*
+  Helpers shared by the benchmarks in this directory.
+*/
+
+
+double bench_seconds(clock_t start)
+{
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+void bench_signal(short int *pcm, int samples, double f1, double f2, double level)
+{
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        double x = 0.3 * sin(i * f1) + 0.2 * sin(i * f2) * sin(i * 0.0007)
+            + 0.05 * (rand() / (double) RAND_MAX - 0.5);
+        pcm[i] = (short int) (level * x * 32767);
+    }
+}
+
+
+// vim:ts=4:sw=4:nowrap:
@@ -0,0 +1,42 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+
+#ifndef TWOLAME_BENCHUTIL_H
+#define TWOLAME_BENCHUTIL_H
+
+#include <time.h>
+
+
+/* Seconds of CPU time since start */
+double bench_seconds(clock_t start);
+
+/* Fill pcm with two tones and a little noise, the second tone
+   fading in and out; level scales the whole signal (1.0 is about
+   half of full scale). Uses rand(), so srand() first. */
+void bench_signal(short int *pcm, int samples, double f1, double f2, double level);
+
+#endif
+
+
+// vim:ts=4:sw=4:nowrap:
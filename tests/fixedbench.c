@@ -0,0 +1,148 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "twolame.h"
+#include "common.h"
+#include "bitbuffer.h"
+#include "subband.h"
+#include "encode.h"
+#include "benchutil.h"
+
+
+/*
+  Micro-benchmark for the fixed point engine.
+
+  Makes up some audio from two tones and a little noise, and runs
+  it through the floating point and the fixed point filterbanks.
+  Reports the signal to noise ratio of the fixed point subband
+  samples (taking the floating point ones as the signal), how many
+  of the scalefactors come out differently, and the time taken by
+  each filterbank.
+
+  Usage: fixedbench [frames]
+*/
+
+#define SAMPLES		(HISTORY_SIZE + TWOLAME_SAMPLES_PER_FRAME)
+
+
+/* Filter one frame of pcm (starting HISTORY_SIZE samples in) both ways */
+static void filter_float(subband_mem * smem, const FLOAT * pcm,
+                         FLOAT sb_sample[1][3][SCALE_BLOCK][SBLIMIT])
+{
+    int gr, bl;
+
+    for (gr = 0; gr < 3; gr++)
+        for (bl = 0; bl < SCALE_BLOCK; bl++)
+            window_filter_subband(smem, &pcm[HISTORY_SIZE + gr * 12 * 32 + 32 * bl],
+                                  sb_sample[0][gr][bl]);
+}
+
+static void filter_fixed(subband_mem * smem, const short int *pcm,
+                         int sb_sample[1][3][SCALE_BLOCK][SBLIMIT])
+{
+    int gr, bl;
+
+    for (gr = 0; gr < 3; gr++)
+        for (bl = 0; bl < SCALE_BLOCK; bl++)
+            window_filter_subband_fixed(smem, &pcm[HISTORY_SIZE + gr * 12 * 32 + 32 * bl],
+                                        sb_sample[0][gr][bl]);
+}
+
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 2000;
+    static subband_mem smem;
+    static FLOAT pcm[SAMPLES];
+    static short int ipcm[SAMPLES];
+    static FLOAT sb_sample[1][3][SCALE_BLOCK][SBLIMIT];
+    static int fixed_sample[1][3][SCALE_BLOCK][SBLIMIT];
+    unsigned int sf[1][3][SBLIMIT], fixed_sf[1][3][SBLIMIT];
+    double signal = 0.0, noise = 0.0;
+    double float_time, fixed_time;
+    int differ = 0;
+    int f, i, gr, bl, sb;
+    clock_t start;
+
+    if (frames < 1) {
+        fprintf(stderr, "Usage: fixedbench [frames]\n");
+        return 1;
+    }
+
+    init_subband(&smem, SBLIMIT);
+
+    /* Compare 64 frames of tones and noise, each louder than the last */
+    srand(1);
+    for (f = 0; f < 64; f++) {
+        FLOAT level = pow(10.0, (f - 63) / 20.0);
+
+        bench_signal(ipcm, SAMPLES, 0.0313 + 0.001 * f, 0.731, level);
+        for (i = 0; i < SAMPLES; i++)
+            pcm[i] = ipcm[i] / (FLOAT) SCALE;
+        filter_float(&smem, pcm, sb_sample);
+        filter_fixed(&smem, ipcm, fixed_sample);
+
+        for (gr = 0; gr < 3; gr++)
+            for (bl = 0; bl < SCALE_BLOCK; bl++)
+                for (sb = 0; sb < SBLIMIT; sb++) {
+                    FLOAT x = sb_sample[0][gr][bl][sb];
+                    FLOAT e = x - fixed_sample[0][gr][bl][sb] / (FLOAT) (1 << FIXED_BITS);
+                    signal += x * x;
+                    noise += e * e;
+                }
+
+        scalefactor_calc(sb_sample, sf, 1, SBLIMIT);
+        scalefactor_calc_fixed(fixed_sample, fixed_sf, 1, SBLIMIT);
+        for (gr = 0; gr < 3; gr++)
+            for (sb = 0; sb < SBLIMIT; sb++)
+                if (sf[0][gr][sb] != fixed_sf[0][gr][sb])
+                    differ++;
+    }
+
+    /* How long they take */
+    start = clock();
+    for (f = 0; f < frames; f++)
+        filter_float(&smem, pcm, sb_sample);
+    float_time = bench_seconds(start);
+
+    start = clock();
+    for (f = 0; f < frames; f++)
+        filter_fixed(&smem, ipcm, fixed_sample);
+    fixed_time = bench_seconds(start);
+
+    printf("float filterbank: %7.2f us per frame\n", 1e6 * float_time / frames);
+    printf("fixed filterbank: %7.2f us per frame\n", 1e6 * fixed_time / frames);
+    printf("subband SNR %.1f dB, %i of %i scalefactors differ\n",
+           10 * log10(signal / noise), differ, 64 * 3 * SBLIMIT);
+
+    return 0;
+}
+
+
+// vim:ts=4:sw=4:nowrap:
@@ -0,0 +1,180 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "twolame.h"
+#include "common.h"
+#include "ath.h"
+#include "masking.h"
+#include "benchutil.h"
+
+
+/*
+  Micro-benchmark for the masking thresholds of psycho models 1 and 3.
+
+  Makes up some spectra with random tones and noises, and works out
+  the masking at the psycho model 3 subsampled lines in three ways:
+  checking every masker against every line (as the models used to)
+  and with masking_threshold(). Reports the time taken for each, and
+  checks that the results are exactly the same.
+
+  Usage: maskbench [spectra]
+*/
+
+#define LINES		(136)
+
+
+static FLOAT dbtable[DBTAB];
+
+
+static FLOAT add_db(FLOAT a, FLOAT b)
+{
+    FLOAT fdiff = (10.0 * (a - b));
+    int idiff;
+
+    if (fdiff > 990.0)
+        return a;
+    if (fdiff < -990.0)
+        return b;
+
+    idiff = (int) fdiff;
+    if (idiff >= 0)
+        return (a + dbtable[idiff]);
+    return (b + dbtable[-idiff]);
+}
+
+
+/* Every masker against every line */
+static void full_scan(masker_list * list, const FLOAT * bark, FLOAT * thres)
+{
+    int i, m;
+
+    for (m = 0; m < list->count; m++) {
+        for (i = 0; i < LINES; i++) {
+            FLOAT dz = bark[i] - list->bark[m];
+            if (dz >= -3.0 && dz < 8.0) {
+                FLOAT vf;
+                if (dz < -1)
+                    vf = 17 * (dz + 1) - list->lower[m];
+                else if (dz < 0)
+                    vf = list->lower[m] * dz;
+                else if (dz < 1)
+                    vf = (-17 * dz);
+                else
+                    vf = -(dz - 1) * list->upper[m] - 17;
+                thres[i] = add_db(thres[i], list->base[m] + vf);
+            }
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    int spectra = argc > 1 ? atoi(argv[1]) : 20000;
+    masker_list *lists;
+    FLOAT line_bark[HAN_SIZE + 1];
+    FLOAT bark[LINES];
+    FLOAT full[LINES], sparse[LINES];
+    double full_time, sparse_time;
+    int differ = 0;
+    int i, j, s;
+    clock_t start;
+
+    if (spectra < 1) {
+        fprintf(stderr, "Usage: maskbench [spectra]\n");
+        return 1;
+    }
+
+    for (i = 0; i < DBTAB; i++) {
+        FLOAT x = (FLOAT) i / 10.0;
+        dbtable[i] = 10 * log10(1 + pow(10.0, x / 10.0)) - x;
+    }
+
+    /* The subsampled lines of psycho model 3 at 44.1kHz */
+    for (i = 1; i <= HAN_SIZE; i++)
+        line_bark[i] = ath_freq2bark(i * 44100.0 / 1024);
+    for (i = 1, j = 0; j < LINES; j++) {
+        bark[j] = line_bark[i];
+        i += (i < 49) ? 1 : (i < 97) ? 2 : (i < 193) ? 4 : 8;
+    }
+
+    /* A tonal and a non-tonal list for each spectrum */
+    lists = (masker_list *) malloc(sizeof(masker_list) * 2 * 64);
+    if (lists == NULL)
+        return 1;
+    srand(1);
+    for (s = 0; s < 2 * 64; s++) {
+        masking_clear(&lists[s]);
+        for (i = 1; i <= HAN_SIZE; i++)
+            if (rand() % 16 == 0)
+                masking_add(&lists[s], i, 20.0 + rand() % 700 / 10.0, line_bark[i],
+                            (s & 1) ? NOISE : TONE);
+    }
+
+    /* Check that the results are the same */
+    for (s = 0; s < 64; s++) {
+        for (i = 0; i < LINES; i++)
+            full[i] = sparse[i] = DBMIN;
+        full_scan(&lists[2 * s], bark, full);
+        full_scan(&lists[2 * s + 1], bark, full);
+        masking_threshold(dbtable, &lists[2 * s], bark, LINES, sparse);
+        masking_threshold(dbtable, &lists[2 * s + 1], bark, LINES, sparse);
+        for (i = 0; i < LINES; i++)
+            if (sparse[i] != full[i])
+                differ++;
+    }
+
+    /* How long they take */
+    start = clock();
+    for (s = 0; s < spectra; s++) {
+        for (i = 0; i < LINES; i++)
+            full[i] = DBMIN;
+        full_scan(&lists[(2 * s) % 128], bark, full);
+        full_scan(&lists[(2 * s + 1) % 128], bark, full);
+    }
+    full_time = bench_seconds(start);
+
+    start = clock();
+    for (s = 0; s < spectra; s++) {
+        for (i = 0; i < LINES; i++)
+            sparse[i] = DBMIN;
+        masking_threshold(dbtable, &lists[(2 * s) % 128], bark, LINES, sparse);
+        masking_threshold(dbtable, &lists[(2 * s + 1) % 128], bark, LINES, sparse);
+    }
+    sparse_time = bench_seconds(start);
+
+    printf("full scan: %7.2f us per spectrum\n", 1e6 * full_time / spectra);
+    printf("window:    %7.2f us per spectrum, %i of %i thresholds differ\n",
+           1e6 * sparse_time / spectra, differ, 64 * LINES);
+
+    free(lists);
+    return differ ? 1 : 0;
+}
+
+
+// vim:ts=4:sw=4:nowrap:
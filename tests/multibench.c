@@ -0,0 +1,177 @@
+/*
+ *	TwoLAME: an optimized MPEG Audio Layer Two encoder
+ *
+ *	Copyright (C) 2004-2007 The TwoLAME Project
+ *
+ *	This library is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU Lesser General Public
+ *	License as published by the Free Software Foundation; either
+ *	version 2.1 of the License, or (at your option) any later version.
+ *
+ *	This library is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *	Lesser General Public License for more details.
+ *
+ *	You should have received a copy of the GNU Lesser General Public
+ *	License along with this library; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *  $Id$
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "twolame.h"
+#include "benchutil.h"
+
+
+/*
+  Benchmark for twolame_encode_frame_multi().
+
+  Makes up some mono audio for each stream, from two tones and some
+  noise, and encodes a frame of each stream in turn, first one at a
+  time and then all together (apart from the last frame, which each
+  stream encodes by itself after twolame_multi_close()).
+  Reports the time taken each way, and checks that the streams come
+  out exactly the same.
+
+  Usage: multibench [streams] [frames] [psymodel] [bitrate]
+*/
+
+
+static twolame_options *open_stream(int psymodel, int bitrate)
+{
+    twolame_options *glopts = twolame_init();
+
+    if (glopts == NULL)
+        return NULL;
+    twolame_set_num_channels(glopts, 1);
+    twolame_set_mode(glopts, TWOLAME_MONO);
+    twolame_set_in_samplerate(glopts, 44100);
+    twolame_set_out_samplerate(glopts, 44100);
+    twolame_set_psymodel(glopts, psymodel);
+    twolame_set_bitrate(glopts, bitrate);
+    if (twolame_init_params(glopts) != 0)
+        twolame_close(&glopts);
+    return glopts;
+}
+
+
+int main(int argc, char **argv)
+{
+    int num_streams = argc > 1 ? atoi(argv[1]) : 8;
+    int frames = argc > 2 ? atoi(argv[2]) : 200;
+    int psymodel = argc > 3 ? atoi(argv[3]) : 3;
+    int bitrate = argc > 4 ? atoi(argv[4]) : 96;
+    twolame_options *single[TWOLAME_MAX_STREAMS], *multi[TWOLAME_MAX_STREAMS];
+    twolame_multi *group;
+    short int *pcm;
+    unsigned char *one, *all;
+    unsigned char *mp2buffer[TWOLAME_MAX_STREAMS];
+    const short int *frame[TWOLAME_MAX_STREAMS];
+    int one_size[TWOLAME_MAX_STREAMS], all_size[TWOLAME_MAX_STREAMS];
+    int mp2_size[TWOLAME_MAX_STREAMS];
+    double single_time, multi_time;
+    int differ = 0;
+    int s, f;
+    clock_t start;
+
+    if (num_streams < 1 || num_streams > TWOLAME_MAX_STREAMS || frames < 1) {
+        fprintf(stderr, "Usage: multibench [streams (1 to %d)] [frames] [psymodel] [bitrate]\n",
+                TWOLAME_MAX_STREAMS);
+        return 1;
+    }
+
+    pcm = (short int *) malloc(sizeof(short int) * num_streams * frames * TWOLAME_SAMPLES_PER_FRAME);
+    one = (unsigned char *) malloc(num_streams * frames * TWOLAME_MAX_FRAME_BYTES);
+    all = (unsigned char *) malloc(num_streams * frames * TWOLAME_MAX_FRAME_BYTES);
+    if (pcm == NULL || one == NULL || all == NULL)
+        return 1;
+
+    /* Different audio for each stream */
+    srand(1);
+    for (s = 0; s < num_streams; s++)
+        bench_signal(pcm + s * frames * TWOLAME_SAMPLES_PER_FRAME,
+                     frames * TWOLAME_SAMPLES_PER_FRAME, 0.01 + 0.003 * s, 0.3 + 0.05 * s, 1.0);
+
+    for (s = 0; s < num_streams; s++) {
+        single[s] = open_stream(psymodel, bitrate);
+        multi[s] = open_stream(psymodel, bitrate);
+        if (single[s] == NULL || multi[s] == NULL)
+            return 1;
+        one_size[s] = all_size[s] = 0;
+    }
+
+    /* One at a time, a frame from each stream in turn as they arrive */
+    start = clock();
+    for (f = 0; f < frames; f++) {
+        for (s = 0; s < num_streams; s++) {
+            unsigned char *out = one + s * frames * TWOLAME_MAX_FRAME_BYTES;
+            const short int *p = pcm + (s * frames + f) * TWOLAME_SAMPLES_PER_FRAME;
+            int bytes = twolame_encode_frame_direct(single[s], p, NULL, out + one_size[s],
+                                                    TWOLAME_MAX_FRAME_BYTES);
+            if (bytes < 0)
+                return 1;
+            one_size[s] += bytes;
+        }
+    }
+    single_time = bench_seconds(start);
+
+    /* All together */
+    start = clock();
+    group = twolame_multi_init(multi, num_streams);
+    if (group == NULL)
+        return 1;
+    for (f = 0; f < frames - 1; f++) {
+        for (s = 0; s < num_streams; s++) {
+            frame[s] = pcm + (s * frames + f) * TWOLAME_SAMPLES_PER_FRAME;
+            mp2buffer[s] = all + s * frames * TWOLAME_MAX_FRAME_BYTES + all_size[s];
+        }
+        if (twolame_encode_frame_multi(group, frame, mp2buffer, TWOLAME_MAX_FRAME_BYTES,
+                                       mp2_size) < 0)
+            return 1;
+        for (s = 0; s < num_streams; s++)
+            all_size[s] += mp2_size[s];
+    }
+    twolame_multi_close(&group);
+    multi_time = bench_seconds(start);
+
+    /* The streams carry on by themselves for the last frame */
+    for (s = 0; s < num_streams; s++) {
+        unsigned char *out = all + s * frames * TWOLAME_MAX_FRAME_BYTES;
+        const short int *p = pcm + (s * frames + f) * TWOLAME_SAMPLES_PER_FRAME;
+        int bytes = twolame_encode_frame_direct(multi[s], p, NULL, out + all_size[s],
+                                                TWOLAME_MAX_FRAME_BYTES);
+        if (bytes < 0)
+            return 1;
+        all_size[s] += bytes;
+    }
+
+    for (s = 0; s < num_streams; s++) {
+        if (one_size[s] != all_size[s]
+            || memcmp(one + s * frames * TWOLAME_MAX_FRAME_BYTES,
+                      all + s * frames * TWOLAME_MAX_FRAME_BYTES, one_size[s]) != 0)
+            differ++;
+        twolame_close(&single[s]);
+        twolame_close(&multi[s]);
+    }
+
+    printf("one at a time: %7.2f us per stream per frame\n",
+           1e6 * single_time / (num_streams * frames));
+    printf("all together:  %7.2f us per stream per frame, %i of %i streams differ\n",
+           1e6 * multi_time / (num_streams * frames), differ, num_streams);
+
+    free(pcm);
+    free(one);
+    free(all);
+    return differ ? 1 : 0;
+}
+
+
+// vim:ts=4:sw=4:nowrap:
@@ -4,7 +4,8 @@ use warnings;
 use strict;
 
 use Digest::MD5 qw(md5_hex);
-use Test::More tests => 77;
+use File::Copy;
+use Test::More tests => 92;
 
 my $TWOLAME_CMD = $ENV{TWOLAME_CMD} || "../frontend/twolame";
 my $STWOLAME_CMD = $ENV{STWOLAME_CMD} || "../simplefrontend/stwolame";
@@ -174,6 +175,65 @@ SKIP: {
 }
 
 
+# Test encoding in segments, checked against a serial encode
+{
+  my $INPUT_FILENAME = input_filepath('testcase-44100.wav');
+  my $OUTPUT_FILENAME = 'testcase-segments.mp2';
+  my $verify = `$TWOLAME_CMD --quiet --segments 3 --verify $INPUT_FILENAME $OUTPUT_FILENAME 2>&1`;
+  is($?, 0, "converting in segments - response code");
+  like($verify, qr/all 22 frames are identical/, "converting in segments - verify against a serial encode");
+  is(md5_file($OUTPUT_FILENAME), '956f85e3647314750a1d3ed3fbf81ae3', "converting in segments - md5sum of output file");
+}
+
+
+# Test batch mode, with copies of the input files as it writes next to them
+{
+  copy(input_filepath('testcase-44100.wav'), 'testcase-batch-1.wav') or die "Copy failed: $!";
+  copy(input_filepath('testcase-22050.wav'), 'testcase-batch-2.wav') or die "Copy failed: $!";
+  my $result = system("$TWOLAME_CMD --quiet --batch --jobs 2 testcase-batch-1.wav testcase-batch-2.wav");
+  is($result, 0, "converting in batch mode - response code");
+  is(md5_file('testcase-batch-1.mp2'), '956f85e3647314750a1d3ed3fbf81ae3', "converting in batch mode - md5sum of first output file");
+  is(md5_file('testcase-batch-2.mp2'), '7919d04c191f1ef38a78a45b1a204b28', "converting in batch mode - md5sum of second output file");
+}
+
+
+# Test the lowpass filter, which leaves out the subbands above it
+{
+  my $INPUT_FILENAME = input_filepath('testcase-44100.wav');
+  my $OUTPUT_FILENAME = 'testcase-lowpass.mp2';
+  my $result = system("$TWOLAME_CMD --quiet --lowpass 10000 $INPUT_FILENAME $OUTPUT_FILENAME");
+  is($result, 0, "converting with lowpass - response code");
+  is(md5_file($OUTPUT_FILENAME), '62782027f203e41ad7063f9fc1461910', "converting with lowpass - md5sum of output file");
+}
+
+
+# Test psycho model 5, in stereo and in MPEG-2 mono
+{
+  my $INPUT_FILENAME = input_filepath('testcase-44100.wav');
+  my $OUTPUT_FILENAME = 'testcase-psy5.mp2';
+  my $result = system("$TWOLAME_CMD --quiet --psyc-mode 5 $INPUT_FILENAME $OUTPUT_FILENAME");
+  is($result, 0, "converting with psycho model 5 - response code");
+  is(md5_file($OUTPUT_FILENAME), 'a432c82c8410d55c416e7b75abfc0583', "converting with psycho model 5 - md5sum of output file");
+
+  $INPUT_FILENAME = input_filepath('testcase-22050.wav');
+  $OUTPUT_FILENAME = 'testcase-psy5-mono.mp2';
+  $result = system("$TWOLAME_CMD --quiet --psyc-mode 5 --mode mono --bitrate 64 $INPUT_FILENAME $OUTPUT_FILENAME");
+  is($result, 0, "converting mono with psycho model 5 - response code");
+  is(md5_file($OUTPUT_FILENAME), 'a16f413e755ee0399a8eac0eac6342a6', "converting mono with psycho model 5 - md5sum of output file");
+}
+
+
+# Check that the benchmarks get the same results both ways ('make check' builds them)
+foreach my $bench ('maskbench 2000', 'multibench 3 20 3', 'multibench 5 20 5') {
+  my ($program) = split(/ /, $bench);
+  SKIP: {
+    skip("$program has not been built", 1) unless (-x $program);
+    my $result = system("./$bench > /dev/null");
+    is($result, 0, "$bench - both ways agree");
+  }
+}
+
+
 ## END OF TESTS ##
 
 sub input_filepath {